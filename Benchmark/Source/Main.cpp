@@ -0,0 +1,294 @@
+/*
+ ==============================================================================
+ Scan engine benchmark
+
+ Sweeps data sizes, thread counts, tally types and scan engines, timing
+ getReduction() + getScan() (the same pair as time_scan in
+ generalscan_examples.cpp), and writes one CSV or JSON record per run.
+
+ Usage: ScanBenchmark [--min-log2 10] [--max-log2 28] [--threads 1,2,4,...]
+                      [--engines GeneralScan,GeneralScanRecursive,GeneralScanSchwartz]
+                      [--tallies SumHeap,MaxScan,LowTen,HistoScan,ExamHeap]
+                      [--reps 3] [--max-memory-mb 4096] [--format csv|json] [--out file]
+
+ Thread counts default to every count from 1 to the core count. A
+ single-threaded run is always included, as the baseline for speedup (t1 / tN)
+ and efficiency (speedup / N). GB/s counts the bytes of input read and output
+ written once each; the two-pass engines actually read the input twice. The
+ input, output and tree of each size are allocated only while it runs, and
+ sizes that would need more than --max-memory-mb are skipped (it is an error
+ if that leaves nothing to run).
+ ==============================================================================
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../../Source/GeneralScan.h"
+#include "../../Source/GeneralScanRecursive.h"
+#include "../../Source/GeneralScanSchwartz.h"
+#include "../../Source/ScanTallies.h"
+
+struct Options
+{
+    int minLog2 = 10, maxLog2 = 28;
+    std::vector<int> threads;
+    std::set<std::string> engines { "GeneralScan", "GeneralScanRecursive", "GeneralScanSchwartz" };
+    std::set<std::string> tallies { "SumHeap", "MaxScan", "LowTen", "HistoScan", "ExamHeap" };
+    int reps = 3;
+    double maxMemoryMB = 4096;
+    bool json = false;
+    std::string out;
+};
+
+struct Record
+{
+    std::string engine, tally;
+    int n, threads;
+    double bestMs, elementsPerSec, gbPerSec, speedup, efficiency;
+};
+
+static std::vector<std::string> split (const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream in (list);
+    std::string item;
+    while (std::getline (in, item, ','))
+        if (! item.empty())
+            items.push_back (item);
+    return items;
+}
+
+static bool parseArgs (int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--min-log2")
+            options.minLog2 = std::stoi (value);
+        else if (arg == "--max-log2")
+            options.maxLog2 = std::stoi (value);
+        else if (arg == "--threads")
+            for (auto& t : split (value))
+                options.threads.push_back (std::stoi (t));
+        else if (arg == "--engines")
+        {
+            auto items = split (value);
+            options.engines = std::set<std::string> (items.begin(), items.end());
+        }
+        else if (arg == "--tallies")
+        {
+            auto items = split (value);
+            options.tallies = std::set<std::string> (items.begin(), items.end());
+        }
+        else if (arg == "--reps")
+            options.reps = std::max (1, std::stoi (value));
+        else if (arg == "--max-memory-mb")
+            options.maxMemoryMB = std::stod (value);
+        else if (arg == "--format")
+            options.json = value == "json";
+        else if (arg == "--out")
+            options.out = value;
+        else
+        {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.minLog2 < 1 || options.maxLog2 > 30 || options.minLog2 > options.maxLog2)
+    {
+        std::cerr << "sizes must be within 2^1..2^30" << std::endl;
+        return false;
+    }
+    if (options.threads.empty())
+    {
+        for (int t = 1; t <= WorkStealingPool::defaultWorkers(); ++t)
+            options.threads.push_back (t);
+    }
+    options.threads.push_back (1);
+    std::sort (options.threads.begin(), options.threads.end());
+    options.threads.erase (std::unique (options.threads.begin(), options.threads.end()), options.threads.end());
+    options.threads.erase (std::remove_if (options.threads.begin(), options.threads.end(),
+                                           [] (int t) { return t < 1; }), options.threads.end());
+    return true;
+}
+
+class Benchmark
+{
+public:
+    Benchmark (const Options& options) : options (options), skipped (0)
+    {
+        for (int t : options.threads)
+            pools[t].reset (new WorkStealingPool (t));
+    }
+
+    /**
+     * Time one engine/tally combination across all the sizes and thread counts. The input is
+     * made for each size in turn, so only the size being timed is held in memory.
+     * @tparam Scanner  a tally from ScanTallies.h over the engine
+     * @param threadPerElement  if the engine needs more elements than threads (and throws otherwise)
+     */
+    template <typename Scanner, typename Elem>
+    void run (const std::string& engine, const std::string& tally, double interiorBytesPerElement,
+              bool threadPerElement)
+    {
+        if (options.engines.count (engine) == 0 || options.tallies.count (tally) == 0)
+            return;
+        typedef typename Scanner::ScanData::value_type Result;
+        double bytes = sizeof (Elem) + sizeof (Result);
+        for (int log2 = options.minLog2; log2 <= options.maxLog2; ++log2)
+        {
+            int n = 1 << log2;
+            if (n * (bytes + interiorBytesPerElement) > options.maxMemoryMB * 1024 * 1024)
+            {
+                std::cerr << "skipping " << engine << " " << tally << " n=" << n << ": over memory limit" << std::endl;
+                ++skipped;
+                continue;
+            }
+            std::vector<Elem> data (n);
+            fill (data);
+            typename Scanner::ScanData output (n);
+            double baseline = 0;
+            for (int threads : options.threads)
+            {
+                if (threadPerElement && threads >= n)
+                    continue;
+                double best = std::numeric_limits<double>::max();
+                for (int r = 0; r < options.reps; ++r)
+                {
+                    Scanner scanner (data, threads, pools[threads].get());
+                    auto start = std::chrono::steady_clock::now();
+                    scanner.getReduction();
+                    scanner.getScan (&output);
+                    auto end = std::chrono::steady_clock::now();
+                    best = std::min (best, std::chrono::duration<double, std::milli> (end - start).count());
+                }
+                if (threads == 1)
+                    baseline = best;
+                Record record;
+                record.engine = engine;
+                record.tally = tally;
+                record.n = n;
+                record.threads = threads;
+                record.bestMs = best;
+                record.elementsPerSec = n / (best / 1000);
+                record.gbPerSec = n * bytes / (best / 1000) / 1e9;
+                record.speedup = baseline / best;
+                record.efficiency = record.speedup / threads;
+                records.push_back (record);
+                std::cerr << engine << " " << tally << " n=" << n << " threads=" << threads
+                          << ": " << best << "ms" << std::endl;
+            }
+        }
+    }
+
+    template <template <typename, typename, typename> class Engine>
+    void runEngine (const std::string& engine, bool fullTree)
+    {
+        // GeneralScan and GeneralScanRecursive keep a tally per interior node
+        double tree = fullTree ? 1.0 : 0.0;
+        // GeneralScanSchwartz throws unless there are more elements than threads
+        bool threadPerElement = ! fullTree;
+        run<SumTally<Engine<int, int, int>>, int> (engine, "SumHeap", tree * sizeof (int), threadPerElement);
+        run<MaxTally<Engine<int, int, int>>, int> (engine, "MaxScan", tree * sizeof (int), threadPerElement);
+        run<LowTenTally<Engine<int, Ten, Ten>>, int> (engine, "LowTen", tree * sizeof (Ten), threadPerElement);
+        run<HistoTally<Engine<int, Histo, Histo>>, int> (engine, "HistoScan", tree * sizeof (Histo),
+                                                         threadPerElement);
+        run<ExamTally<Engine<double, double, double>>, double> (engine, "ExamHeap", tree * sizeof (double),
+                                                                threadPerElement);
+    }
+
+    /**
+     * @return if nothing was timed because every size was over --max-memory-mb
+     */
+    bool allOverMemoryLimit() const
+    {
+        return records.empty() && skipped > 0;
+    }
+
+    void write (std::ostream& out) const
+    {
+        if (options.json)
+        {
+            out << "[\n";
+            for (size_t i = 0; i < records.size(); ++i)
+            {
+                const Record& r = records[i];
+                out << "  {\"engine\": \"" << r.engine << "\", \"tally\": \"" << r.tally
+                    << "\", \"n\": " << r.n << ", \"threads\": " << r.threads
+                    << ", \"best_ms\": " << r.bestMs << ", \"elements_per_s\": " << r.elementsPerSec
+                    << ", \"gb_per_s\": " << r.gbPerSec << ", \"speedup\": " << r.speedup
+                    << ", \"efficiency\": " << r.efficiency << "}" << (i + 1 < records.size() ? "," : "") << "\n";
+            }
+            out << "]\n";
+        }
+        else
+        {
+            out << "engine,tally,n,threads,best_ms,elements_per_s,gb_per_s,speedup,efficiency\n";
+            for (const Record& r : records)
+                out << r.engine << "," << r.tally << "," << r.n << "," << r.threads << "," << r.bestMs << ","
+                    << r.elementsPerSec << "," << r.gbPerSec << "," << r.speedup << "," << r.efficiency << "\n";
+        }
+    }
+
+private:
+    const Options& options;
+    std::map<int, std::unique_ptr<WorkStealingPool>> pools;  // one per thread count, so N threads means N
+    std::vector<Record> records;
+    int skipped;
+
+    static void fill (std::vector<int>& data)
+    {
+        for (size_t i = 0; i < data.size(); ++i)
+            data[i] = (int) (((unsigned) i * 2654435761u) >> 29);  // 0..7, so a 2^28 sum still fits in an int
+    }
+
+    static void fill (std::vector<double>& data)
+    {
+        for (size_t i = 0; i < data.size(); ++i)
+            data[i] = (((unsigned) i * 2654435761u) >> 22) * 1e-6;  // miss probabilities up to 0.001
+    }
+};
+
+int main (int argc, char* argv[])
+{
+    Options options;
+    if (! parseArgs (argc, argv, options))
+        return 1;
+
+    Benchmark benchmark (options);
+    benchmark.runEngine<GeneralScan> ("GeneralScan", true);
+    benchmark.runEngine<GeneralScanRecursive> ("GeneralScanRecursive", true);
+    benchmark.runEngine<GeneralScanSchwartz> ("GeneralScanSchwartz", false);
+    if (benchmark.allOverMemoryLimit())
+    {
+        std::cerr << "nothing to run: even n=2^" << options.minLog2 << " needs more than --max-memory-mb "
+                  << options.maxMemoryMB << std::endl;
+        return 1;
+    }
+
+    if (options.out.empty())
+    {
+        benchmark.write (std::cout);
+    }
+    else
+    {
+        std::ofstream file (options.out);
+        benchmark.write (file);
+    }
+    return 0;
+}
@@ -0,0 +1,367 @@
+/*
+ ==============================================================================
+ Headless MIDI heatmap pipeline
+
+ Runs the app's pipeline (load the MIDI file, extract the notes, build the
+ heatmap) on the given files without any GUI or display, and prints how long
+ each stage took as one CSV record per file. Batch mode (--batch, see
+ Source/CorpusBatch.h), offline rendering of the animation (--render, see
+ Source/HeatmapRenderer.h) and the live input latency benchmark (--live, see
+ Source/LiveHeatmap.h) are available here too. Any of them takes --trace <json
+ file> to write a Chrome trace of the run (see Source/Trace.h; needs a build
+ with MIDI_TRACE=1).
+
+ Usage: MidiPipeline [--loader smf|midifile|notemap|cache] [--engine auto|sweep|scan]
+                     [--threads n] [--reps 1] [--counts] [--cache-dir <directory>] file...
+        MidiPipeline --batch <directory or list file> [--out <directory>]
+                     [--report <csv file>] [--threads n] [--max-memory-mb 1024]
+        MidiPipeline --render <midi file> --out <file> [--format rgba|png]
+                     [--fps 30] [--width 600] [--height 370] [--keys 12|88|128]
+                     [--heat decay|sounding] [--threads n]
+        MidiPipeline --live <midi file> [--rate 10000] [--seconds 5] [--fps 60]
+                     [--width 600] [--height 370] [--keys 12|88|128] [--heat decay|sounding]
+
+ Loaders: smf maps the file and decodes it with SmfReader (the load stage is
+ just the mapping; pages are read in as the notes stage touches them);
+ midifile reads a juce::MidiFile and extracts a NoteStore with getNoteStore;
+ notemap is the original getNoteMap and NoteMap scanNoteMap, which ignore
+ --engine (getNoteMap reads the tracks on the --threads pool, scanNoteMap is
+ serial; their map nodes come from a per-file Arena, see Source/Arena.h);
+ cache goes through the heatmap cache (Source/HeatmapCache.h, in --cache-dir
+ or the app's own): the load stage maps and hashes the file and looks up its
+ entry, and on a hit the notes and heatmap stages copy them out of the entry
+ (on a miss they read and build them as smf does, and the heatmap stage
+ includes computing the keyframes and decaying heat and writing the entry).
+ Engines: sweep is the serial sweepHeatmap, scan the parallel scanHeatmap
+ (frames found and counted by NoteHistoScan), auto chooses by size as the app
+ does. --counts adds a stage computing the active-note counts at every frame.
+ Each stage's time is the best of --reps runs.
+ ==============================================================================
+ */
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../../Source/FileUtils.h"
+#include "../../Source/MidiUtils.h"
+#include "../../Source/CorpusBatch.h"
+#include "../../Source/HeatmapCache.h"
+#include "../../Source/HeatmapRenderer.h"
+#include "../../Source/LiveHeatmap.h"
+#include "../../Source/Trace.h"
+
+// counts the heap allocations for the trace (nothing unless built with MIDI_TRACE=1)
+MIDI_TRACE_ALLOCATION_HOOKS()
+
+struct Options
+{
+    std::string loader = "smf", engine = "auto", cacheDir;
+    int threads = WorkStealingPool::defaultWorkers();
+    int reps = 1;
+    bool counts = false;
+    std::vector<std::string> files;
+};
+
+struct StageTimes
+{
+    double loadMs, notesMs, heatmapMs, countsMs;
+    int notes = 0, frames = 0;
+
+    StageTimes() : loadMs (0), notesMs (0), heatmapMs (0), countsMs (0) {}
+
+    void keepBest (const StageTimes& other)
+    {
+        loadMs = std::min (loadMs, other.loadMs);
+        notesMs = std::min (notesMs, other.notesMs);
+        heatmapMs = std::min (heatmapMs, other.heatmapMs);
+        countsMs = std::min (countsMs, other.countsMs);
+    }
+};
+
+static bool parseArgs (int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--counts")
+        {
+            options.counts = true;
+            continue;
+        }
+        if (arg.compare (0, 2, "--") != 0)
+        {
+            options.files.push_back (arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--loader")
+            options.loader = value;
+        else if (arg == "--engine")
+            options.engine = value;
+        else if (arg == "--threads")
+            options.threads = std::max (1, std::stoi (value));
+        else if (arg == "--reps")
+            options.reps = std::max (1, std::stoi (value));
+        else if (arg == "--cache-dir")
+            options.cacheDir = value;
+        else
+        {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.loader != "smf" && options.loader != "midifile" && options.loader != "notemap"
+        && options.loader != "cache")
+    {
+        std::cerr << "unknown loader " << options.loader << std::endl;
+        return false;
+    }
+    if (options.engine != "auto" && options.engine != "sweep" && options.engine != "scan")
+    {
+        std::cerr << "unknown engine " << options.engine << std::endl;
+        return false;
+    }
+    if (options.files.empty())
+    {
+        std::cerr << "no MIDI files given" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static double millisecondsSince (std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * The counts stage, if asked for.
+ */
+static void runCountsStage (const NoteStore& notes, const Options& options, WorkStealingPool& pool,
+                            StageTimes& times)
+{
+    if (options.counts)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<NoteEvent> events = getNoteEvents (notes, pool);
+        NoteHistoScan scanner (events, pool.size(), &pool);
+        NoteHistoScan::ScanData counts (scanner.numFrames());
+        scanner.getScan (&counts);
+        times.countsMs = millisecondsSince (start);
+    }
+}
+
+/**
+ * The heatmap stage (and the counts stage, if asked for) on a NoteStore.
+ */
+static void runHeatmapStages (const NoteStore& notes, const Options& options, WorkStealingPool& pool,
+                              StageTimes& times)
+{
+    auto start = std::chrono::steady_clock::now();
+    HeatmapList heatmap;
+    if (options.engine == "sweep")
+        sweepHeatmap (notes, heatmap, pool);
+    else if (options.engine == "scan")
+        scanHeatmap (notes, heatmap, nullptr, pool);
+    else
+        buildHeatmap (notes, heatmap, pool);
+    times.heatmapMs = millisecondsSince (start);
+    times.frames = heatmap.size();
+    runCountsStage (notes, options, pool, times);
+}
+
+/**
+ * One run of the whole pipeline on a file.
+ * @throws exception (as readInMidiFile, or invalid_argument) if the file can't be read
+ */
+static StageTimes runPipeline (const File& file, const Options& options, WorkStealingPool& pool)
+{
+    StageTimes times;
+    auto start = std::chrono::steady_clock::now();
+    if (options.loader == "smf")
+    {
+        MemoryMappedFile mappedFile (file, MemoryMappedFile::readOnly);
+        if (mappedFile.getData() == nullptr)
+            throw std::invalid_argument ("can't read the file");
+        SmfReader reader ((const uint8_t*) mappedFile.getData(), mappedFile.getSize());
+        times.loadMs = millisecondsSince (start);
+
+        start = std::chrono::steady_clock::now();
+        NoteStore notes = reader.readNotes (pool);
+        times.notesMs = millisecondsSince (start);
+        times.notes = notes.size();
+        runHeatmapStages (notes, options, pool, times);
+    }
+    else if (options.loader == "cache")
+    {
+        MemoryMappedFile mappedFile (file, MemoryMappedFile::readOnly);
+        if (mappedFile.getData() == nullptr)
+            throw std::invalid_argument ("can't read the file");
+        const uint8_t* bytes = (const uint8_t*) mappedFile.getData();
+        uint64_t sourceHash = hashContent (bytes, mappedFile.getSize()), sourceSize = mappedFile.getSize();
+        HeatmapCache cache (options.cacheDir.empty() ? HeatmapCache::getDefaultDirectory()
+                                                     : File::getCurrentWorkingDirectory().getChildFile (options.cacheDir));
+        std::unique_ptr<CachedHeatmap> cached = cache.find (sourceHash, sourceSize);
+        times.loadMs = millisecondsSince (start);
+
+        start = std::chrono::steady_clock::now();
+        NoteStore notes;
+        if (cached != nullptr)
+            cached->copyTo (notes);
+        else
+            notes = SmfReader (bytes, mappedFile.getSize()).readNotes (pool);
+        times.notesMs = millisecondsSince (start);
+        times.notes = notes.size();
+
+        start = std::chrono::steady_clock::now();
+        HeatmapList heatmap;
+        if (cached != nullptr)
+            cached->copyTo (heatmap);
+        else
+        {
+            buildHeatmap (notes, heatmap, pool);
+            cache.store (sourceHash, sourceSize, heatmap, notes, pool);
+        }
+        times.heatmapMs = millisecondsSince (start);
+        times.frames = heatmap.size();
+        runCountsStage (notes, options, pool, times);
+    }
+    else
+    {
+        MidiFile midiFile = readInMidiFile (file.getFullPathName());
+        times.loadMs = millisecondsSince (start);
+
+        start = std::chrono::steady_clock::now();
+        if (options.loader == "midifile")
+        {
+            NoteStore notes = getNoteStore (midiFile, pool);
+            times.notesMs = millisecondsSince (start);
+            times.notes = notes.size();
+            runHeatmapStages (notes, options, pool, times);
+        }
+        else
+        {
+            Arena arena;  // every node of both maps, freed at once when the run is done
+            NoteMap noteMap = getNoteMap (midiFile, &arena, pool);
+            times.notesMs = millisecondsSince (start);
+            times.notes = (int) noteMap.size();
+
+            start = std::chrono::steady_clock::now();
+            std::unique_ptr<HeatmapList> heatmap (scanNoteMap (noteMap));
+            times.heatmapMs = millisecondsSince (start);
+            times.frames = heatmap->size();
+        }
+    }
+    return times;
+}
+
+/**
+ * Writes the trace recorded since --trace turned it on, if it did.
+ */
+static int finishTrace (const std::string& traceFile, int exitCode)
+{
+   #if MIDI_TRACE
+    if (! traceFile.empty())
+    {
+        Trace::stop();
+        std::ofstream out (traceFile);
+        Trace::writeChromeJson (out);
+        std::cerr << Trace::size() << " trace events written to " << traceFile << std::endl;
+    }
+   #else
+    (void) traceFile;
+   #endif
+    return exitCode;
+}
+
+static int runMode (int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; ++i)
+        args.add (argv[i]);
+    if (args.contains ("--batch"))
+        return runCorpusBatch (args, std::cout);
+    if (args.contains ("--render"))
+        return runHeatmapRender (args, std::cout);
+    if (args.contains ("--live"))
+        return runLiveBench (args, std::cout);
+
+    Options options;
+    if (! parseArgs (argc, argv, options))
+        return 1;
+
+    WorkStealingPool pool (options.threads);
+    std::cout << "file,loader,engine,threads,notes,frames,load_ms,notes_ms,heatmap_ms,counts_ms,total_ms\n";
+    int failed = 0;
+    for (auto& path : options.files)
+    {
+        File file = File::getCurrentWorkingDirectory().getChildFile (path);
+        try
+        {
+            StageTimes best;
+            best.loadMs = best.notesMs = best.heatmapMs = best.countsMs = std::numeric_limits<double>::max();
+            for (int r = 0; r < options.reps; ++r)
+            {
+                StageTimes times = runPipeline (file, options, pool);
+                best.keepBest (times);
+                best.notes = times.notes;
+                best.frames = times.frames;
+            }
+            double total = best.loadMs + best.notesMs + best.heatmapMs + best.countsMs;
+            std::cout << file.getFullPathName() << "," << options.loader << "," << options.engine << ","
+                      << options.threads << "," << best.notes << "," << best.frames << "," << best.loadMs << ","
+                      << best.notesMs << "," << best.heatmapMs << "," << best.countsMs << "," << total << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << path << ": " << e.what() << std::endl;
+            ++failed;
+        }
+        catch (const char* error)
+        {
+            std::cerr << path << ": " << error << std::endl;
+            ++failed;
+        }
+        catch (const String& error)
+        {
+            std::cerr << path << ": " << error << std::endl;
+            ++failed;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+int main (int argc, char* argv[])
+{
+    // --trace <file> applies to every mode, so it is taken out before they see the arguments
+    std::string traceFile;
+    std::vector<char*> modeArgs;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (i > 0 && i + 1 < argc && std::string (argv[i]) == "--trace")
+            traceFile = argv[++i];
+        else
+            modeArgs.push_back (argv[i]);
+    }
+    if (! traceFile.empty())
+    {
+       #if MIDI_TRACE
+        MIDI_TRACE_THREAD ("main");
+        Trace::start();
+       #else
+        std::cerr << "tracing is compiled out: build with MIDI_TRACE=1 to use --trace" << std::endl;
+       #endif
+    }
+    return finishTrace (traceFile, runMode ((int) modeArgs.size(), modeArgs.data()));
+}
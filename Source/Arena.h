@@ -0,0 +1,202 @@
+/**
+ * @file Arena.h - per-file memory arena for the node-based containers of the NoteMap pipeline
+ *
+ * getNoteMap and scanNoteMap(NoteMap&) build std::multimaps, which allocate a node per note on
+ * the heap and free each one again when the map goes away: two heap calls per note for the
+ * notes, two more per note for the pending note-offs. An Arena hands memory out of large
+ * chunks instead (a bump of a pointer), keeps blocks given back on a free list per size so
+ * the pending note-offs reuse the nodes of the ones already erased, and returns every chunk to
+ * the heap in one release() (or its destructor) once the file is done with.
+ *
+ * An arena is not thread-safe: use it from one thread at a time.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+/**
+ * Chunked bump allocator with free lists for small blocks.
+ */
+class Arena {
+public:
+    /**
+     * Size of the first chunk; each further chunk is twice the last, up to MAX_CHUNK.
+     */
+    static const size_t FIRST_CHUNK = 1 << 16;
+    static const size_t MAX_CHUNK = 1 << 24;
+
+    /**
+     * Blocks up to this size are recycled when given back, in size classes of ALIGNMENT bytes.
+     */
+    static const size_t MAX_RECYCLED = 256;
+
+    /**
+     * Alignment of every block (enough for any type the containers hold).
+     */
+    static const size_t ALIGNMENT = 16;
+
+    Arena() : chunks(nullptr), next(nullptr), end(nullptr), nextChunk(FIRST_CHUNK), reserved(0), allocations(0) {
+        for (void *&list : freeLists)
+            list = nullptr;
+    }
+
+    ~Arena() {
+        release();
+    }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /**
+     * @param bytes  size of the block
+     * @param align  its alignment, at most ALIGNMENT
+     * @return a block that stays valid until it is given back or the arena is released
+     */
+    void *allocate(size_t bytes, size_t align = ALIGNMENT) {
+        (void) align;
+        bytes = roundUp(bytes > 0 ? bytes : 1);
+        allocations++;
+        if (bytes <= MAX_RECYCLED) {
+            void *&list = freeLists[bytes / ALIGNMENT - 1];
+            if (list != nullptr) {
+                void *block = list;
+                list = *static_cast<void **>(block);
+                return block;
+            }
+        }
+        if ((size_t) (end - next) < bytes)
+            addChunk(bytes);
+        void *block = next;
+        next += bytes;
+        return block;
+    }
+
+    /**
+     * Gives a block back: small ones are kept for allocate to hand out again, larger ones stay
+     * allocated until the arena is released.
+     * @param bytes  the size it was allocated with
+     */
+    void deallocate(void *block, size_t bytes) {
+        bytes = roundUp(bytes > 0 ? bytes : 1);
+        if (block != nullptr && bytes <= MAX_RECYCLED) {
+            void *&list = freeLists[bytes / ALIGNMENT - 1];
+            *static_cast<void **>(block) = list;
+            list = block;
+        }
+    }
+
+    /**
+     * Frees every chunk at once. Nothing allocated from the arena may be used after this.
+     */
+    void release() {
+        while (chunks != nullptr) {
+            Chunk *chunk = chunks;
+            chunks = chunk->previous;
+            ::operator delete(chunk);
+        }
+        for (void *&list : freeLists)
+            list = nullptr;
+        next = end = nullptr;
+        nextChunk = FIRST_CHUNK;
+        reserved = 0;
+    }
+
+    /**
+     * @return bytes taken from the heap in chunks
+     */
+    size_t getReserved() const {
+        return reserved;
+    }
+
+    /**
+     * @return blocks allocated since the arena was created
+     */
+    size_t getAllocations() const {
+        return allocations;
+    }
+
+private:
+    // each chunk starts with a link to the one before, padded to keep the blocks aligned
+    struct Chunk {
+        Chunk *previous;
+    };
+    static const size_t HEADER = (sizeof(Chunk) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    Chunk *chunks;
+    char *next, *end;  // the unused part of the newest chunk
+    size_t nextChunk, reserved, allocations;
+    void *freeLists[MAX_RECYCLED / ALIGNMENT];
+
+    static size_t roundUp(size_t bytes) {
+        return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    /**
+     * Starts a new chunk with room for at least the given bytes; what was left of the last one
+     * is abandoned.
+     */
+    void addChunk(size_t bytes) {
+        size_t size = nextChunk;
+        while (size < bytes + HEADER)
+            size *= 2;
+        if (nextChunk < MAX_CHUNK)
+            nextChunk *= 2;
+        Chunk *chunk = static_cast<Chunk *>(::operator new(size));
+        chunk->previous = chunks;
+        chunks = chunk;
+        next = reinterpret_cast<char *>(chunk) + HEADER;
+        end = reinterpret_cast<char *>(chunk) + size;
+        reserved += size;
+    }
+};
+
+/**
+ * Standard allocator drawing from an Arena, for the node-based containers. One without an
+ * arena uses the heap, so containers that use it can still be made without one.
+ */
+template<typename T>
+class ArenaAllocator {
+    static_assert(alignof(T) <= Arena::ALIGNMENT, "type needs more alignment than an Arena gives");
+
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena *arena = nullptr) noexcept : arena(arena) {
+    }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept : arena(other.getArena()) {
+    }
+
+    T *allocate(size_t n) {
+        if (arena == nullptr)
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        if (arena == nullptr)
+            ::operator delete(p);
+        else
+            arena->deallocate(p, n * sizeof(T));
+    }
+
+    Arena *getArena() const noexcept {
+        return arena;
+    }
+
+private:
+    Arena *arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) noexcept {
+    return a.getArena() == b.getArena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) noexcept {
+    return a.getArena() != b.getArena();
+}
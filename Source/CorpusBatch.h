@@ -0,0 +1,287 @@
+/**
+ * @file CorpusBatch.h - heatmaps for a whole corpus of MIDI files
+ *
+ * Every file goes through the same pipeline as the app's single example file (load the notes,
+ * build the heatmap), but files are processed concurrently, one task per file on a
+ * WorkStealingPool; a large file's own stages fork onto the same pool. To bound the memory in
+ * flight, each file is admitted, in order, as soon as its estimated working memory fits in what
+ * the files still running leave of the budget, and gives its share back when it finishes. A
+ * corpus of any size needs no more than the budget (or one file's worth, for a file larger
+ * than the budget, which then runs alone), and one large file never holds up the others'
+ * cores while there is memory for them.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "WorkStealingPool.h"
+#include "SmfReader.h"
+#include "HeatmapScan.h"
+
+/**
+ * Working memory of the pipeline per byte of MIDI file, for the memory budget: a note takes at
+ * least 6 bytes of file and about 170 bytes at the peak (the note store and its sort order, the
+ * sorted events, the heatmap), plus the mapped file itself.
+ */
+static const int BATCH_BYTES_PER_FILE_BYTE = 32;
+
+/**
+ * What happened to one file of a batch.
+ */
+struct BatchFileResult
+{
+    String path;
+    int64 bytes = 0;
+    int notes = 0, frames = 0;
+    double loadMs = 0, scanMs = 0, writeMs = 0;
+    String error;  // empty if the file was processed
+};
+
+struct BatchOptions
+{
+    int threads = WorkStealingPool::defaultWorkers();
+    double maxMemoryMB = 1024;
+    File outputDir;  // heatmaps are written here, if set
+};
+
+/**
+ * Writes a heatmap as its packed arrays: "PMHM", the frame and event counts (little-endian),
+ * then the timestamps, offsets, splits and events arrays as they are in memory.
+ */
+static bool writeHeatmapFile(const HeatmapList& heatmap, const File& file)
+{
+    file.deleteFile();
+    FileOutputStream out(file);
+    if (!out.openedOk())
+        return false;
+    out.write("PMHM", 4);
+    out.writeInt(heatmap.size());
+    out.writeInt(heatmap.numEvents());
+    out.write(heatmap.timestamps.data(), heatmap.timestamps.size() * sizeof(double));
+    out.write(heatmap.offsets.data(), heatmap.offsets.size() * sizeof(int));
+    out.write(heatmap.splits.data(), heatmap.splits.size() * sizeof(int));
+    out.write(heatmap.events.data(), heatmap.events.size());
+    out.flush();
+    return out.getStatus().wasOk();
+}
+
+/**
+ * The MIDI files to process: every .mid/.midi file under a directory, or the files named one
+ * per line in a list file.
+ */
+static Array<File> findBatchFiles(const File& directoryOrList)
+{
+    Array<File> files;
+    if (directoryOrList.isDirectory())
+    {
+        files = directoryOrList.findChildFiles(File::findFiles, true, "*.mid;*.midi");
+    }
+    else
+    {
+        StringArray lines;
+        directoryOrList.readLines(lines);
+        for (auto& line : lines)
+            if (line.trim().isNotEmpty())
+                files.add(File::getCurrentWorkingDirectory().getChildFile(line.trim()));
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+class CorpusBatch
+{
+public:
+    CorpusBatch(const BatchOptions& options)
+        : options(options), pool(options.threads), next(0), running(0), inFlight(0)
+    {
+    }
+
+    /**
+     * Processes all the files, up to one per worker at a time, within the memory budget.
+     * @return one result per file, in the same order
+     */
+    std::vector<BatchFileResult> run(const Array<File>& files)
+    {
+        std::vector<BatchFileResult> results(files.size());
+        std::vector<double> estimates(files.size());
+        for (int f = 0; f < files.size(); ++f)
+            estimates[f] = (double) files[f].getSize() * BATCH_BYTES_PER_FILE_BYTE;
+        next = 0;
+        inFlight = 0;
+        running = 0;
+
+        // each feeder admits the next file, waits on the pool while it is processed, and gives
+        // its memory back; the feeders block on the budget, so the pool's workers never do
+        std::vector<std::thread> feeders;
+        for (int t = 0; t < std::min(pool.size(), files.size()); ++t)
+            feeders.emplace_back([&] {
+                for (int f = admit(estimates); f >= 0; f = admit(estimates))
+                {
+                    pool.run([&] { results[f] = processFile(files[f]); });
+                    release(estimates[f]);
+                }
+            });
+        for (auto& feeder : feeders)
+            feeder.join();
+        return results;
+    }
+
+private:
+    const BatchOptions& options;
+    WorkStealingPool pool;
+    std::mutex budgetLock;
+    std::condition_variable budgetFreed;
+    int next, running;  // the next file to admit, and the files admitted but not finished
+    double inFlight;    // their estimated working memory
+
+    /**
+     * Waits until the next file's estimate fits the budget (or nothing else is running) and
+     * admits it.
+     * @return the file's index, or -1 once every file has been admitted
+     */
+    int admit(const std::vector<double>& estimates)
+    {
+        std::unique_lock<std::mutex> guard(budgetLock);
+        double budget = options.maxMemoryMB * 1024 * 1024;
+        budgetFreed.wait(guard, [&] {
+            return next == (int) estimates.size() || running == 0 || inFlight + estimates[next] <= budget;
+        });
+        if (next == (int) estimates.size())
+            return -1;
+        inFlight += estimates[next];
+        ++running;
+        return next++;
+    }
+
+    void release(double estimate)
+    {
+        {
+            std::lock_guard<std::mutex> guard(budgetLock);
+            inFlight -= estimate;
+            --running;
+        }
+        budgetFreed.notify_all();
+    }
+
+    static double millisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    BatchFileResult processFile(const File& file)
+    {
+        BatchFileResult result;
+        result.path = file.getFullPathName();
+        result.bytes = file.getSize();
+        try
+        {
+            auto start = std::chrono::steady_clock::now();
+            MemoryMappedFile mappedFile(file, MemoryMappedFile::readOnly);
+            if (mappedFile.getData() == nullptr)
+                throw std::invalid_argument("can't read the file");
+            NoteStore notes = SmfReader((const uint8_t*) mappedFile.getData(), mappedFile.getSize()).readNotes(pool);
+            result.notes = notes.size();
+            result.loadMs = millisecondsSince(start);
+
+            start = std::chrono::steady_clock::now();
+            HeatmapList heatmap;
+            buildHeatmap(notes, heatmap, pool);
+            result.frames = heatmap.size();
+            result.scanMs = millisecondsSince(start);
+
+            if (options.outputDir != File())
+            {
+                start = std::chrono::steady_clock::now();
+                // the path hash keeps files of the same name in different directories apart
+                File out = options.outputDir.getChildFile(file.getFileNameWithoutExtension() + "-"
+                    + String::toHexString(file.getFullPathName().hashCode64()) + ".heatmap");
+                if (!writeHeatmapFile(heatmap, out))
+                    throw std::invalid_argument("can't write " + out.getFullPathName().toStdString());
+                result.writeMs = millisecondsSince(start);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            result.error = e.what();
+        }
+        return result;
+    }
+};
+
+/**
+ * Batch mode from the command line:
+ *   --batch <directory or list file> [--out <directory>] [--report <csv file>]
+ *   [--threads <n>] [--max-memory-mb <megabytes>]
+ * Writes a CSV line per file (to the report file, or to out) and a summary with files/s and
+ * notes/s to out.
+ * @return process exit code: 0 if every file was processed
+ */
+static int runCorpusBatch(const StringArray& args, std::ostream& out)
+{
+    BatchOptions options;
+    File input, report;
+    for (int i = 0; i < args.size(); i += 2)
+    {
+        const String& arg = args[i];
+        if (i + 1 == args.size())
+        {
+            out << "missing value for " << arg << std::endl;
+            return 1;
+        }
+        const String& value = args[i + 1];
+        File path = File::getCurrentWorkingDirectory().getChildFile(value);
+        if (arg == "--batch")
+            input = path;
+        else if (arg == "--out")
+            options.outputDir = path;
+        else if (arg == "--report")
+            report = path;
+        else if (arg == "--threads")
+            options.threads = std::max(1, value.getIntValue());
+        else if (arg == "--max-memory-mb")
+            options.maxMemoryMB = value.getDoubleValue();
+        else
+        {
+            out << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (!input.exists())
+    {
+        out << "usage: --batch <directory or list file> [--out <directory>] [--report <csv file>]"
+               " [--threads <n>] [--max-memory-mb <megabytes>]" << std::endl;
+        return 1;
+    }
+    if (options.outputDir != File())
+        options.outputDir.createDirectory();
+
+    Array<File> files = findBatchFiles(input);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BatchFileResult> results = CorpusBatch(options).run(files);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    String csv = "path,bytes,notes,frames,load_ms,scan_ms,write_ms,error\n";
+    long long notes = 0;
+    int failed = 0;
+    for (auto& result : results)
+    {
+        csv << result.path.quoted() << "," << result.bytes << "," << result.notes << "," << result.frames << ","
+            << result.loadMs << "," << result.scanMs << "," << result.writeMs << "," << result.error.quoted() << "\n";
+        notes += result.notes;
+        failed += result.error.isNotEmpty();
+    }
+    if (report != File())
+        report.replaceWithText(csv);
+    else
+        out << csv;
+    out << results.size() << " files (" << failed << " failed), " << notes << " notes in " << seconds << "s: "
+        << results.size() / seconds << " files/s, " << notes / seconds << " notes/s" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
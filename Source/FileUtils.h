@@ -9,12 +9,14 @@
 */
 
 #pragma once
+#include "SmfReader.h"
+#include "Trace.h"
 
 /**
  * Static method that returns the current project directory
  * @return String full path of the current project directory
  */
-static String getProjectFullPath(const char * jucerFilename, bool debug = false)
+inline String getProjectFullPath(const char * jucerFilename, bool debug = false)
 {
     // get current project directory
     File dir = File::getCurrentWorkingDirectory();
@@ -36,8 +38,9 @@ static String getProjectFullPath(const char * jucerFilename, bool debug = false)
  * Method that reads a midi file from the provided full path.
  * @throws exception if file doesn't exist or MIDI file could not be read
  */
-static MidiFile readInMidiFile(const String& path)
+inline MidiFile readInMidiFile(const String& path)
 {
+    MIDI_TRACE_SPAN("read file", "stage");
     File fileToRead(path);
     if (fileToRead.existsAsFile())
     {
@@ -51,3 +54,30 @@ static MidiFile readInMidiFile(const String& path)
     }
     throw "File doesn't exist at provided path: " + path;
 }
+
+//=============================================================================
+/**
+ * Method that reads the notes of a midi file from the provided full path, decoding them
+ * straight from the memory-mapped file (see SmfReader.h) rather than building a MidiFile.
+ * @return the notes, as getNoteStore would give them for the same file
+ * @throws exception if file doesn't exist or MIDI file could not be read
+ */
+inline NoteStore readInNoteStore(const String& path)
+{
+    File fileToRead(path);
+    if (fileToRead.existsAsFile())
+    {
+        MemoryMappedFile mappedFile(fileToRead, MemoryMappedFile::readOnly);
+        if (mappedFile.getData() != nullptr)
+        {
+            try
+            {
+                SmfReader reader((const uint8_t*) mappedFile.getData(), mappedFile.getSize());
+                return reader.readNotes();
+            }
+            catch (const std::invalid_argument&) {}
+        }
+        throw "Error reading file";
+    }
+    throw "File doesn't exist at provided path: " + path;
+}
@@ -0,0 +1,312 @@
+/**
+ * @file GeneralScanLookback.h - single-pass chunked scan with decoupled look-back
+ *
+ * GeneralScan and GeneralScanSchwartz make two passes over the data for a scan: reduce(ROOT)
+ * to fill in the tree, then scan(ROOT, ...) which prepares every element again. Once the data
+ * is larger than the last-level cache, that reads it from memory twice.
+ *
+ * Here the data is cut into chunks small enough to stay in cache, handed out in order to the
+ * threads. Each chunk is reduced, its aggregate is published, and then the thread "looks back"
+ * over the preceding chunks' published values to find the tally of everything before it:
+ * an inclusive prefix ends the look-back, a bare aggregate is folded in and the look-back keeps
+ * going. The chunk then publishes its own inclusive prefix and scans itself while it is still
+ * in cache. Every element is read from memory once.
+ */
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+#include "WorkStealingPool.h"
+#include "ScanSpan.h"
+
+/**
+ * Generalized single-pass scanning class. Subclasses supply the same four operations as for
+ * GeneralScan (init, prepare, combine, gen) and may override accum.
+ *
+ * @tparam ElemType   This is the data type of the read-only data elements.
+ * @tparam TallyType  This is the combination-result data type. This type must have a 0-arg ctor.
+ *                    Defaults to ElemType.
+ * @tparam ResultType This is the final result data type. Any final tally will be converted to this
+ *                    data type (using the gen(tally) method). Defaults to TallyType.
+ */
+template<typename ElemType, typename TallyType=ElemType, typename ResultType=TallyType>
+class GeneralScanLookback {
+public:
+    /**
+     * @class RawData - a vector of ElemType, how the raw data must be packaged for the ctor.
+     */
+    typedef std::vector<ElemType> RawData;
+
+    /**
+     * @class RawSpan - non-owning view of the raw data; converts implicitly from a RawData.
+     */
+    typedef ScanSpan<const ElemType> RawSpan;
+
+    /**
+     * @class ScanData - a vector of ResultType, used for scan output.
+     */
+    typedef std::vector<ResultType> ScanData;
+
+    /**
+     * Default number of threads to use in the parallelization.
+     */
+    static const int N_THREADS = 16;
+
+    /**
+     * Default number of elements per chunk; small enough for a chunk to still be in the L2
+     * cache when it is scanned right after being reduced.
+     */
+    static const int CHUNK = 1 << 14;
+
+    /**
+     * Construct the scanner with the given input.
+     * @param raw          input data
+     * @param n_threads    number of threads to use for parallelization, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared()
+     * @param chunk        number of elements per chunk, defaults to CHUNK
+     */
+    GeneralScanLookback(const RawData *raw, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr,
+                        int chunk = CHUNK)
+            : GeneralScanLookback(RawSpan(*raw), n_threads, pool, chunk) {
+    }
+
+    /**
+     * Construct the scanner over memory it doesn't own (which must outlive it).
+     * @param raw          input data
+     * @param n_threads    number of threads to use for parallelization, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared()
+     * @param chunk        number of elements per chunk, defaults to CHUNK
+     */
+    GeneralScanLookback(RawSpan raw, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr,
+                        int chunk = CHUNK)
+            : reduced(false), n(raw.size()), data(raw.data()), n_threads(n_threads < 1 ? 1 : n_threads),
+              pool(pool != nullptr ? pool : &WorkStealingPool::shared()), chunk(chunk),
+              n_chunks(chunk > 0 ? (n + chunk - 1) / chunk : 0), chunks(n_chunks) {
+        if (chunk < 1)
+            throw std::invalid_argument("chunk size must be positive");
+    }
+
+    virtual ~GeneralScanLookback() {
+    }
+
+    /**
+     * Get the reduction of all the data. Computed once (by the first call to this or to
+     * getScan) and then served from the stored result.
+     * @return  the reduction
+     */
+    ResultType getReduction() {
+        if (!reduced) {
+            forEachChunk([this](int c) {
+                chunks[c].aggregate = reduce(c);
+            });
+            total = init();
+            for (int c = 0; c < n_chunks; c++)
+                accum(total, chunks[c].aggregate);
+            reduced = true;
+        }
+        return gen(total);
+    }
+
+    /**
+     * Get all the scan (inclusive) results for all the input data, in a single pass.
+     * @param output  scan results (vector is indexed corresponding to input elements)
+     */
+    void getScan(ScanData *output) {
+        if ((int) output->size() < n)
+            throw std::invalid_argument("output is smaller than the data");
+        getScan(output->data());
+    }
+
+    /**
+     * Get all the scan (inclusive) results for all the input data, in a single pass.
+     * The output may be the input itself (an in-place scan); that overwrites the data, so the
+     * scanner can't be used again afterwards.
+     * @param output  random-access iterator, pointer or ScanSpan; output[j] gets the result
+     *                for input element j
+     */
+    template<typename OutputIt>
+    void getScan(OutputIt output) {
+        scanAll(output, true);
+    }
+
+    /**
+     * Get all the exclusive scan results: output[j] is the result for the elements before j
+     * (so output[0] is gen(init())).
+     * @param output  scan results (vector is indexed corresponding to input elements)
+     */
+    void getExclusiveScan(ScanData *output) {
+        if ((int) output->size() < n)
+            throw std::invalid_argument("output is smaller than the data");
+        getExclusiveScan(output->data());
+    }
+
+    /**
+     * Get all the exclusive scan results, in place or into any random-access output
+     * (see getScan).
+     * @param output  random-access iterator, pointer or ScanSpan
+     */
+    template<typename OutputIt>
+    void getExclusiveScan(OutputIt output) {
+        scanAll(output, false);
+    }
+
+protected:
+    /*
+     * These four functions must be implemented by the subclass.
+     * The fifth, accum, may be overridden by subclass to be more efficient.
+     */
+
+    /**
+     * Identity element for tally operation.
+     * So, combine(init(), prepare(x)) == prepare(x).
+     * @return identity tally element
+     */
+    virtual TallyType init() const = 0;
+
+    /**
+     * Convert an element (in the input data) to a tally.
+     * @param datum  the datum to be converted
+     * @return       the corresponding tally
+     */
+    virtual TallyType prepare(const ElemType &datum) const = 0;
+
+    /**
+     * Combine two tallies. Must be associative; left is always the earlier part of the data.
+     * @param left   one of the tallies to combine
+     * @param right  the other of the tallies to combine
+     * @return       a new tally which is the combination of left and right
+     */
+    virtual TallyType combine(const TallyType &left, const TallyType &right) const = 0;
+
+    /**
+     * Convert a tally to a result.
+     * @param tally  the resultant tally to be converted
+     * @return       the result indicated by the tally
+     */
+    virtual ResultType gen(const TallyType &tally) const = 0;
+
+    /**
+     * Combine and replace left with result.
+     * @param accumulator the tally to combine and replace
+     * @param right       the other combine operand
+     */
+    virtual void accum(TallyType &accumulator, const TallyType &right) const {
+        accumulator = combine(accumulator, right);
+    }
+
+private:
+    /*
+     * Chunk status, published with release stores: AGGREGATE means aggregate is valid,
+     * PREFIX means inclusive (everything up to and including this chunk) is valid too.
+     */
+    static const int EMPTY = 0;
+    static const int AGGREGATE = 1;
+    static const int PREFIX = 2;
+
+    struct Chunk {
+        std::atomic<int> status;
+        TallyType aggregate;
+        TallyType inclusive;
+
+        Chunk() : status(EMPTY) {}
+    };
+
+    bool reduced;  // flag to say if total is valid
+    int n; // n is size of data
+    const ElemType *data;
+    int n_threads;
+    WorkStealingPool *pool;
+    int chunk;
+    int n_chunks;
+    std::vector<Chunk> chunks;
+    TallyType total;
+
+    /**
+     * Run fn(c) for every chunk c, with chunks claimed in increasing order by n_threads tasks.
+     * Claiming in order guarantees that every chunk a look-back waits on is already being
+     * worked on by a running thread, so the look-back always finishes.
+     */
+    template<typename Fn>
+    void forEachChunk(Fn fn) {
+        std::atomic<int> next(0);
+        int tasks = n_threads < n_chunks ? n_threads : n_chunks;
+        pool->parallelFor(0, tasks, [this, &next, &fn](int) {
+            for (int c = next++; c < n_chunks; c = next++)
+                fn(c);
+        }, tasks);
+    }
+
+    int first(int c) {
+        return c * chunk;
+    }
+
+    int last(int c) {
+        return c + 1 < n_chunks ? (c + 1) * chunk : n;
+    }
+
+    TallyType reduce(int c) {
+        TallyType tally = init();
+        for (int j = first(c), end = last(c); j < end; j++)
+            accum(tally, prepare(data[j]));
+        return tally;
+    }
+
+    template<typename OutputIt>
+    void scanAll(OutputIt output, bool inclusive) {
+        for (Chunk &c: chunks)
+            c.status.store(EMPTY, std::memory_order_relaxed);
+        forEachChunk([this, output, inclusive](int c) {
+            scanChunk(c, output, inclusive);
+        });
+        total = n_chunks > 0 ? chunks[n_chunks - 1].inclusive : init();
+        reduced = true;
+    }
+
+    /**
+     * Reduce, publish, look back, publish, then scan one chunk.
+     */
+    template<typename OutputIt>
+    void scanChunk(int c, OutputIt output, bool inclusive) {
+        Chunk &self = chunks[c];
+        self.aggregate = reduce(c);
+        TallyType prior = init();
+        if (c > 0) {
+            self.status.store(AGGREGATE, std::memory_order_release);
+            prior = lookBack(c);
+        }
+        self.inclusive = combine(prior, self.aggregate);
+        self.status.store(PREFIX, std::memory_order_release);
+
+        // the chunk was just read by reduce, so this pass comes from cache
+        TallyType tally = prior;
+        for (int j = first(c), end = last(c); j < end; j++) {
+            if (inclusive) {
+                accum(tally, prepare(data[j]));
+                output[j] = gen(tally);
+            } else {
+                TallyType datum = prepare(data[j]);
+                output[j] = gen(tally);
+                accum(tally, datum);
+            }
+        }
+    }
+
+    /**
+     * Tally of everything before chunk c, from the predecessors' published values.
+     */
+    TallyType lookBack(int c) {
+        TallyType exclusive = init();
+        for (int k = c - 1; k >= 0; k--) {
+            int status;
+            while ((status = chunks[k].status.load(std::memory_order_acquire)) == EMPTY)
+                std::this_thread::yield();
+            if (status == PREFIX)
+                return combine(chunks[k].inclusive, exclusive);
+            exclusive = combine(chunks[k].aggregate, exclusive);
+        }
+        return exclusive;
+    }
+};
@@ -0,0 +1,250 @@
+/**
+ * @file GeneralScanPolicy.h - statically dispatched version of the Schwartz reduce/scan
+ *
+ * Same tree-cap algorithm as GeneralScanSchwartz, but the operations come from a policy class
+ * given as a template argument instead of virtual overrides. That lets the compiler inline
+ * prepare/combine/gen into the tight leaf loops (and vectorize them where it can).
+ */
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+#include "WorkStealingPool.h"
+#include "ScanKernels.h"
+#include "ScanSpan.h"
+
+/**
+ * Generalized reducing/scanning class whose operations are supplied by a Policy.
+ *
+ * The Policy must provide:
+ *   - typedefs ElemType, TallyType (must have a 0-arg ctor) and ResultType
+ *   - TallyType init() const                                  identity element
+ *   - TallyType prepare(const ElemType &datum) const          element to tally
+ *   - TallyType combine(const TallyType &left, const TallyType &right) const
+ *   - ResultType gen(const TallyType &tally) const            tally to result
+ * These have the same meaning as the pure virtual methods of GeneralScan. The policy object is
+ * copied into the scanner, so it may carry state (e.g., histogram bounds).
+ *
+ * It may also provide void fold(TallyType &tally, const ElemType &datum) const, which must
+ * have the same effect as tally = combine(tally, prepare(datum)); the leaf loops call it
+ * instead, saving two temporary tallies per element (see ScanKernels::HasFold).
+ *
+ * A policy over int, float or double tallies can also typedef Operator as the function object
+ * its combine is equivalent to (std::plus, std::multiplies, ScanKernels::Maximum or
+ * ScanKernels::Minimum); the leaf loops then use the SIMD kernels from ScanKernels.h.
+ *
+ * @tparam Policy  the operations for the reduce/scan
+ */
+template<typename Policy>
+class GeneralScanPolicy {
+public:
+    typedef typename Policy::ElemType ElemType;
+    typedef typename Policy::TallyType TallyType;
+    typedef typename Policy::ResultType ResultType;
+
+    /**
+     * @class RawData - a vector of ElemType, how the raw data must be packaged for the ctor.
+     */
+    typedef std::vector<ElemType> RawData;
+
+    /**
+     * @class RawSpan - non-owning view of the raw data; converts implicitly from a RawData.
+     */
+    typedef ScanSpan<const ElemType> RawSpan;
+
+    /**
+     * @class TallyData - a vector of TallyType, used for the interior nodes of the reduction.
+     */
+    typedef std::vector<TallyType> TallyData;
+
+    /**
+     * @class ScanData - a vector of ResultType, used for scan output.
+     */
+    typedef std::vector<ResultType> ScanData;
+
+    /**
+     * Interior node number of the root of the parallel reduction.
+     */
+    static const int ROOT = 0;
+
+    /**
+     * Default number of threads to use in the parallelization.
+     */
+    static const int N_THREADS = 16;
+
+    /**
+     * Construct the reducer/scanner with the given input.
+     * @param raw          input data (any non-zero size)
+     * @param n_threads    number of threads to use for parallelization, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared()
+     * @param policy       the operations, defaults to a default-constructed Policy
+     */
+    GeneralScanPolicy(const RawData *raw, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr,
+                      const Policy &policy = Policy())
+            : GeneralScanPolicy(RawSpan(*raw), n_threads, pool, policy) {
+    }
+
+    /**
+     * Construct the reducer/scanner over memory it doesn't own (which must outlive it).
+     * @param raw          input data (any non-zero size)
+     * @param n_threads    number of threads to use for parallelization, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared()
+     * @param policy       the operations, defaults to a default-constructed Policy
+     */
+    GeneralScanPolicy(RawSpan raw, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr,
+                      const Policy &policy = Policy())
+            : policy(policy), reduced(false), n(raw.size()), data(raw.data()), height(n > 1 ? ceil(log2(n)) : 0),
+              n_threads(n_threads), pool(pool != nullptr ? pool : &WorkStealingPool::shared()) {
+        if (n < 1)
+            throw std::invalid_argument("data must not be empty");
+        if (n_threads >= n)
+            throw std::invalid_argument("must be more data than threads!");
+        tasks = WorkStealingPool::tasksFor(n_threads);
+        while (tasks >= n)
+            tasks /= 2;
+        interior.resize(tasks * 2);
+    }
+
+    /**
+     * Get the result of the reduction at any node of the top of the tree. The complete
+     * reduction is computed once and subsequent requests are served from the stored results.
+     * @param i    node number (defaults to ROOT)
+     * @return     the reduction for the given node
+     * @throws invalid_argument if the node number is not stored
+     */
+    ResultType getReduction(int i = ROOT) {
+        if (i >= (int) interior.size() && i < n - 1)
+            throw std::invalid_argument("node is below the tree cap");
+        if (i >= size())
+            throw std::invalid_argument("non-existent node");
+        reduced = reduced || reduce(ROOT);
+        return policy.gen(value(i));
+    }
+
+    /**
+     * Get all the scan (inclusive) results for all the input data.
+     * @param output  scan results (vector is indexed corresponding to input elements)
+     */
+    void getScan(ScanData *output) {
+        if ((int) output->size() < n)
+            throw std::invalid_argument("output is smaller than the data");
+        getScan(output->data());
+    }
+
+    /**
+     * Get all the scan (inclusive) results for all the input data.
+     * The output may be the input itself (an in-place scan); that overwrites the data, so the
+     * scanner can't be used again afterwards.
+     * @param output  random-access iterator, pointer or ScanSpan; output[j] gets the result
+     *                for input element j
+     */
+    template<typename OutputIt>
+    void getScan(OutputIt output) {
+        reduced = reduced || reduce(ROOT);
+        scan(ROOT, policy.init(), output, true);
+    }
+
+    /**
+     * Get all the exclusive scan results: output[j] is the result for the elements before j
+     * (so output[0] is gen(init())).
+     * @param output  scan results (vector is indexed corresponding to input elements)
+     */
+    void getExclusiveScan(ScanData *output) {
+        if ((int) output->size() < n)
+            throw std::invalid_argument("output is smaller than the data");
+        getExclusiveScan(output->data());
+    }
+
+    /**
+     * Get all the exclusive scan results, in place or into any random-access output
+     * (see getScan).
+     * @param output  random-access iterator, pointer or ScanSpan
+     */
+    template<typename OutputIt>
+    void getExclusiveScan(OutputIt output) {
+        reduced = reduced || reduce(ROOT);
+        scan(ROOT, policy.init(), output, false);
+    }
+
+private:
+    Policy policy;
+    bool reduced;  // flag to say if we've already done the initial reduction
+    int n; // n is size of data
+    const ElemType *data;
+    TallyData interior; // tallies for the top of the tree, down to the leaf tasks
+    int height; // number of levels below the root, so the deepest leaves start at node 2^height - 1
+    int n_threads;
+    WorkStealingPool *pool;
+    int tasks; // number of leaf tasks the top of the tree is forked into
+
+    TallyType value(int i) {
+        if (i < n - 1)
+            return interior[i];
+        else
+            return policy.prepare(data[dataIndex(i)]);
+    }
+
+    bool reduce(int i) {
+        if (i < tasks - 1) {
+            pool->invoke([this, i] { reduce(right(i)); }, [this, i] { reduce(left(i)); });
+            interior[i] = policy.combine(value(left(i)), value(right(i)));
+        } else {
+            int lm = dataIndex(leftmost(i));
+            int count = dataIndex(rightmost(i)) - lm + 1;
+            interior[i] = ScanKernels::Leaf<Policy>::reduce(policy, data + lm, count, policy.init());
+        }
+        return true;
+    }
+
+    template<typename OutputIt>
+    void scan(int i, const TallyType &tallyPrior, OutputIt output, bool inclusive) {
+        if (i < tasks - 1) {
+            TallyType rightPrior = policy.combine(tallyPrior, value(left(i)));
+            pool->invoke([this, i, &tallyPrior, output, inclusive] { scan(left(i), tallyPrior, output, inclusive); },
+                         [this, i, &rightPrior, output, inclusive] { scan(right(i), rightPrior, output, inclusive); });
+        } else {
+            int lm = dataIndex(leftmost(i));
+            int count = dataIndex(rightmost(i)) - lm + 1;
+            ScanKernels::Leaf<Policy>::scan(policy, data + lm, count, tallyPrior, outputAt(output, lm), inclusive);
+        }
+    }
+
+    // Following are for maneuvering around the binary tree (see GeneralScanSchwartz)
+    int size() {
+        return (n - 1) + n;
+    }
+
+    int left(int i) {
+        return i * 2 + 1;
+    }
+
+    int right(int i) {
+        return left(i) + 1;
+    }
+
+    bool isLeaf(int i) {
+        return left(i) >= size();
+    }
+
+    int leftmost(int i) {
+        while (!isLeaf(i))
+            i = left(i);
+        return i;
+    }
+
+    int rightmost(int i) {
+        while (!isLeaf(i))
+            i = right(i);
+        return i;
+    }
+
+    int dataIndex(int i) {
+        int deepest = (1 << height) - 1;
+        if (i >= deepest)
+            return i - deepest;
+        else
+            return i - (n - 1) + (2 * n - 1 - deepest);
+    }
+};
@@ -1,5 +1,5 @@
 /**
- * @file GeneralScan.h - fully recursive version of a generic parallelized reduce/scan
+ * @file GeneralScanRecursive.h - fully recursive version of a generic parallelized reduce/scan
  * @author Kevin Lundeen
  * @version 3-Feb-2020
  *
@@ -7,9 +7,10 @@
  */
 
 #include <vector>
-#include <future>
 #include <cmath>
 #include <stdexcept>
+#include "WorkStealingPool.h"
+#include "ScanSpan.h"
 
 /**
  * Generalized reducing/scanning class with methods for preparing the data elements into
@@ -24,13 +25,18 @@
  *                    data type (using the gen(tally) method). Defaults to TallyType.
  */
 template<typename ElemType, typename TallyType=ElemType, typename ResultType=TallyType>
-class GeneralScan {
+class GeneralScanRecursive {
 public:
     /**
      * @class RawData - a vector of ElemType, how the raw data must be packaged for the ctor.
      */
     typedef std::vector<ElemType> RawData;
 
+    /**
+     * @class RawSpan - non-owning view of the raw data; converts implicitly from a RawData.
+     */
+    typedef ScanSpan<const ElemType> RawSpan;
+
     /**
      * @class TallyData - a vector of TallyType, used for the interior nodes of the reduction.
      */
@@ -53,20 +59,36 @@ public:
 
     /**
      * Construct the reducer/scanner with the given input.
+     * Any non-zero data size is supported; when it is not a power of 2 the bottom level of the
+     * tree is only partially filled (see dataIndex).
      * @param raw          input data
      * @param n_threads    number of threads to use for parallelization, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared(); its size
+     *                     caps how many threads actually run at once
      */
-    GeneralScan(const RawData *raw, int n_threads = N_THREADS) : reduced(false), n(raw->size()), data(raw),
-                                                                 height(ceil(log2(n))), n_threads(n_threads) {
-        if (1 << height != n)
-            throw std::invalid_argument("data size must be power of 2 for now"); // FIXME
+    GeneralScanRecursive(const RawData *raw, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr)
+            : GeneralScanRecursive(RawSpan(*raw), n_threads, pool) {
+    }
+
+    /**
+     * Construct the reducer/scanner over memory it doesn't own (which must outlive it).
+     * @param raw          input data
+     * @param n_threads    number of threads to use for parallelization, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared()
+     */
+    GeneralScanRecursive(RawSpan raw, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr)
+            : reduced(false), n(raw.size()), data(raw.data()), height(n > 1 ? ceil(log2(n)) : 0),
+              n_threads(n_threads), pool(pool != nullptr ? pool : &WorkStealingPool::shared()),
+              tasks(WorkStealingPool::tasksFor(n_threads)) {
+        if (n < 1)
+            throw std::invalid_argument("data must not be empty");
         interior = new TallyData(n - 1);
     }
 
     /**
      * Destructor removes reduction results.
      */
-    virtual ~GeneralScan() {
+    virtual ~GeneralScanRecursive() {
         delete interior;
     }
 
@@ -88,10 +110,48 @@ public:
     /**
      * Get all the scan (inclusive) results for all the input data.
      * @param output  scan results (vector is indexed corresponding to input elements)
+     * @throws invalid_argument if output is smaller than the data
      */
     void getScan(ScanData *output) {
+        if ((int) output->size() < n)
+            throw std::invalid_argument("output is smaller than the data");
+        getScan(output->data());
+    }
+
+    /**
+     * Get all the scan (inclusive) results for all the input data.
+     * The output may be the input itself (an in-place scan); that overwrites the data, so the
+     * scanner can't be used again afterwards.
+     * @param output  random-access iterator, pointer or ScanSpan; output[j] gets the result
+     *                for input element j
+     */
+    template<typename OutputIt>
+    void getScan(OutputIt output) {
         reduced = reduced || reduce(ROOT); // need to make sure reduction has already run to get the prefix tallies
-        scan(ROOT, init(), output);
+        scan(ROOT, init(), output, true);
+    }
+
+    /**
+     * Get all the exclusive scan results: output[j] is the result for the elements before j
+     * (so output[0] is gen(init())).
+     * @param output  scan results (vector is indexed corresponding to input elements)
+     * @throws invalid_argument if output is smaller than the data
+     */
+    void getExclusiveScan(ScanData *output) {
+        if ((int) output->size() < n)
+            throw std::invalid_argument("output is smaller than the data");
+        getExclusiveScan(output->data());
+    }
+
+    /**
+     * Get all the exclusive scan results, in place or into any random-access output
+     * (see getScan).
+     * @param output  random-access iterator, pointer or ScanSpan
+     */
+    template<typename OutputIt>
+    void getExclusiveScan(OutputIt output) {
+        reduced = reduced || reduce(ROOT);
+        scan(ROOT, init(), output, false);
     }
 
 protected:
@@ -136,10 +196,12 @@ protected:
 private:
     bool reduced;  // flag to say if we've already done the initial reduction
     int n; // n is size of data, n-1 is size of interior
-    const RawData *data;
+    const ElemType *data;
     TallyData *interior;
-    int height;
+    int height; // number of levels below the root, so the deepest leaves start at node 2^height - 1
     int n_threads;
+    WorkStealingPool *pool;
+    int tasks; // number of leaf tasks the top of the tree is forked into (see WorkStealingPool::tasksFor)
 
     /**
      * Get the value for a node in the tree.
@@ -150,7 +212,7 @@ private:
         if (i < n - 1)
             return interior->at(i);
         else
-            return prepare(data->at(i - (n - 1)));
+            return prepare(data[dataIndex(i)]);
     }
 
     /**
@@ -160,10 +222,8 @@ private:
      */
     bool reduce(int i) {
         if (!isLeaf(i)) {
-            if (i < n_threads - 1) {
-                auto handle = std::async(std::launch::async, &GeneralScan::reduce, this, left(i));
-                reduce(right(i));
-                handle.wait();
+            if (i < tasks - 1) {
+                pool->invoke([this, i] { reduce(left(i)); }, [this, i] { reduce(right(i)); });
             } else {
                 reduce(left(i));
                 reduce(right(i));
@@ -174,22 +234,26 @@ private:
     }
 
     /**
-     * Recursive binary-tree prefix scan (inclusive).
+     * Recursive binary-tree prefix scan.
+     * The right side's prior is computed before the left side is scanned, since an in-place
+     * scan overwrites the left side's data.
      * @param i           node number
      * @param tallyPrior  tally of all the elements to the left of this node
      * @param output      where to write the output results
+     * @param inclusive   true for an inclusive scan, false for exclusive
      */
-    void scan(int i, TallyType tallyPrior, ScanData *output) {
+    template<typename OutputIt>
+    void scan(int i, TallyType tallyPrior, OutputIt output, bool inclusive) {
         if (isLeaf(i)) {
-            output->at(i - (n - 1)) = gen(combine(tallyPrior, value(i)));
+            output[dataIndex(i)] = gen(inclusive ? combine(tallyPrior, value(i)) : tallyPrior);
         } else {
-            if (i < n_threads - 1) {
-                auto handle = std::async(std::launch::async, &GeneralScan::scan, this, left(i), tallyPrior, output);
-                scan(right(i), combine(tallyPrior, value(left(i))), output);
-                handle.wait();
+            TallyType rightPrior = combine(tallyPrior, value(left(i)));
+            if (i < tasks - 1) {
+                pool->invoke([this, i, &tallyPrior, output, inclusive] { scan(left(i), tallyPrior, output, inclusive); },
+                             [this, i, &rightPrior, output, inclusive] { scan(right(i), rightPrior, output, inclusive); });
             } else {
-                scan(left(i), tallyPrior, output);
-                scan(right(i), combine(tallyPrior, value(left(i))), output);
+                scan(left(i), tallyPrior, output, inclusive);
+                scan(right(i), rightPrior, output, inclusive);
             }
         }
     }
@@ -214,5 +278,20 @@ private:
     bool isLeaf(int i) {
         return left(i) >= size();
     }
+
+    /**
+     * Get the data index of a leaf node.
+     * The leaves are nodes n-1 through 2n-2. If n is not a power of 2, the deepest level only
+     * holds some of them, starting at node 2^height - 1. In-order, those deepest leaves come
+     * first, followed by the leaves one level up (nodes n-1 up to 2^height - 2), so every
+     * subtree still covers a contiguous range of the data.
+     */
+    int dataIndex(int i) {
+        int deepest = (1 << height) - 1;
+        if (i >= deepest)
+            return i - deepest;
+        else
+            return i - (n - 1) + (2 * n - 1 - deepest);
+    }
 };
 
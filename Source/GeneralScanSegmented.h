@@ -0,0 +1,268 @@
+/**
+ * @file GeneralScanSegmented.h - segmented reduce/scan over one array of many sequences
+ *
+ * A merged stream (e.g., the events of every MIDI channel, one channel after another) is
+ * scanned as one array, with the tally reset at the first element of every segment. All the
+ * segments go through a single parallel pass, so thousands of tiny segments cost no more than
+ * one long one, instead of paying a scanner's startup per segment.
+ *
+ * The tree is the same tree-cap as GeneralScanPolicy. Each node's tally also records whether
+ * a segment starts inside it; combining with a right side that holds a segment head just keeps
+ * the right side's tally, which makes the segmented operation associative again.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+#include "WorkStealingPool.h"
+#include "ScanSpan.h"
+
+/**
+ * Segmented reducing/scanning class whose operations are supplied by a Policy, with the same
+ * requirements as for GeneralScanPolicy (the Operator typedef is not used).
+ *
+ * Segments are given either as head flags (non-zero for the first element of a segment) or as
+ * the ascending offsets of the segment starts. Element 0 always starts a segment.
+ *
+ * @tparam Policy  the operations for the reduce/scan
+ */
+template<typename Policy>
+class GeneralScanSegmented {
+public:
+    typedef typename Policy::ElemType ElemType;
+    typedef typename Policy::TallyType TallyType;
+    typedef typename Policy::ResultType ResultType;
+
+    /**
+     * @class RawSpan - non-owning view of the raw data; converts implicitly from a vector.
+     */
+    typedef ScanSpan<const ElemType> RawSpan;
+
+    /**
+     * @class HeadSpan - one flag per element, non-zero where a segment starts.
+     */
+    typedef ScanSpan<const unsigned char> HeadSpan;
+
+    /**
+     * @class OffsetSpan - ascending indices of the segment starts.
+     */
+    typedef ScanSpan<const int> OffsetSpan;
+
+    /**
+     * @class ScanData - a vector of ResultType, used for scan output.
+     */
+    typedef std::vector<ResultType> ScanData;
+
+    /**
+     * Default number of threads to use in the parallelization.
+     */
+    static const int N_THREADS = 16;
+
+    /**
+     * Construct the scanner with segments marked by head flags.
+     * @param raw          input data (any non-zero size)
+     * @param flags        segment-head flags, one per element; must outlive the scanner
+     * @param n_threads    number of threads to use for parallelization, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared()
+     * @param policy       the operations, defaults to a default-constructed Policy
+     * @throws invalid_argument if there isn't one flag per element
+     */
+    GeneralScanSegmented(RawSpan raw, HeadSpan flags, int n_threads = N_THREADS,
+                         WorkStealingPool *pool = nullptr, const Policy &policy = Policy())
+            : policy(policy), reduced(false), n(raw.size()), data(raw.data()), heads(flags.data()),
+              height(n > 1 ? ceil(log2(n)) : 0), pool(pool != nullptr ? pool : &WorkStealingPool::shared()) {
+        if (flags.size() != n)
+            throw std::invalid_argument("need one segment-head flag per element");
+        setup(n_threads);
+    }
+
+    /**
+     * Construct the scanner with segments given by their starting offsets.
+     * @param raw          input data (any non-zero size)
+     * @param offsets      ascending index of the first element of each segment
+     * @param n_threads    number of threads to use for parallelization, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared()
+     * @param policy       the operations, defaults to a default-constructed Policy
+     * @throws invalid_argument if an offset is out of range
+     */
+    GeneralScanSegmented(RawSpan raw, OffsetSpan offsets, int n_threads = N_THREADS,
+                         WorkStealingPool *pool = nullptr, const Policy &policy = Policy())
+            : policy(policy), reduced(false), n(raw.size()), data(raw.data()), ownedHeads(raw.size(), 0),
+              height(n > 1 ? ceil(log2(n)) : 0), pool(pool != nullptr ? pool : &WorkStealingPool::shared()) {
+        for (int offset: offsets) {
+            if (offset < 0 || offset >= n)
+                throw std::invalid_argument("segment offset out of range");
+            ownedHeads[offset] = 1;
+        }
+        heads = ownedHeads.data();
+        setup(n_threads);
+    }
+
+    /**
+     * Get the segmented (inclusive) scan: output[j] is the result for the elements from the
+     * start of j's segment up to and including j.
+     * @param output  scan results (vector is indexed corresponding to input elements)
+     */
+    void getScan(ScanData *output) {
+        if ((int) output->size() < n)
+            throw std::invalid_argument("output is smaller than the data");
+        getScan(output->data());
+    }
+
+    /**
+     * Get the segmented (inclusive) scan into any random-access output, which may be the
+     * input itself (that overwrites the data, so the scanner can't be used again afterwards).
+     * @param output  random-access iterator, pointer or ScanSpan
+     */
+    template<typename OutputIt>
+    void getScan(OutputIt output) {
+        reduced = reduced || reduce(ROOT);
+        scan(ROOT, policy.init(), output, true);
+    }
+
+    /**
+     * Get the segmented exclusive scan: output[j] is the result for the elements of j's
+     * segment before j (gen(init()) at every segment head).
+     * @param output  scan results (vector is indexed corresponding to input elements)
+     */
+    void getExclusiveScan(ScanData *output) {
+        if ((int) output->size() < n)
+            throw std::invalid_argument("output is smaller than the data");
+        getExclusiveScan(output->data());
+    }
+
+    /**
+     * Get the segmented exclusive scan into any random-access output (see getScan).
+     * @param output  random-access iterator, pointer or ScanSpan
+     */
+    template<typename OutputIt>
+    void getExclusiveScan(OutputIt output) {
+        reduced = reduced || reduce(ROOT);
+        scan(ROOT, policy.init(), output, false);
+    }
+
+private:
+    /**
+     * Tally of a node: the tally since the last segment head within the node (or of the
+     * whole node if there is none), and whether there was one.
+     */
+    struct Segment {
+        bool head;
+        TallyType tally;
+    };
+
+    static const int ROOT = 0;
+
+    Policy policy;
+    bool reduced;  // flag to say if we've already done the initial reduction
+    int n; // n is size of data
+    const ElemType *data;
+    std::vector<unsigned char> ownedHeads; // built from offsets
+    const unsigned char *heads;
+    int height; // number of levels below the root, so the deepest leaves start at node 2^height - 1
+    WorkStealingPool *pool;
+    int tasks; // number of leaf tasks the top of the tree is forked into
+    std::vector<Segment> interior; // tallies for the top of the tree, down to the leaf tasks
+
+    void setup(int n_threads) {
+        if (n < 1)
+            throw std::invalid_argument("data must not be empty");
+        tasks = WorkStealingPool::tasksFor(n_threads);
+        while (tasks > 1 && tasks >= n)
+            tasks /= 2;
+        interior.resize(tasks * 2);
+    }
+
+    /**
+     * Segmented combine: a head on the right cuts off everything to its left.
+     */
+    Segment combine(const Segment &left, const Segment &right) const {
+        Segment s;
+        s.head = left.head || right.head;
+        s.tally = right.head ? right.tally : policy.combine(left.tally, right.tally);
+        return s;
+    }
+
+    bool reduce(int i) {
+        if (i < tasks - 1) {
+            pool->invoke([this, i] { reduce(right(i)); }, [this, i] { reduce(left(i)); });
+            interior[i] = combine(interior[left(i)], interior[right(i)]);
+        } else {
+            int lm = dataIndex(leftmost(i)), rm = dataIndex(rightmost(i));
+            Segment s;
+            s.head = false;
+            s.tally = policy.init();
+            for (int j = lm; j <= rm; j++) {
+                if (heads[j]) {
+                    s.head = true;
+                    s.tally = policy.init();
+                }
+                s.tally = policy.combine(s.tally, policy.prepare(data[j]));
+            }
+            interior[i] = s;
+        }
+        return true;
+    }
+
+    /**
+     * @param tallyPrior  tally of this node's segment so far, from the elements to its left
+     */
+    template<typename OutputIt>
+    void scan(int i, const TallyType &tallyPrior, OutputIt output, bool inclusive) {
+        if (i < tasks - 1) {
+            const Segment &l = interior[left(i)];
+            TallyType rightPrior = l.head ? l.tally : policy.combine(tallyPrior, l.tally);
+            pool->invoke([this, i, &tallyPrior, output, inclusive] { scan(left(i), tallyPrior, output, inclusive); },
+                         [this, i, &rightPrior, output, inclusive] { scan(right(i), rightPrior, output, inclusive); });
+        } else {
+            int lm = dataIndex(leftmost(i)), rm = dataIndex(rightmost(i));
+            TallyType tally = tallyPrior;
+            for (int j = lm; j <= rm; j++) {
+                if (heads[j])
+                    tally = policy.init();
+                TallyType next = policy.combine(tally, policy.prepare(data[j]));
+                output[j] = policy.gen(inclusive ? next : tally);
+                tally = next;
+            }
+        }
+    }
+
+    // Following are for maneuvering around the binary tree (see GeneralScanSchwartz)
+    int size() {
+        return (n - 1) + n;
+    }
+
+    int left(int i) {
+        return i * 2 + 1;
+    }
+
+    int right(int i) {
+        return left(i) + 1;
+    }
+
+    bool isLeaf(int i) {
+        return left(i) >= size();
+    }
+
+    int leftmost(int i) {
+        while (!isLeaf(i))
+            i = left(i);
+        return i;
+    }
+
+    int rightmost(int i) {
+        while (!isLeaf(i))
+            i = right(i);
+        return i;
+    }
+
+    int dataIndex(int i) {
+        int deepest = (1 << height) - 1;
+        if (i >= deepest)
+            return i - deepest;
+        else
+            return i - (n - 1) + (2 * n - 1 - deepest);
+    }
+};
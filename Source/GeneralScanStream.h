@@ -0,0 +1,169 @@
+/**
+ * @file GeneralScanStream.h - appendable scan for data that arrives in batches
+ *
+ * GeneralScan and friends scan a fixed RawData: when more data arrives the tree and every scan
+ * result have to be rebuilt. For a prefix scan, everything the old data contributes to the new
+ * results is its total tally, so here only that is kept. Each appended batch is scanned with the
+ * running total as its prior and then folded into it, in time proportional to the batch.
+ */
+
+#pragma once
+
+#include <vector>
+#include "WorkStealingPool.h"
+#include "ScanKernels.h"
+#include "ScanSpan.h"
+
+/**
+ * Streaming reducer/scanner whose operations are supplied by a Policy, with the same
+ * requirements as for GeneralScanPolicy (so a policy can be used with either).
+ *
+ * @tparam Policy  the operations for the reduce/scan
+ */
+template<typename Policy>
+class GeneralScanStream {
+public:
+    typedef typename Policy::ElemType ElemType;
+    typedef typename Policy::TallyType TallyType;
+    typedef typename Policy::ResultType ResultType;
+
+    /**
+     * @class RawSpan - non-owning view of a batch; converts implicitly from a vector.
+     */
+    typedef ScanSpan<const ElemType> RawSpan;
+
+    /**
+     * @class ScanData - a vector of ResultType, used for scan output.
+     */
+    typedef std::vector<ResultType> ScanData;
+
+    /**
+     * Default number of threads to use in the parallelization.
+     */
+    static const int N_THREADS = 16;
+
+    /**
+     * Batches smaller than this (per thread) are scanned by the calling thread alone.
+     */
+    static const int MIN_CHUNK = 1 << 14;
+
+    /**
+     * Construct an empty stream.
+     * @param n_threads    number of threads to use for large batches, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared()
+     * @param policy       the operations, defaults to a default-constructed Policy
+     */
+    explicit GeneralScanStream(int n_threads = N_THREADS, WorkStealingPool *pool = nullptr,
+                               const Policy &policy = Policy())
+            : policy(policy), n(0), total(policy.init()), n_threads(n_threads < 1 ? 1 : n_threads),
+              pool(pool != nullptr ? pool : &WorkStealingPool::shared()) {
+    }
+
+    /**
+     * Append a batch, growing output by its scan results, so that output stays equal to the
+     * (inclusive) scan of everything appended so far.
+     * @param batch   the new elements
+     * @param output  scan results; batch.size() results are added at the end
+     */
+    void append(RawSpan batch, ScanData *output) {
+        size_t end = output->size();
+        output->resize(end + batch.size());
+        append(batch, output->data() + end);
+    }
+
+    /**
+     * Append a batch and write its scan results, i.e., output[j] gets the result for
+     * everything appended before the batch followed by batch[0..j].
+     * @param batch   the new elements
+     * @param output  random-access iterator, pointer or ScanSpan; may be the batch itself
+     */
+    template<typename OutputIt>
+    void append(RawSpan batch, OutputIt output) {
+        int chunks = chunksFor(batch.size());
+        if (chunks == 1) {
+            total = ScanKernels::Leaf<Policy>::scan(policy, batch.data(), batch.size(), total, output);
+        } else {
+            reduceChunks(batch, chunks);
+            pool->parallelFor(0, chunks, [this, &batch, chunks, output](int c) {
+                int first = chunkFirst(batch.size(), chunks, c);
+                ScanKernels::Leaf<Policy>::scan(policy, batch.data() + first,
+                                                chunkFirst(batch.size(), chunks, c + 1) - first,
+                                                priors[c], outputAt(output, first));
+            }, chunks);
+        }
+        n += batch.size();
+    }
+
+    /**
+     * Append a batch without producing scan results; only the reduction is updated.
+     * @param batch   the new elements
+     */
+    void append(RawSpan batch) {
+        int chunks = chunksFor(batch.size());
+        if (chunks == 1)
+            total = ScanKernels::Leaf<Policy>::reduce(policy, batch.data(), batch.size(), total);
+        else
+            reduceChunks(batch, chunks);
+        n += batch.size();
+    }
+
+    /**
+     * @return the reduction of everything appended so far
+     */
+    ResultType getReduction() const {
+        return policy.gen(total);
+    }
+
+    /**
+     * @return the number of elements appended so far
+     */
+    long long size() const {
+        return n;
+    }
+
+    /**
+     * Start over with an empty stream.
+     */
+    void clear() {
+        n = 0;
+        total = policy.init();
+    }
+
+private:
+    Policy policy;
+    long long n; // number of elements appended so far
+    TallyType total; // tally of everything appended so far
+    int n_threads;
+    WorkStealingPool *pool;
+    std::vector<TallyType> priors; // per chunk of the current batch, kept to avoid reallocating
+
+    int chunksFor(int size) const {
+        int chunks = size / MIN_CHUNK;
+        if (chunks > n_threads)
+            chunks = n_threads;
+        return chunks < 1 ? 1 : chunks;
+    }
+
+    static int chunkFirst(int size, int chunks, int c) {
+        return (int) ((long long) size * c / chunks);
+    }
+
+    /**
+     * Reduce the chunks in parallel, then turn their tallies into each chunk's prior and fold
+     * the batch into the total.
+     */
+    void reduceChunks(const RawSpan &batch, int chunks) {
+        priors.resize(chunks);
+        pool->parallelFor(0, chunks, [this, &batch, chunks](int c) {
+            int first = chunkFirst(batch.size(), chunks, c);
+            priors[c] = ScanKernels::Leaf<Policy>::reduce(policy, batch.data() + first,
+                                                         chunkFirst(batch.size(), chunks, c + 1) - first,
+                                                         policy.init());
+        }, chunks);
+        for (int c = 0; c < chunks; c++) {
+            TallyType chunkTally = priors[c];
+            priors[c] = total;
+            total = policy.combine(total, chunkTally);
+        }
+    }
+};
@@ -0,0 +1,202 @@
+/**
+ * @file Heatmap.h - packed list of heatmap frames
+ *
+ * Frames are stored compressed-sparse-row style: a timestamp per frame, one array holding every
+ * frame's note events back to back, and per-frame offsets into it. Building a list appends to
+ * three vectors (no allocation per frame or event once they are reserved), any frame can be
+ * reached by index, and playback walks memory in order. A HeatmapView reads the same arrays
+ * wherever they are, e.g. straight from a cache entry mapped into memory (see HeatmapCache.h).
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "ScanSpan.h"
+
+/**
+ * A single frame in the midi heatmap list: the notes starting and the notes ending at its
+ * timestamp. A view into the HeatmapList it came from.
+ */
+struct HeatmapFrame
+{
+    double timestamp;
+    ScanSpan<const uint8_t> additions, subtractions;
+};
+
+/**
+ * Final result of the scan which is used to animate the heatmap in order.
+ */
+class HeatmapList
+{
+public:
+    /**
+     * @return number of frames
+     */
+    int size() const
+    {
+        return (int) timestamps.size();
+    }
+
+    bool empty() const
+    {
+        return timestamps.empty();
+    }
+
+    /**
+     * @return total number of note events in all the frames
+     */
+    int numEvents() const
+    {
+        return (int) events.size();
+    }
+
+    double timestamp(int f) const
+    {
+        return timestamps[f];
+    }
+
+    /**
+     * @return view of the given frame (valid until the list is modified)
+     */
+    HeatmapFrame frame(int f) const
+    {
+        const uint8_t* base = events.data();
+        return { timestamps[f],
+                 ScanSpan<const uint8_t>(base + offsets[f], base + splits[f]),
+                 ScanSpan<const uint8_t>(base + splits[f], base + offsets[f + 1]) };
+    }
+
+    /**
+     * Room for the given numbers of frames and events, so that building doesn't reallocate.
+     */
+    void reserve(int frameCount, int eventCount)
+    {
+        timestamps.reserve(frameCount);
+        splits.reserve(frameCount);
+        offsets.reserve(frameCount + 1);
+        events.reserve(eventCount);
+    }
+
+    void clear()
+    {
+        timestamps.clear();
+        splits.clear();
+        offsets.assign(1, 0);
+        events.clear();
+    }
+
+    /**
+     * Start a new frame; subsequent note events go into it.
+     */
+    void addFrame(double timestamp)
+    {
+        timestamps.push_back(timestamp);
+        splits.push_back((int) events.size());
+        offsets.push_back((int) events.size());
+    }
+
+    /**
+     * Add a note starting (noteOn) or ending to the last frame.
+     */
+    void addNoteEvent(int noteNumber, bool noteOn)
+    {
+        if (noteOn && splits.back() != (int) events.size())
+            events.insert(events.begin() + splits.back(), (uint8_t) noteNumber);  // keep additions first
+        else
+            events.push_back((uint8_t) noteNumber);
+        if (noteOn)
+            ++splits.back();
+        ++offsets.back();
+    }
+
+    /**
+     * Direct access to the packed arrays, e.g. for building a list in parallel: frame f's
+     * events are events[offsets[f]..offsets[f + 1]), additions before splits[f].
+     */
+    std::vector<double> timestamps;
+    std::vector<int> offsets { 0 };
+    std::vector<int> splits;
+    std::vector<uint8_t> events;
+};
+
+/**
+ * The frames of a heatmap, read from packed arrays laid out as a HeatmapList's: those of a list,
+ * or those of a cache entry mapped into memory. A view; the arrays must outlive it (and not
+ * change).
+ */
+class HeatmapView
+{
+public:
+    /**
+     * No frames.
+     */
+    HeatmapView() : timestamps(nullptr), offsets(nullptr), splits(nullptr), events(nullptr), numFrames(0)
+    {
+    }
+
+    HeatmapView(const HeatmapList& list)
+        : timestamps(list.timestamps.data()), offsets(list.offsets.data()), splits(list.splits.data()),
+          events(list.events.data()), numFrames(list.size())
+    {
+    }
+
+    /**
+     * @param offsets  numFrames + 1 of them; the other arrays as in HeatmapList
+     */
+    HeatmapView(const double* timestamps, const int* offsets, const int* splits, const uint8_t* events, int numFrames)
+        : timestamps(timestamps), offsets(offsets), splits(splits), events(events), numFrames(numFrames)
+    {
+    }
+
+    /**
+     * @return number of frames
+     */
+    int size() const
+    {
+        return numFrames;
+    }
+
+    bool empty() const
+    {
+        return numFrames == 0;
+    }
+
+    int numEvents() const
+    {
+        return numFrames > 0 ? offsets[numFrames] : 0;
+    }
+
+    double timestamp(int f) const
+    {
+        return timestamps[f];
+    }
+
+    /**
+     * @return view of the given frame
+     */
+    HeatmapFrame frame(int f) const
+    {
+        return { timestamps[f],
+                 ScanSpan<const uint8_t>(events + offsets[f], events + splits[f]),
+                 ScanSpan<const uint8_t>(events + splits[f], events + offsets[f + 1]) };
+    }
+
+    /**
+     * Index of the first frame after a time: every frame before it has happened by then.
+     * @return 0 if time is before the first frame, size() if it is at or after the last
+     */
+    int frameAfter(double time) const
+    {
+        return (int) (std::upper_bound(timestamps, timestamps + numFrames, time) - timestamps);
+    }
+
+    const double* timestamps;
+    const int* offsets;
+    const int* splits;
+    const uint8_t* events;
+
+private:
+    int numFrames;
+};
@@ -0,0 +1,501 @@
+/**
+ * @file HeatmapCache.h - computed heatmaps (and their notes) kept on disk for instant startup
+ *
+ * Reading a large MIDI file and building its heatmap, keyframes (see HeatmapKeyframes.h) and
+ * decaying heat (see HeatmapDecay.h) takes seconds, on the message thread before the window
+ * appears. A cache entry stores all of them as the packed arrays of the HeatmapList, the
+ * NoteStore and the two sets of keyframes, each at an 8-byte aligned offset given in the
+ * header, so an entry is used by mapping it: playback reads the frames, keyframes and heat
+ * straight from the mapping (CachedHeatmap::getFrames, getKeyframes and getDecay), and only the
+ * pages it touches are read from disk. Copying the lists out, where a caller wants its own, is
+ * one memcpy per array, with no parsing.
+ *
+ * Entries are named by a hash of the MIDI file's content, not its path or date, so a file that
+ * has changed finds no entry and is rebuilt. The header repeats the hash and the source size,
+ * and an entry with another format version, byte order, layout or decay rate is ignored and
+ * rewritten. Entries that are no longer used would pile up, so the directory is kept under a
+ * size cap by deleting the least recently used ones whenever an entry is added.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "WorkStealingPool.h"
+#include "Trace.h"
+#include "SmfReader.h"
+#include "NoteStore.h"
+#include "Heatmap.h"
+#include "HeatmapScan.h"
+#include "HeatmapKeyframes.h"
+#include "HeatmapDecay.h"
+
+/**
+ * Format version of the entries; bump it whenever the layout or the meaning of the arrays
+ * changes, and old entries will be rebuilt.
+ */
+static const uint32_t HEATMAP_CACHE_VERSION = 2;
+
+/**
+ * Written as is, so an entry made on a machine of the other byte order reads back differently.
+ */
+static const uint32_t HEATMAP_CACHE_BYTE_ORDER = 0x01020304;
+
+/**
+ * Default size cap of a cache directory, in bytes.
+ */
+static const int64 HEATMAP_CACHE_MAX_BYTES = (int64) 512 << 20;
+
+/**
+ * The arrays of an entry, in file order.
+ */
+enum HeatmapCacheSection
+{
+    timestampsSection, offsetsSection, splitsSection, eventsSection,
+    onsetSection, offsetSection, onsetTickSection, offsetTickSection,
+    pitchSection, velocitySection, channelSection, trackSection,
+    keyframesSection, decayKeyframesSection, firstNoteSection,
+    numCacheSections
+};
+
+struct HeatmapCacheHeader
+{
+    char magic[4];  // "PMHC"
+    uint32_t version, byteOrder;
+    int32_t numFrames, numEvents, numNotes;
+    uint64_t sourceHash, sourceSize;
+    uint64_t fileSize;
+    double decayRate;  // of the decaying heat's keyframes
+    uint64_t sections[numCacheSections];  // byte offset of each array
+};
+
+/**
+ * 64-bit hash of a file's content, for naming its cache entry (not cryptographic).
+ * FNV-1a over 8-byte words in four interleaved lanes, since a byte at a time would be bound
+ * by the multiply latency; every step is invertible, so changing any one word changes the hash.
+ */
+static uint64_t hashContent(const uint8_t* bytes, size_t size)
+{
+    static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL, FNV_PRIME = 0x100000001b3ULL;
+    uint64_t lanes[4] = { FNV_OFFSET, FNV_OFFSET + 1, FNV_OFFSET + 2, FNV_OFFSET + 3 };
+    size_t numWords = size / 8, w = 0;
+    for (; w + 4 <= numWords; w += 4)
+        for (int l = 0; l < 4; ++l)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + 8 * (w + l), 8);
+            lanes[l] = (lanes[l] ^ word) * FNV_PRIME;
+            lanes[l] ^= lanes[l] >> 32;
+        }
+    uint64_t hash = FNV_OFFSET ^ size;
+    for (uint64_t lane : lanes)
+        hash = (hash ^ lane) * FNV_PRIME;
+    for (size_t b = 8 * w; b < size; ++b)
+        hash = (hash ^ bytes[b]) * FNV_PRIME;
+    return hash ^ hash >> 32;
+}
+
+/**
+ * Sets the section offsets of a header from its counts.
+ * @return the size of the whole entry
+ */
+static uint64_t layoutHeatmapCache(HeatmapCacheHeader& header)
+{
+    uint64_t frames = (uint64_t) header.numFrames, notes = (uint64_t) header.numNotes;
+    const uint64_t sizes[numCacheSections] = {
+        frames * sizeof(double), (frames + 1) * sizeof(int32_t), frames * sizeof(int32_t), (uint64_t) header.numEvents,
+        notes * sizeof(double), notes * sizeof(double), notes * sizeof(uint32_t), notes * sizeof(uint32_t),
+        notes, notes, notes, notes * sizeof(uint16_t),
+        HeatmapKeyframes::numKeyframesFor(header.numFrames) * sizeof(NoteHisto),
+        HeatmapDecay::numKeyframesFor(header.numFrames) * sizeof(KeyHeatMap), (frames + 1) * sizeof(int32_t)
+    };
+    uint64_t end = sizeof(HeatmapCacheHeader);
+    for (int s = 0; s < numCacheSections; ++s)
+    {
+        header.sections[s] = (end + 7) & ~(uint64_t) 7;
+        end = header.sections[s] + sizes[s];
+    }
+    return end;
+}
+
+/**
+ * Writes a cache entry for a heatmap and its notes, with their keyframes and decaying heat
+ * (computed here, at DEFAULT_HEAT_DECAY).
+ * @param pool  executor to compute the keyframes on
+ * @return false if the stream couldn't be written
+ */
+static bool writeHeatmapCache(OutputStream& out, uint64_t sourceHash, uint64_t sourceSize,
+                              const HeatmapList& heatmap, const NoteStore& notes, WorkStealingPool& pool)
+{
+    HeatmapKeyframes keyframes(heatmap, pool);
+    HeatmapDecay decay(heatmap, notes, DEFAULT_HEAT_DECAY, pool);
+
+    HeatmapCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "PMHC", 4);
+    header.version = HEATMAP_CACHE_VERSION;
+    header.byteOrder = HEATMAP_CACHE_BYTE_ORDER;
+    header.numFrames = heatmap.size();
+    header.numEvents = heatmap.numEvents();
+    header.numNotes = notes.size();
+    header.sourceHash = sourceHash;
+    header.sourceSize = sourceSize;
+    header.decayRate = decay.getRate();
+    header.fileSize = layoutHeatmapCache(header);
+
+    uint64_t position = sizeof(header);
+    bool ok = out.write(&header, sizeof(header));
+    auto writeSection = [&](int s, const void* data, size_t bytes) {
+        ok = ok && out.writeRepeatedByte(0, (size_t) (header.sections[s] - position)) && out.write(data, bytes);
+        position = header.sections[s] + bytes;
+    };
+    writeSection(timestampsSection, heatmap.timestamps.data(), heatmap.timestamps.size() * sizeof(double));
+    writeSection(offsetsSection, heatmap.offsets.data(), heatmap.offsets.size() * sizeof(int));
+    writeSection(splitsSection, heatmap.splits.data(), heatmap.splits.size() * sizeof(int));
+    writeSection(eventsSection, heatmap.events.data(), heatmap.events.size());
+    writeSection(onsetSection, notes.onset.data(), notes.onset.size() * sizeof(double));
+    writeSection(offsetSection, notes.offset.data(), notes.offset.size() * sizeof(double));
+    writeSection(onsetTickSection, notes.onsetTick.data(), notes.onsetTick.size() * sizeof(uint32_t));
+    writeSection(offsetTickSection, notes.offsetTick.data(), notes.offsetTick.size() * sizeof(uint32_t));
+    writeSection(pitchSection, notes.pitch.data(), notes.pitch.size());
+    writeSection(velocitySection, notes.velocity.data(), notes.velocity.size());
+    writeSection(channelSection, notes.channel.data(), notes.channel.size());
+    writeSection(trackSection, notes.track.data(), notes.track.size() * sizeof(uint16_t));
+    writeSection(keyframesSection, &keyframes.keyframe(0), keyframes.numKeyframes() * sizeof(NoteHisto));
+    writeSection(decayKeyframesSection, &decay.keyframe(0), decay.numKeyframes() * sizeof(KeyHeatMap));
+    writeSection(firstNoteSection, decay.firstNotes(), (heatmap.size() + 1) * sizeof(int));
+    return ok;
+}
+
+/**
+ * Writes a cache entry to a file, through a temporary file so that an interrupted write never
+ * leaves a damaged entry behind.
+ * @return false if the file couldn't be written
+ */
+static bool writeHeatmapCache(const File& file, uint64_t sourceHash, uint64_t sourceSize,
+                              const HeatmapList& heatmap, const NoteStore& notes, WorkStealingPool& pool)
+{
+    TemporaryFile temp(file);
+    {
+        FileOutputStream out(temp.getFile());
+        if (!out.openedOk())
+            return false;
+        bool ok = writeHeatmapCache(out, sourceHash, sourceSize, heatmap, notes, pool);
+        out.flush();
+        if (!ok || !out.getStatus().wasOk())
+            return false;
+    }
+    return temp.overwriteTargetFileWithTemporary();
+}
+
+/**
+ * A cache entry, mapped into memory (or, if it couldn't be stored, held in memory). Its frames,
+ * keyframes and decaying heat are views into it; nothing is read from disk until it is used.
+ */
+class CachedHeatmap
+{
+public:
+    /**
+     * Maps the entry for the given source.
+     * @return the entry, or nullptr if the file is missing, is for other content, has another
+     *         format version or is damaged
+     */
+    static std::unique_ptr<CachedHeatmap> open(const File& file, uint64_t sourceHash, uint64_t sourceSize)
+    {
+        if (!file.existsAsFile())
+            return nullptr;
+        std::unique_ptr<CachedHeatmap> cached(new CachedHeatmap());
+        cached->mappedFile.reset(new MemoryMappedFile(file, MemoryMappedFile::readOnly));
+        cached->data = (const char*) cached->mappedFile->getData();
+        cached->dataSize = cached->mappedFile->getSize();
+        if (!cached->isEntryFor(sourceHash, sourceSize))
+            return nullptr;
+        return cached;
+    }
+
+    /**
+     * Builds an entry in memory, laid out as on disk, for when it can't be stored.
+     * @param pool  executor to compute the keyframes on
+     */
+    static std::unique_ptr<CachedHeatmap> build(uint64_t sourceHash, uint64_t sourceSize, const HeatmapList& heatmap,
+                                                const NoteStore& notes,
+                                                WorkStealingPool& pool = WorkStealingPool::shared())
+    {
+        std::unique_ptr<CachedHeatmap> cached(new CachedHeatmap());
+        {
+            MemoryOutputStream out(cached->block, false);
+            writeHeatmapCache(out, sourceHash, sourceSize, heatmap, notes, pool);
+        }
+        cached->data = (const char*) cached->block.getData();
+        cached->dataSize = cached->block.getSize();
+        return cached;
+    }
+
+    /**
+     * @return number of frames
+     */
+    int size() const
+    {
+        return header().numFrames;
+    }
+
+    int numEvents() const
+    {
+        return header().numEvents;
+    }
+
+    int numNotes() const
+    {
+        return header().numNotes;
+    }
+
+    double timestamp(int f) const
+    {
+        return section<double>(timestampsSection)[f];
+    }
+
+    /**
+     * @return the frames (valid while the entry is open)
+     */
+    HeatmapView getFrames() const
+    {
+        return HeatmapView(section<double>(timestampsSection), section<int>(offsetsSection),
+                           section<int>(splitsSection), section<uint8_t>(eventsSection), size());
+    }
+
+    /**
+     * @return the frames' keyframes, read from the entry (valid while it is open)
+     */
+    HeatmapKeyframes getKeyframes() const
+    {
+        return HeatmapKeyframes(getFrames(), section<NoteHisto>(keyframesSection));
+    }
+
+    /**
+     * @return the frames' decaying heat, read from the entry (valid while it is open)
+     */
+    HeatmapDecay getDecay() const
+    {
+        return HeatmapDecay(getFrames(), section<KeyHeatMap>(decayKeyframesSection), section<int>(firstNoteSection),
+                            section<uint8_t>(pitchSection), section<uint8_t>(velocitySection), header().decayRate);
+    }
+
+    /**
+     * Copies the heatmap out of the entry.
+     */
+    void copyTo(HeatmapList& heatmap) const
+    {
+        int frames = size();
+        copySection(timestampsSection, heatmap.timestamps, frames);
+        copySection(offsetsSection, heatmap.offsets, frames + 1);
+        copySection(splitsSection, heatmap.splits, frames);
+        copySection(eventsSection, heatmap.events, numEvents());
+    }
+
+    /**
+     * Copies the notes out of the entry.
+     */
+    void copyTo(NoteStore& notes) const
+    {
+        int n = numNotes();
+        copySection(onsetSection, notes.onset, n);
+        copySection(offsetSection, notes.offset, n);
+        copySection(onsetTickSection, notes.onsetTick, n);
+        copySection(offsetTickSection, notes.offsetTick, n);
+        copySection(pitchSection, notes.pitch, n);
+        copySection(velocitySection, notes.velocity, n);
+        copySection(channelSection, notes.channel, n);
+        copySection(trackSection, notes.track, n);
+    }
+
+private:
+    std::unique_ptr<MemoryMappedFile> mappedFile;
+    MemoryBlock block;
+    const char* data = nullptr;
+    size_t dataSize = 0;
+
+    CachedHeatmap()
+    {
+    }
+
+    const HeatmapCacheHeader& header() const
+    {
+        return *(const HeatmapCacheHeader*) data;
+    }
+
+    template<typename T>
+    const T* section(int s) const
+    {
+        return (const T*) (data + header().sections[s]);
+    }
+
+    template<typename T>
+    void copySection(int s, std::vector<T>& column, int n) const
+    {
+        const T* first = section<T>(s);
+        column.assign(first, first + n);
+    }
+
+    /**
+     * Checks the header (and the ends of the frame offsets), not the arrays themselves: the
+     * entries are our own output, and a read of every array would undo the point of mapping.
+     */
+    bool isEntryFor(uint64_t sourceHash, uint64_t sourceSize) const
+    {
+        if (data == nullptr || dataSize < sizeof(HeatmapCacheHeader))
+            return false;
+        const HeatmapCacheHeader& stored = header();
+        if (std::memcmp(stored.magic, "PMHC", 4) != 0 || stored.version != HEATMAP_CACHE_VERSION
+            || stored.byteOrder != HEATMAP_CACHE_BYTE_ORDER || stored.sourceHash != sourceHash
+            || stored.sourceSize != sourceSize || stored.decayRate != DEFAULT_HEAT_DECAY || stored.numFrames < 0
+            || stored.numEvents < 0 || stored.numNotes < 0)
+            return false;
+        HeatmapCacheHeader expected = stored;
+        if (layoutHeatmapCache(expected) != stored.fileSize || stored.fileSize != dataSize
+            || std::memcmp(expected.sections, stored.sections, sizeof(stored.sections)) != 0)
+            return false;
+        const int32_t* offsets = section<int32_t>(offsetsSection);
+        return offsets[0] == 0 && offsets[stored.numFrames] == stored.numEvents;
+    }
+};
+
+/**
+ * A directory of cache entries, one per MIDI file content, kept under a size cap.
+ */
+class HeatmapCache
+{
+public:
+    /**
+     * @param maxBytes  size cap of the directory: adding an entry deletes the least recently
+     *                  used others until the entries fit in it
+     */
+    HeatmapCache(const File& directory, int64 maxBytes = HEATMAP_CACHE_MAX_BYTES)
+        : directory(directory), maxBytes(maxBytes)
+    {
+    }
+
+    /**
+     * The app's cache, in the user's application data directory.
+     */
+    static File getDefaultDirectory()
+    {
+        return File::getSpecialLocation(File::userApplicationDataDirectory)
+            .getChildFile("ParallelMidi").getChildFile("HeatmapCache");
+    }
+
+    File getEntryFile(uint64_t sourceHash) const
+    {
+        return directory.getChildFile(String::toHexString((int64) sourceHash) + ".pmhc");
+    }
+
+    /**
+     * Finds the entry for a MIDI file's content, and marks it as just used.
+     * @return the entry, or nullptr if there is no current one
+     */
+    std::unique_ptr<CachedHeatmap> find(uint64_t sourceHash, uint64_t sourceSize) const
+    {
+        File file = getEntryFile(sourceHash);
+        std::unique_ptr<CachedHeatmap> cached = CachedHeatmap::open(file, sourceHash, sourceSize);
+        if (cached != nullptr)
+            file.setLastModificationTime(Time::getCurrentTime());
+        return cached;
+    }
+
+    /**
+     * Adds (or replaces) the entry for a MIDI file's content, then trims the directory to its
+     * size cap.
+     * @param pool  executor to compute the entry's keyframes on
+     * @return false if it couldn't be written
+     */
+    bool store(uint64_t sourceHash, uint64_t sourceSize, const HeatmapList& heatmap, const NoteStore& notes,
+               WorkStealingPool& pool = WorkStealingPool::shared()) const
+    {
+        File file = getEntryFile(sourceHash);
+        if (!directory.createDirectory().wasOk()
+            || !writeHeatmapCache(file, sourceHash, sourceSize, heatmap, notes, pool))
+            return false;
+        trim(file);
+        return true;
+    }
+
+    /**
+     * Deletes the least recently used entries (and any temporary files left by interrupted
+     * writes) until the directory holds at most the size cap. An entry that is open elsewhere
+     * may fail to delete on some systems; it is tried again next time.
+     * @param keep  an entry never to delete
+     */
+    void trim(const File& keep = File()) const
+    {
+        Array<File> files = directory.findChildFiles(File::findFiles, false, "*.pmhc");
+        std::sort(files.begin(), files.end(), [](const File& a, const File& b) {
+            return a.getLastModificationTime() > b.getLastModificationTime();  // most recently used first
+        });
+        int64 kept = keep.existsAsFile() ? keep.getSize() : 0;
+        for (const File& file : files)
+        {
+            if (file == keep)
+                continue;
+            if (kept + file.getSize() <= maxBytes || !file.deleteFile())
+                kept += file.getSize();
+        }
+    }
+
+private:
+    File directory;
+    int64 maxBytes;
+};
+
+/**
+ * Reads the heatmap of a midi file through the cache: maps its entry if there is a current one,
+ * otherwise reads the notes (see SmfReader.h), builds the heatmap, stores it (with its
+ * keyframes and decaying heat) as a new entry and maps that. Nothing is copied out: playback
+ * reads the entry's views.
+ * @param pool  executor to build on
+ * @return the entry (held in memory if it couldn't be stored)
+ * @throws exception if file doesn't exist or MIDI file could not be read
+ */
+static std::unique_ptr<CachedHeatmap> readInHeatmap(const String& path, const HeatmapCache& cache,
+                                                    WorkStealingPool& pool = WorkStealingPool::shared())
+{
+    File fileToRead(path);
+    if (!fileToRead.existsAsFile())
+        throw "File doesn't exist at provided path: " + path;
+    MemoryMappedFile mappedFile(fileToRead, MemoryMappedFile::readOnly);
+    if (mappedFile.getData() == nullptr)
+        throw "Error reading file";
+    const uint8_t* bytes = (const uint8_t*) mappedFile.getData();
+    uint64_t sourceHash, sourceSize = mappedFile.getSize();
+    std::unique_ptr<CachedHeatmap> cached;
+    {
+        // hashing reads every page of the file in
+        MIDI_TRACE_SPAN("read file", "stage");
+        sourceHash = hashContent(bytes, mappedFile.getSize());
+        cached = cache.find(sourceHash, sourceSize);
+    }
+    if (cached != nullptr)
+        return cached;
+
+    NoteStore notes;
+    try
+    {
+        notes = SmfReader(bytes, mappedFile.getSize()).readNotes(pool);
+    }
+    catch (const std::invalid_argument&)
+    {
+        throw "Error reading file";
+    }
+    HeatmapList heatmap;
+    buildHeatmap(notes, heatmap, pool);
+    if (cache.store(sourceHash, sourceSize, heatmap, notes, pool))
+        cached = cache.find(sourceHash, sourceSize);
+    if (cached == nullptr)
+    {
+        DBG("Couldn't write the heatmap cache entry for " + path);
+        cached = CachedHeatmap::build(sourceHash, sourceSize, heatmap, notes, pool);
+    }
+    return cached;
+}
@@ -0,0 +1,284 @@
+/**
+ * @file HeatmapDecay.h - decaying heat per key, precomputed as keyframes
+ *
+ * Counting the sounding notes makes a held note and a note struck over and over look the same.
+ * Here each key's heat jumps by the velocity of every note struck on it and then fades:
+ * h(t) = h(t_prev) * e^(-rate * (t - t_prev)) + velocity. From one frame to the next that is the
+ * affine map h -> a * h + b per key (a the same for every key, b the velocities struck in the
+ * frame), and affine maps compose associatively (AffinePolicy below), so the heat after every
+ * frame is a scan.
+ *
+ * As for the keyframes (see HeatmapKeyframes.h), the scan runs over blocks of frames: the
+ * GeneralScanPolicy composes each block's frames into one map and scans the blocks in parallel.
+ * The prefix of every block is kept as its keyframe (516 bytes per BLOCK_FRAMES frames, small
+ * enough to store in a cache entry, see HeatmapCache.h), and the heat at any time replays fewer
+ * than BLOCK_FRAMES frames from the keyframe before it.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "WorkStealingPool.h"
+#include "GeneralScanPolicy.h"
+#include "NoteStore.h"
+#include "Heatmap.h"
+#include "HeatmapKeyframes.h"
+
+/**
+ * Default decay rate per second: heat halves in about a third of a second.
+ */
+static const double DEFAULT_HEAT_DECAY = 2.0;
+
+/**
+ * Heat per palette step (see HeatmapPalette.h): a note struck at full velocity starts 8 steps
+ * up.
+ */
+static const float DECAY_HEAT_PER_STEP = 16.0f;
+
+/**
+ * The map h -> decay * h + heat[k] on each of N keys at once, all keys sharing the decay.
+ * Applied to no heat, its heat is the result. With one key it is a step of any first-order
+ * linear recurrence h(i) = a(i) * h(i - 1) + b(i).
+ */
+template<typename T, int Keys>
+struct AffineMap {
+    static const int N = Keys;
+    T decay;
+    T heat[N];
+
+    AffineMap() : decay(1) {
+        for (int i = 0; i < N; i++)
+            heat[i] = 0;
+    }
+};
+
+/**
+ * Composition of affine maps as a GeneralScanPolicy policy: the scan at i is element 0's map,
+ * then element 1's and so on up to element i's. Composition is associative but not
+ * commutative; combine keeps left before right. The elements are maps themselves, unless a
+ * policy deriving from this one prepares them from something else (as DecayHeatPolicy does).
+ */
+template<typename T, int Keys, typename Elem = AffineMap<T, Keys>>
+struct AffinePolicy {
+    typedef Elem ElemType;
+    typedef AffineMap<T, Keys> TallyType;
+    typedef AffineMap<T, Keys> ResultType;
+
+    TallyType init() const {
+        return TallyType();
+    }
+
+    TallyType prepare(const Elem &datum) const {
+        return datum;
+    }
+
+    TallyType combine(const TallyType &left, const TallyType &right) const {
+        TallyType map;
+        map.decay = left.decay * right.decay;
+        for (int i = 0; i < map.N; i++)
+            map.heat[i] = left.heat[i] * right.decay + right.heat[i];
+        return map;
+    }
+
+    ResultType gen(const TallyType &tally) const {
+        return tally;
+    }
+};
+
+/**
+ * Heat of every MIDI note; the tally type of DecayHeatPolicy.
+ */
+typedef AffineMap<float, 128> KeyHeatMap;
+
+/**
+ * Composition of the frames' heat maps, over blocks of frames. Carries the notes' pitches and
+ * velocities, where each frame's notes start and the decay rate.
+ */
+struct DecayHeatPolicy : AffinePolicy<float, KeyHeatMap::N, HeatmapBlock> {
+    const uint8_t *pitch, *velocity;  // of the notes, sorted by onset
+    const int *firstNote;             // notes [firstNote[f], firstNote[f + 1]) start at frame f
+    double rate;
+
+    DecayHeatPolicy(const uint8_t *pitch = nullptr, const uint8_t *velocity = nullptr, const int *firstNote = nullptr,
+                    double rate = DEFAULT_HEAT_DECAY)
+            : pitch(pitch), velocity(velocity), firstNote(firstNote), rate(rate) {
+    }
+
+    KeyHeatMap prepare(const HeatmapBlock &datum) const {
+        KeyHeatMap map;
+        fold(map, datum);
+        return map;
+    }
+
+    /**
+     * Applies a block's frames to the map, one after the other.
+     */
+    void fold(KeyHeatMap &map, const HeatmapBlock &datum) const {
+        for (int f = datum.first; f < datum.last; f++)
+            step(map, *datum.heatmap, f);
+    }
+
+    /**
+     * Applies frame f: decay since the frame before (or time 0), then the notes struck.
+     */
+    void step(KeyHeatMap &map, const HeatmapView &heatmap, int f) const {
+        float a = (float) std::exp(-rate * (heatmap.timestamp(f) - (f > 0 ? heatmap.timestamp(f - 1) : 0.0)));
+        map.decay *= a;
+        for (int i = 0; i < map.N; i++)
+            map.heat[i] *= a;
+        for (int n = firstNote[f]; n < firstNote[f + 1]; n++)
+            map.heat[pitch[n]] += velocity[n];
+    }
+};
+
+/**
+ * Heat per key after every frame of a heatmap. Its frames, and the notes it was computed from,
+ * must outlive it (and not change).
+ */
+class HeatmapDecay {
+public:
+    static const int N = KeyHeatMap::N;
+
+    /**
+     * Frames per block of the scan, and between keyframes.
+     */
+    static const int BLOCK_FRAMES = 64;
+
+    /**
+     * No frames: no heat at any time.
+     */
+    HeatmapDecay()
+            : rate(DEFAULT_HEAT_DECAY), pitch(nullptr), velocity(nullptr), computedKeyframes(1),
+              storedKeyframes(nullptr), storedFirstNote(nullptr) {
+    }
+
+    /**
+     * Computes the keyframes of the heat.
+     * @param heatmap  the frames (only their times are used)
+     * @param notes    the notes the heatmap was built from, sorted by onset (as loaded)
+     * @param rate     decay rate per second
+     * @param pool     executor to run on
+     */
+    HeatmapDecay(const HeatmapView &heatmap, const NoteStore &notes, double rate = DEFAULT_HEAT_DECAY,
+                 WorkStealingPool &pool = WorkStealingPool::shared())
+            : heatmap(heatmap), rate(rate), pitch(notes.pitch.data()), velocity(notes.velocity.data()),
+              storedKeyframes(nullptr), storedFirstNote(nullptr) {
+        int numFrames = heatmap.size(), blocks = numKeyframesFor(numFrames) - 1;
+
+        // the notes are in onset order, so each frame's are a run; a little slack absorbs
+        // rounding between a note's onset and its frame's time
+        computedFirstNote.assign(numFrames + 1, notes.size());
+        const double *onset = notes.onset.data();
+        pool.parallelFor(0, blocks, [&](int b) {
+            for (int f = b * BLOCK_FRAMES; f < std::min(numFrames, (b + 1) * BLOCK_FRAMES); f++)
+                computedFirstNote[f] = (int) (std::lower_bound(onset, onset + notes.size(), heatmap.timestamp(f) - 1e-9)
+                                              - onset);
+        });
+
+        DecayHeatPolicy policy = getPolicy();
+        std::vector<HeatmapBlock> ranges(blocks);
+        for (int b = 0; b < blocks; b++)
+            ranges[b] = {&this->heatmap, b * BLOCK_FRAMES, std::min(numFrames, (b + 1) * BLOCK_FRAMES)};
+        computedKeyframes.resize(blocks + 1);  // computedKeyframes[b] is every frame before block b
+        if (blocks > 1) {
+            GeneralScanPolicy<DecayHeatPolicy> scanner(ranges, std::min(pool.size(), blocks - 1), &pool, policy);
+            scanner.getScan(computedKeyframes.data() + 1);
+        } else if (blocks == 1) {
+            policy.fold(computedKeyframes[1], ranges[0]);
+        }
+    }
+
+    /**
+     * Reads back keyframes computed before, e.g. from a cache entry.
+     * @param heatmap    the frames
+     * @param keyframes  numKeyframesFor(heatmap.size()) keyframes, as keyframe() gave them
+     * @param firstNote  heatmap.size() + 1 indexes, as firstNotes() gave them
+     * @param pitch      the pitches of the notes the heatmap was built from, sorted by onset
+     * @param velocity   and their velocities (all of these must outlive the heat)
+     * @param rate       decay rate per second the keyframes were computed with
+     */
+    HeatmapDecay(const HeatmapView &heatmap, const KeyHeatMap *keyframes, const int *firstNote, const uint8_t *pitch,
+                 const uint8_t *velocity, double rate)
+            : heatmap(heatmap), rate(rate), pitch(pitch), velocity(velocity), storedKeyframes(keyframes),
+              storedFirstNote(firstNote) {
+    }
+
+    /**
+     * @return how many keyframes the heat of the given number of frames has
+     */
+    static int numKeyframesFor(int numFrames) {
+        return (numFrames + BLOCK_FRAMES - 1) / BLOCK_FRAMES + 1;
+    }
+
+    int numFrames() const {
+        return heatmap.size();
+    }
+
+    double getRate() const {
+        return rate;
+    }
+
+    int numKeyframes() const {
+        return numKeyframesFor(numFrames());
+    }
+
+    /**
+     * @return the map of every frame before frame k * BLOCK_FRAMES (the keyframes are
+     *         contiguous, so this is also where all of them start for k = 0)
+     */
+    const KeyHeatMap &keyframe(int k) const {
+        return (storedKeyframes != nullptr ? storedKeyframes : computedKeyframes.data())[k];
+    }
+
+    /**
+     * @return numFrames() + 1 indexes: frame f's notes are [firstNotes()[f], firstNotes()[f + 1])
+     */
+    const int *firstNotes() const {
+        return storedFirstNote != nullptr ? storedFirstNote : computedFirstNote.data();
+    }
+
+    /**
+     * The heat of every key just after frame f's notes are struck: the keyframe before it, with
+     * the frames since replayed.
+     * @param keyHeat  set to N values
+     */
+    void frameHeat(int f, float *keyHeat) const {
+        int k = f / BLOCK_FRAMES;
+        KeyHeatMap map = keyframe(k);
+        DecayHeatPolicy policy = getPolicy();
+        for (int g = k * BLOCK_FRAMES; g <= f; g++)
+            policy.step(map, heatmap, g);
+        std::copy(map.heat, map.heat + N, keyHeat);
+    }
+
+    /**
+     * The heat of every key at a time: the last frame at or before it, decayed since.
+     * @param keyHeat  set to N values
+     */
+    void heatAt(double time, float *keyHeat) const {
+        int f = heatmap.frameAfter(time) - 1;
+        if (f < 0) {
+            std::fill(keyHeat, keyHeat + N, 0.0f);
+            return;
+        }
+        frameHeat(f, keyHeat);
+        float a = (float) std::exp(-rate * (time - heatmap.timestamp(f)));
+        for (int i = 0; i < N; i++)
+            keyHeat[i] *= a;
+    }
+
+private:
+    HeatmapView heatmap;
+    double rate;
+    const uint8_t *pitch, *velocity;
+    std::vector<KeyHeatMap> computedKeyframes;
+    std::vector<int> computedFirstNote;
+    const KeyHeatMap *storedKeyframes;  // read back instead of computed, if not nullptr
+    const int *storedFirstNote;
+
+    DecayHeatPolicy getPolicy() const {
+        return DecayHeatPolicy(pitch, velocity, firstNotes(), rate);
+    }
+};
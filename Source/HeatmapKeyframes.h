@@ -0,0 +1,186 @@
+/**
+ * @file HeatmapKeyframes.h - keyframes of a HeatmapList, for seeking in O(log n)
+ *
+ * A HeatmapList only records what changes at each frame, so the notes sounding at frame f are
+ * every frame before it replayed. HeatmapKeyframes stores that whole state (the sounding count
+ * per MIDI note number) before every KEYFRAME_INTERVAL-th frame. Seeking binary-searches the
+ * frame timestamps, copies the keyframe at or before the frame found and replays fewer than
+ * KEYFRAME_INTERVAL frames after it, however far into the piece the frame is.
+ *
+ * The keyframes are a scan over blocks of KEYFRAME_INTERVAL frames: each block's net change in
+ * the counts is the element, and a GeneralScanPolicy both totals the blocks and sums them up in
+ * parallel. They can also be read back from where they were stored, e.g. a cache entry (see
+ * HeatmapCache.h), without being computed again.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "WorkStealingPool.h"
+#include "GeneralScanPolicy.h"
+#include "NoteHistoScan.h"
+#include "Heatmap.h"
+
+/**
+ * A run of consecutive frames of a heatmap; the element type of KeyframeBlockPolicy.
+ */
+struct HeatmapBlock {
+    const HeatmapView *heatmap;
+    int first, last;
+};
+
+/**
+ * Net change in the sounding notes, per note number, over blocks of frames.
+ */
+struct KeyframeBlockPolicy {
+    typedef HeatmapBlock ElemType;
+    typedef NoteHisto TallyType;
+    typedef NoteHisto ResultType;
+
+    NoteHisto init() const {
+        return NoteHisto();
+    }
+
+    NoteHisto prepare(const HeatmapBlock &datum) const {
+        NoteHisto h;
+        fold(h, datum);
+        return h;
+    }
+
+    NoteHisto combine(const NoteHisto &left, const NoteHisto &right) const {
+        NoteHisto h;
+        for (int i = 0; i < h.N; i++)
+            h.bucket[i] = left.bucket[i] + right.bucket[i];
+        return h;
+    }
+
+    /**
+     * Adds a block's frames straight into the tally, walking the packed event array in order.
+     */
+    void fold(NoteHisto &tally, const HeatmapBlock &datum) const {
+        const HeatmapView &heatmap = *datum.heatmap;
+        const uint8_t *events = heatmap.events;
+        for (int f = datum.first; f < datum.last; f++) {
+            for (int e = heatmap.offsets[f]; e < heatmap.splits[f]; e++)
+                tally.bucket[events[e]]++;
+            for (int e = heatmap.splits[f]; e < heatmap.offsets[f + 1]; e++)
+                tally.bucket[events[e]]--;
+        }
+    }
+
+    NoteHisto gen(const NoteHisto &tally) const {
+        return tally;
+    }
+};
+
+/**
+ * Keyframe index of a heatmap, whose frames must outlive it (and not change).
+ */
+class HeatmapKeyframes {
+public:
+    /**
+     * Frames between keyframes: a seek replays at most KEYFRAME_INTERVAL - 1 frames, and the
+     * keyframes take 4 bytes per note number per KEYFRAME_INTERVAL frames.
+     */
+    static const int KEYFRAME_INTERVAL = 64;
+
+    /**
+     * An index of no frames.
+     */
+    HeatmapKeyframes() : computed(1), stored(nullptr) {
+    }
+
+    /**
+     * Computes the keyframes of the given heatmap.
+     * @param heatmap  the frames
+     * @param pool     executor to run on
+     */
+    HeatmapKeyframes(const HeatmapView &heatmap, WorkStealingPool &pool = WorkStealingPool::shared())
+            : heatmap(heatmap), stored(nullptr) {
+        int numFrames = heatmap.size(), blocks = numKeyframesFor(numFrames) - 1;
+        std::vector<HeatmapBlock> ranges(blocks);
+        for (int b = 0; b < blocks; b++)
+            ranges[b] = {&this->heatmap, b * KEYFRAME_INTERVAL, std::min(numFrames, (b + 1) * KEYFRAME_INTERVAL)};
+        computed.resize(blocks + 1);  // computed[0] is before anything sounds
+        if (blocks > 1) {
+            GeneralScanPolicy<KeyframeBlockPolicy> scanner(ranges, std::min(pool.size(), blocks - 1), &pool);
+            scanner.getScan(computed.data() + 1);
+        } else if (blocks == 1) {
+            KeyframeBlockPolicy().fold(computed[1], ranges[0]);
+        }
+    }
+
+    /**
+     * Reads back keyframes computed before, e.g. from a cache entry.
+     * @param heatmap    the frames
+     * @param keyframes  numKeyframesFor(heatmap.size()) keyframes, as keyframe() gave them (they
+     *                   must outlive the index)
+     */
+    HeatmapKeyframes(const HeatmapView &heatmap, const NoteHisto *keyframes) : heatmap(heatmap), stored(keyframes) {
+    }
+
+    /**
+     * @return how many keyframes index the given number of frames
+     */
+    static int numKeyframesFor(int numFrames) {
+        return (numFrames + KEYFRAME_INTERVAL - 1) / KEYFRAME_INTERVAL + 1;
+    }
+
+    /**
+     * @return number of frames indexed
+     */
+    int numFrames() const {
+        return heatmap.size();
+    }
+
+    int numKeyframes() const {
+        return numKeyframesFor(numFrames());
+    }
+
+    /**
+     * @return the sounding notes before frame k * KEYFRAME_INTERVAL (the keyframes are
+     *         contiguous, so this is also where all of them start for k = 0)
+     */
+    const NoteHisto &keyframe(int k) const {
+        return (stored != nullptr ? stored : computed.data())[k];
+    }
+
+    /**
+     * Index of the first frame after a time: every frame before it has happened by then.
+     * @return 0 if time is before the first frame, numFrames() if it is at or after the last
+     */
+    int frameAfter(double time) const {
+        return heatmap.frameAfter(time);
+    }
+
+    /**
+     * The sounding notes before frame f (after frames 0 .. f - 1): the keyframe at or before f,
+     * with the frames since replayed.
+     * @param f      frame number, 0 to numFrames()
+     * @param state  set to the counts
+     */
+    void stateBefore(int f, NoteHisto &state) const {
+        int k = f / KEYFRAME_INTERVAL;
+        state = keyframe(k);
+        if (f > k * KEYFRAME_INTERVAL)
+            KeyframeBlockPolicy().fold(state, {&heatmap, k * KEYFRAME_INTERVAL, f});
+    }
+
+    /**
+     * Seeks to a time in the piece.
+     * @param time   seconds from the start
+     * @param state  set to the sounding notes at that time
+     * @return the next frame to show, as frameAfter(time)
+     */
+    int seek(double time, NoteHisto &state) const {
+        int f = frameAfter(time);
+        stateBefore(f, state);
+        return f;
+    }
+
+private:
+    HeatmapView heatmap;
+    std::vector<NoteHisto> computed;
+    const NoteHisto *stored;  // read back instead of computed, if not nullptr
+};
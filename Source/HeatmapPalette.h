@@ -0,0 +1,166 @@
+/**
+ * @file HeatmapPalette.h - per-key heat and its colours
+ *
+ * The heatmap's state is the number of notes sounding per MIDI note number (a NoteHisto),
+ * updated with plain integer adds as frames play, or a decaying heat per note number (see
+ * HeatmapDecay.h) read for the time shown. Drawing folds that into one heat value per
+ * displayed key (12 pitch classes, the 88 piano keys or all 128 notes) and looks each one up
+ * in a palette computed once, so a frame costs O(keys) however many events it had, with no
+ * colour arithmetic per event.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "NoteHistoScan.h"
+
+/**
+ * What the heatmap shows a box for.
+ */
+enum HeatmapDisplayMode
+{
+    pitchClassDisplay,  // 12 boxes, every octave of a pitch class together
+    pianoKeyDisplay,    // 88 boxes, A0 (note 21) to C8 (note 108)
+    allNoteDisplay      // 128 boxes, one per MIDI note number
+};
+
+/**
+ * What a box's heat is.
+ */
+enum HeatmapHeatModel
+{
+    soundingHeat,   // the number of notes sounding
+    decayingHeat    // velocity struck, fading away (see HeatmapDecay.h)
+};
+
+/**
+ * MIDI note number of the lowest piano key, A0.
+ */
+static const int LOWEST_PIANO_KEY = 21;
+
+/**
+ * @return number of boxes in the given display mode
+ */
+static int getNumDisplayKeys(HeatmapDisplayMode mode)
+{
+    return mode == pitchClassDisplay ? 12 : mode == pianoKeyDisplay ? 88 : NoteHisto::N;
+}
+
+/**
+ * Heat of every box of a display mode: the notes sounding in it.
+ * @param sounding  notes sounding per note number
+ * @param heat      set to getNumDisplayKeys(mode) values
+ */
+static void getDisplayHeat(const NoteHisto& sounding, HeatmapDisplayMode mode, int* heat)
+{
+    if (mode == pitchClassDisplay)
+    {
+        std::fill(heat, heat + 12, 0);
+        for (int noteNumber = 0; noteNumber < NoteHisto::N; ++noteNumber)
+            heat[noteNumber % 12] += sounding.bucket[noteNumber];
+    }
+    else if (mode == pianoKeyDisplay)
+    {
+        std::copy(sounding.bucket + LOWEST_PIANO_KEY, sounding.bucket + LOWEST_PIANO_KEY + 88, heat);
+    }
+    else
+    {
+        std::copy(sounding.bucket, sounding.bucket + NoteHisto::N, heat);
+    }
+}
+
+/**
+ * Heat of every box of a display mode from decaying heat per note number, in palette steps.
+ * @param keyHeat  heat per note number (NoteHisto::N values)
+ * @param perStep  heat per palette step
+ * @param heat     set to getNumDisplayKeys(mode) values
+ */
+static void getDisplayHeat(const float* keyHeat, float perStep, HeatmapDisplayMode mode, int* heat)
+{
+    float boxHeat[NoteHisto::N];
+    int nKeys = getNumDisplayKeys(mode);
+    if (mode == pitchClassDisplay)
+    {
+        std::fill(boxHeat, boxHeat + 12, 0.0f);
+        for (int noteNumber = 0; noteNumber < NoteHisto::N; ++noteNumber)
+            boxHeat[noteNumber % 12] += keyHeat[noteNumber];
+    }
+    else
+    {
+        int lowest = mode == pianoKeyDisplay ? LOWEST_PIANO_KEY : 0;
+        std::copy(keyHeat + lowest, keyHeat + lowest + nKeys, boxHeat);
+    }
+    for (int i = 0; i < nKeys; ++i)
+        heat[i] = (int) (boxHeat[i] / perStep + 0.5f);
+}
+
+/**
+ * Colour for each heat, from a table: the cold colour brightened once per sounding note, up
+ * to a heat that is as good as white.
+ */
+class HeatmapPalette
+{
+public:
+    /**
+     * Heat from which every box looks the same.
+     */
+    static const int MAX_HEAT = 32;
+
+    HeatmapPalette(Colour cold = Colours::darkblue)
+    {
+        Colour colour = cold;
+        for (int heat = 0; heat <= MAX_HEAT; ++heat)
+        {
+            colours.push_back(colour);
+            const uint8_t bytes[] = { colour.getRed(), colour.getGreen(), colour.getBlue(), colour.getAlpha() };
+            uint32_t pixel;
+            std::memcpy(&pixel, bytes, 4);
+            rgba.push_back(pixel);
+            colour = colour.brighter();
+        }
+    }
+
+    /**
+     * @return the colour of a box with the given heat (clamped to 0 .. MAX_HEAT)
+     */
+    const Colour& getColour(int heat) const
+    {
+        return colours[clamp(heat)];
+    }
+
+    /**
+     * @return the same colour as 4 bytes in R, G, B, A order, for writing straight to a buffer
+     */
+    uint32_t getRGBA(int heat) const
+    {
+        return rgba[clamp(heat)];
+    }
+
+    /**
+     * Colours of n boxes from their heats.
+     */
+    void getColours(const int* heat, int n, Colour* out) const
+    {
+        for (int i = 0; i < n; ++i)
+            out[i] = colours[clamp(heat[i])];
+    }
+
+    void getRGBA(const int* heat, int n, uint32_t* out) const
+    {
+        for (int i = 0; i < n; ++i)
+            out[i] = rgba[clamp(heat[i])];
+    }
+
+private:
+    std::vector<Colour> colours;
+    std::vector<uint32_t> rgba;
+
+    static int clamp(int heat)
+    {
+        return std::min(std::max(heat, 0), (int) MAX_HEAT);
+    }
+};
@@ -0,0 +1,283 @@
+/**
+ * @file HeatmapRenderer.h - offline rendering of the heatmap animation to images
+ *
+ * NoteMapComponent draws the heatmap in real time on the message thread, so a video of a piece
+ * meant screen-capturing it for the piece's whole length. HeatmapRenderer draws the same
+ * picture for any time in the piece, into a juce::Image or a raw RGBA buffer. A video frame's
+ * state comes from the keyframes (see HeatmapKeyframes.h), not from the frame before it, so
+ * frames are independent and renderFrames draws many of them at once across the pool.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "WorkStealingPool.h"
+#include "Trace.h"
+#include "Heatmap.h"
+#include "HeatmapKeyframes.h"
+#include "HeatmapCache.h"
+#include "HeatmapDecay.h"
+#include "HeatmapPalette.h"
+
+/**
+ * Draws what NoteMapComponent shows: a full-height box per key of the display mode, left to
+ * right, coloured by its heat (the notes sounding, or the precomputed decaying heat).
+ */
+class HeatmapRenderer
+{
+public:
+    /**
+     * @param heatmap    the frames to draw
+     * @param keyframes  their keyframes (the frames and the keyframes must outlive the renderer)
+     * @param width      picture size in pixels, at least one per key
+     * @param height
+     * @param mode       which keys to draw a box for
+     * @param decay      decaying heat of the same frames to draw (must outlive the renderer), or
+     *                   nullptr to draw the notes sounding
+     */
+    HeatmapRenderer(const HeatmapView& heatmap, const HeatmapKeyframes& keyframes, int width, int height,
+                    HeatmapDisplayMode mode = pitchClassDisplay, const HeatmapDecay* decay = nullptr)
+        : heatmap(heatmap), keyframes(keyframes), decay(decay), width(width), height(height), mode(mode),
+          numKeys(getNumDisplayKeys(mode)), boxWidth(width / numKeys)
+    {
+    }
+
+    int getWidth() const
+    {
+        return width;
+    }
+
+    int getHeight() const
+    {
+        return height;
+    }
+
+    /**
+     * @return bytes of one RGBA picture
+     */
+    size_t getFrameBytes() const
+    {
+        return (size_t) width * height * 4;
+    }
+
+    /**
+     * @return number of video frames at the given rate, from time 0 to the last heatmap frame
+     */
+    int getNumFrames(double fps) const
+    {
+        return heatmap.empty() ? 0 : (int) std::floor(heatmap.timestamp(heatmap.size() - 1) * fps) + 1;
+    }
+
+    int getNumKeys() const
+    {
+        return numKeys;
+    }
+
+    /**
+     * The heat of every box at a time in the piece.
+     * @param heat  set to getNumKeys() values
+     */
+    void getKeyHeat(double time, int* heat) const
+    {
+        if (decay != nullptr)
+        {
+            float keyHeat[HeatmapDecay::N];
+            decay->heatAt(time, keyHeat);
+            getDisplayHeat(keyHeat, DECAY_HEAT_PER_STEP, mode, heat);
+            return;
+        }
+        NoteHisto sounding;
+        keyframes.seek(time, sounding);
+        getDisplayHeat(sounding, mode, heat);
+    }
+
+    /**
+     * Draws the picture at a time in the piece as RGBA bytes, top row first.
+     * @param pixels  getFrameBytes() bytes
+     */
+    void renderRGBA(double time, uint8_t* pixels) const
+    {
+        MIDI_TRACE_SPAN("paint", "paint");
+        int heat[NoteHisto::N];
+        uint32_t keyPixels[NoteHisto::N];
+        getKeyHeat(time, heat);
+        palette.getRGBA(heat, numKeys, keyPixels);
+        // the boxes are full-height columns, so every row is the same
+        const uint8_t black[] = { 0, 0, 0, 255 };
+        for (int x = 0; x < width; ++x)
+            std::memcpy(pixels + 4 * x, x < numKeys * boxWidth ? (const void*) &keyPixels[x / boxWidth] : black, 4);
+        size_t rowBytes = (size_t) width * 4;
+        for (int y = 1; y < height; ++y)
+            std::memcpy(pixels + y * rowBytes, pixels, rowBytes);
+    }
+
+    /**
+     * Draws the picture at a time in the piece into a new image.
+     */
+    Image render(double time) const
+    {
+        MIDI_TRACE_SPAN("paint", "paint");
+        int heat[NoteHisto::N];
+        Colour colours[NoteHisto::N];
+        getKeyHeat(time, heat);
+        palette.getColours(heat, numKeys, colours);
+        Image image(Image::ARGB, width, height, false);
+        Image::BitmapData bitmap(image, Image::BitmapData::writeOnly);
+        for (int x = 0; x < width; ++x)
+            bitmap.setPixelColour(x, 0, x < numKeys * boxWidth ? colours[x / boxWidth] : Colours::black);
+        for (int y = 1; y < height; ++y)
+            std::memcpy(bitmap.getLinePointer(y), bitmap.getLinePointer(0), (size_t) width * bitmap.pixelStride);
+        return image;
+    }
+
+    /**
+     * Draws video frames [first, last) at the given rate in parallel, as RGBA.
+     * @param pixels  (last - first) * getFrameBytes() bytes; frame f goes at (f - first) * getFrameBytes()
+     * @param pool    executor to run on
+     */
+    void renderFrames(double fps, int first, int last, uint8_t* pixels,
+                      WorkStealingPool& pool = WorkStealingPool::shared()) const
+    {
+        pool.parallelFor(first, last, [&](int f) {
+            renderRGBA(f / fps, pixels + (size_t) (f - first) * getFrameBytes());
+        });
+    }
+
+private:
+    HeatmapView heatmap;
+    const HeatmapKeyframes& keyframes;
+    const HeatmapDecay* decay;
+    int width, height;
+    HeatmapDisplayMode mode;
+    int numKeys, boxWidth;
+    HeatmapPalette palette;
+};
+
+/**
+ * Render mode from the command line:
+ *   --render <midi file> --out <file> [--format rgba|png] [--fps 30] [--width 600] [--height 370]
+ *   [--keys 12|88|128] [--heat decay|sounding] [--threads <n>]
+ * rgba writes every frame to one raw video file (e.g. for
+ * ffmpeg -f rawvideo -pix_fmt rgba -s 600x370 -r 30 -i <file> out.mp4), drawn a batch of frames at
+ * a time in parallel; png writes <file>-000000.png and so on, each drawn and encoded by its own
+ * task. Prints the frames rendered per second and how much faster than real time that is.
+ * @return process exit code: 0 if every frame was written
+ */
+static int runHeatmapRender(const StringArray& args, std::ostream& out)
+{
+    File input, output;
+    String format = "rgba", heatModel = "decay";
+    double fps = 30;
+    int width = 600, height = 370, keys = 12, threads = WorkStealingPool::defaultWorkers();
+    for (int i = 0; i < args.size(); i += 2)
+    {
+        const String& arg = args[i];
+        if (i + 1 == args.size())
+        {
+            out << "missing value for " << arg << std::endl;
+            return 1;
+        }
+        const String& value = args[i + 1];
+        if (arg == "--render")
+            input = File::getCurrentWorkingDirectory().getChildFile(value);
+        else if (arg == "--out")
+            output = File::getCurrentWorkingDirectory().getChildFile(value);
+        else if (arg == "--format")
+            format = value;
+        else if (arg == "--fps")
+            fps = value.getDoubleValue();
+        else if (arg == "--width")
+            width = value.getIntValue();
+        else if (arg == "--height")
+            height = value.getIntValue();
+        else if (arg == "--keys")
+            keys = value.getIntValue();
+        else if (arg == "--heat")
+            heatModel = value;
+        else if (arg == "--threads")
+            threads = std::max(1, value.getIntValue());
+        else
+        {
+            out << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    HeatmapDisplayMode mode = keys == 88 ? pianoKeyDisplay : keys == 128 ? allNoteDisplay : pitchClassDisplay;
+    if (!input.existsAsFile() || output == File() || (format != "rgba" && format != "png") || fps <= 0
+        || (keys != 12 && keys != 88 && keys != 128) || width < keys || height < 1
+        || (heatModel != "decay" && heatModel != "sounding"))
+    {
+        out << "usage: --render <midi file> --out <file> [--format rgba|png] [--fps 30] [--width 600]"
+               " [--height 370] [--keys 12|88|128] [--heat decay|sounding] [--threads <n>]" << std::endl;
+        return 1;
+    }
+
+    WorkStealingPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<CachedHeatmap> heatmap;
+    try
+    {
+        heatmap = readInHeatmap(input.getFullPathName(), HeatmapCache(HeatmapCache::getDefaultDirectory()), pool);
+    }
+    catch (...)
+    {
+        out << "can't read " << input.getFullPathName() << std::endl;
+        return 1;
+    }
+    // drawn straight from the cache entry, keyframes and heat included
+    HeatmapKeyframes keyframes = heatmap->getKeyframes();
+    HeatmapDecay decay = heatmap->getDecay();
+    HeatmapRenderer renderer(heatmap->getFrames(), keyframes, width, height, mode,
+                             heatModel == "decay" ? &decay : nullptr);
+    int numFrames = renderer.getNumFrames(fps);
+    double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    bool ok = true;
+    if (format == "rgba")
+    {
+        // batches bound the memory: a few frames per worker in flight, then written in order
+        int batch = 4 * pool.size();
+        std::vector<uint8_t> pixels((size_t) batch * renderer.getFrameBytes());
+        output.deleteFile();
+        FileOutputStream stream(output);
+        ok = stream.openedOk();
+        for (int first = 0; ok && first < numFrames; first += batch)
+        {
+            int last = std::min(numFrames, first + batch);
+            renderer.renderFrames(fps, first, last, pixels.data(), pool);
+            ok = stream.write(pixels.data(), (size_t) (last - first) * renderer.getFrameBytes());
+        }
+        stream.flush();
+        ok = ok && stream.getStatus().wasOk();
+    }
+    else
+    {
+        std::atomic<bool> written(true);
+        pool.parallelFor(0, numFrames, [&](int f) {
+            File frameFile = output.getSiblingFile(output.getFileNameWithoutExtension() + "-"
+                                                   + String(f).paddedLeft('0', 6) + ".png");
+            frameFile.deleteFile();
+            FileOutputStream stream(frameFile);
+            if (!stream.openedOk() || !PNGImageFormat().writeImageToStream(renderer.render(f / fps), stream))
+                written = false;
+        });
+        ok = written;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    out << numFrames << " frames of " << width << "x" << height << " at " << fps << " fps (" << numFrames / fps
+        << "s of video) in " << seconds << "s after " << loadSeconds << "s loading: " << numFrames / seconds
+        << " frames/s, " << numFrames / fps / seconds << "x real time" << std::endl;
+    if (!ok)
+        out << "couldn't write " << output.getFullPathName() << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+/**
+ * @file HeatmapScan.h - building a HeatmapList from a NoteStore
+ *
+ * Both builders start from the same event stream: every note start and end as an integer MIDI
+ * tick, radix sorted in parallel (getNoteEvents), so that simultaneous events are found by
+ * exact comparison. sweepHeatmap then emits the frames in one linear pass. scanHeatmap does the
+ * rest in parallel too: a NoteHistoScan splits the stream into frames and (on request) counts
+ * the sounding notes at each one, and the packed arrays are filled in frame by frame.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "WorkStealingPool.h"
+#include "Trace.h"
+#include "ParallelSort.h"
+#include "NoteStore.h"
+#include "NoteHistoScan.h"
+#include "Heatmap.h"
+
+/**
+ * Notes in a store at which buildHeatmap switches from sweepHeatmap to scanHeatmap; below it the
+ * extra passes of the parallel build cost more than they save. (On a single worker they always
+ * do.)
+ */
+static const int PARALLEL_HEATMAP_NOTES = 1 << 15;
+
+/**
+ * Run fn(i) for every i in [0, n), in blocks of consecutive indices on the pool.
+ */
+template<typename Fn>
+inline void parallelFill(int n, Fn &&fn, WorkStealingPool &pool)
+{
+    static const int FILL_GRAIN = 1 << 16;
+    int blocks = (n + FILL_GRAIN - 1) / FILL_GRAIN;
+    pool.parallelFor(0, blocks, [&](int b) {
+        int end = std::min(n, (b + 1) * FILL_GRAIN);
+        for (int i = b * FILL_GRAIN; i < end; i++)
+            fn(i);
+    });
+}
+
+/**
+ * One start and one end event per note, in time order, grouped exactly by MIDI tick.
+ *
+ * Each event gets the key tick * 2 + (start ? 1 : 0) and the keys are radix sorted in
+ * parallel, so at equal ticks the ends come first, then the starts, each in store order.
+ * Every event at a tick then takes the seconds of the first one, so that grouping by
+ * timestamp (as NoteHistoScan does) is grouping by tick, with no floating-point surprises.
+ * @param notes  a NoteStore sorted by onset
+ * @param pool   executor to run on
+ */
+inline std::vector<NoteEvent> getNoteEvents(const NoteStore &notes,
+                                            WorkStealingPool &pool = WorkStealingPool::shared())
+{
+    static const int TICK_GRAIN = 1 << 16;
+    int n = notes.size(), numEvents = 2 * n;
+    std::vector<uint64_t> keys(numEvents);
+    std::vector<int> ids(numEvents);  // note * 2 + (start ? 1 : 0)
+    parallelFill(n, [&](int i) {
+        keys[2 * i] = (uint64_t) notes.offsetTick[i] * 2;
+        keys[2 * i + 1] = (uint64_t) notes.onsetTick[i] * 2 + 1;
+        ids[2 * i] = 2 * i;
+        ids[2 * i + 1] = 2 * i + 1;
+    }, pool);
+    parallelRadixSort(keys, ids, pool);
+
+    std::vector<NoteEvent> events(numEvents);
+    int blocks = (numEvents + TICK_GRAIN - 1) / TICK_GRAIN;
+    pool.parallelFor(0, blocks, [&](int b) {
+        int first = b * TICK_GRAIN, end = std::min(numEvents, first + TICK_GRAIN), head = first;
+        while (head > 0 && keys[head - 1] / 2 == keys[first] / 2)
+            --head;
+        for (int e = first; e < end; e++) {
+            if (keys[e] / 2 != keys[head] / 2)
+                head = e;
+            int note = ids[e] / 2, headNote = ids[head] / 2;
+            bool start = ids[e] % 2 != 0;
+            double timestamp = ids[head] % 2 != 0 ? notes.onset[headNote] : notes.offset[headNote];
+            events[e] = { timestamp, notes.channel[note], notes.pitch[note], start ? 1 : -1 };
+        }
+    });
+    return events;
+}
+
+/**
+ * Heatmap build in one linear sweep over the tick-sorted events: one frame per distinct tick
+ * at which notes start or end, listing the notes that start and the notes that end (each in
+ * store order).
+ * @param notes    a NoteStore sorted by onset
+ * @param heatmap  cleared, then filled in
+ * @param pool     executor for sorting the events
+ */
+inline void sweepHeatmap(const NoteStore &notes, HeatmapList &heatmap,
+                         WorkStealingPool &pool = WorkStealingPool::shared())
+{
+    MIDI_TRACE_SPAN("build heatmap", "stage");
+    std::vector<NoteEvent> events = getNoteEvents(notes, pool);
+    int numEvents = (int) events.size();
+    heatmap.clear();
+    heatmap.reserve(numEvents, numEvents);
+    for (int first = 0; first < numEvents;) {
+        double timestamp = events[first].timestamp;
+        int starts = first, end = first;
+        while (starts < numEvents && events[starts].timestamp == timestamp && events[starts].delta < 0)
+            ++starts;
+        for (end = starts; end < numEvents && events[end].timestamp == timestamp; ++end)
+            ;
+        heatmap.addFrame(timestamp);
+        for (int e = starts; e < end; e++)
+            heatmap.addNoteEvent(events[e].noteNumber, true);
+        for (int e = first; e < starts; e++)
+            heatmap.addNoteEvent(events[e].noteNumber, false);
+        first = end;
+    }
+    MIDI_TRACE_COUNTER("frames", heatmap.size());
+    MIDI_TRACE_ALLOCATIONS();
+}
+
+/**
+ * Parallel heatmap build, with the same result as sweepHeatmap.
+ * @param notes    a NoteStore sorted by onset
+ * @param heatmap  replaced by the notes' heatmap
+ * @param counts   if given, set to the sounding notes per note number at the end of each frame
+ * @param pool     executor to run on
+ */
+inline void scanHeatmap(const NoteStore &notes, HeatmapList &heatmap, NoteHistoScan::ScanData *counts = nullptr,
+                        WorkStealingPool &pool = WorkStealingPool::shared())
+{
+    MIDI_TRACE_SPAN("build heatmap", "stage");
+    std::vector<NoteEvent> events = getNoteEvents(notes, pool);
+    NoteHistoScan scanner(events, pool.size(), &pool);
+    const std::vector<NoteFrame> &frames = scanner.getFrames();
+    int numFrames = scanner.numFrames(), numEvents = (int) events.size();
+
+    heatmap.timestamps.resize(numFrames);
+    heatmap.offsets.resize(numFrames + 1);
+    heatmap.splits.resize(numFrames);
+    heatmap.events.resize(numEvents);
+    parallelFill(numFrames, [&](int f) {
+        const NoteFrame &frame = frames[f];
+        int first = (int) (frame.events - events.data()), ends = 0;
+        while (ends < frame.count && frame.events[ends].delta < 0)
+            ++ends;
+        heatmap.timestamps[f] = frame.events->timestamp;
+        heatmap.offsets[f] = first;
+        heatmap.splits[f] = first + frame.count - ends;
+        uint8_t *out = heatmap.events.data() + first;  // the list wants the starts first
+        for (int e = ends; e < frame.count; e++)
+            *out++ = (uint8_t) frame.events[e].noteNumber;
+        for (int e = 0; e < ends; e++)
+            *out++ = (uint8_t) frame.events[e].noteNumber;
+    }, pool);
+    heatmap.offsets[numFrames] = numEvents;
+
+    if (counts != nullptr) {
+        counts->resize(numFrames);
+        scanner.getScan(counts);
+    }
+    MIDI_TRACE_COUNTER("frames", heatmap.size());
+    MIDI_TRACE_ALLOCATIONS();
+}
+
+/**
+ * Heatmap of a NoteStore with whichever builder suits its size: scanHeatmap for large stores
+ * on a pool of more than one worker, sweepHeatmap otherwise.
+ * @param notes    a NoteStore sorted by onset
+ * @param heatmap  replaced by the notes' heatmap
+ * @param pool     executor to run on
+ */
+inline void buildHeatmap(const NoteStore &notes, HeatmapList &heatmap,
+                         WorkStealingPool &pool = WorkStealingPool::shared())
+{
+    if (notes.size() < PARALLEL_HEATMAP_NOTES || pool.size() < 2)
+        sweepHeatmap(notes, heatmap, pool);
+    else
+        scanHeatmap(notes, heatmap, nullptr, pool);
+}
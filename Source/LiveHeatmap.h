@@ -0,0 +1,462 @@
+/**
+ * @file LiveHeatmap.h - the heatmap driven by live MIDI input
+ *
+ * Note events arrive on a thread the app doesn't own (a MIDI device callback, or
+ * MidiFileReplayThread standing in for one), which must not block or allocate. It stamps each
+ * event with the high-resolution clock and pushes it into a preallocated SpscRing; that is all
+ * it does. Once per display frame the drawing thread drains the ring into a LiveHeatState
+ * (the notes sounding and a decaying heat per key, as HeatmapDecay.h computes for files),
+ * draws it, and records how long each event took from the input to the finished pixels.
+ *
+ * With a display refreshing every frame, an event that comes in just after a frame has drained
+ * the ring waits for the next one, so latency ranges from the drawing time to a frame plus the
+ * drawing time whatever the queue does. What the queue must ensure is that no event waits
+ * longer: each one is in the first frame drawn after it arrives, and LatencyStats counts the
+ * events for which that fails.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "SpscRing.h"
+#include "Trace.h"
+#include "NoteStore.h"
+#include "NoteHistoScan.h"
+#include "HeatmapDecay.h"
+#include "HeatmapPalette.h"
+#include "HeatmapCache.h"
+
+/**
+ * A note starting or ending, as it came in.
+ */
+struct LiveNoteEvent
+{
+    int64 ticks;  // Time::getHighResolutionTicks() when it arrived
+    uint8 noteNumber, velocity;
+    bool noteOn;
+};
+
+/**
+ * Histogram of latencies in 0.1ms bins up to 100ms (longer ones go in the last bin), so
+ * recording one is a couple of adds, and a count of events that missed their frame.
+ */
+class LatencyStats
+{
+public:
+    static const int BINS = 1000;
+
+    /**
+     * @param ms           from arrival to finished pixels
+     * @param missedFrame  if it arrived before an earlier frame drained the queue
+     */
+    void record(double ms, bool missedFrame)
+    {
+        ++bins[jlimit(0, BINS, (int) (ms * 10.0))];
+        ++count;
+        missed += missedFrame ? 1 : 0;
+        total += ms;
+        maxMs = jmax(maxMs, ms);
+    }
+
+    void reset()
+    {
+        *this = LatencyStats();
+    }
+
+    int64 getCount() const
+    {
+        return count;
+    }
+
+    double getMean() const
+    {
+        return count > 0 ? total / count : 0.0;
+    }
+
+    double getMax() const
+    {
+        return maxMs;
+    }
+
+    /**
+     * @return events not shown by the first frame drawn after they arrived
+     */
+    int64 getMissedFrames() const
+    {
+        return missed;
+    }
+
+    /**
+     * @return latency in ms that the given fraction of events were within (to the bin's top)
+     */
+    double getPercentile(double fraction) const
+    {
+        int64 seen = 0;
+        for (int i = 0; i < BINS; ++i)
+            if ((seen += bins[i]) >= fraction * count)
+                return (i + 1) / 10.0;
+        return maxMs;
+    }
+
+private:
+    int64 bins[BINS + 1] = {};
+    int64 count = 0, missed = 0;
+    double total = 0.0, maxMs = 0.0;
+};
+
+/**
+ * The queue from the input thread to the drawing thread. push and pushMessage may only be
+ * called from one thread at a time, and drain from one other.
+ */
+class LiveHeatmapInput
+{
+public:
+    /**
+     * Events the queue holds: over 1.5s of input at 10k events/s.
+     */
+    static const int DEFAULT_CAPACITY = 1 << 14;
+
+    LiveHeatmapInput(int capacity = DEFAULT_CAPACITY) : ring((size_t) capacity), dropped(0)
+    {
+    }
+
+    /**
+     * Input thread: queues a note event. Wait-free, no locks or allocation.
+     * @return false if the queue was full and the event was dropped
+     */
+    bool push(int noteNumber, int velocity, bool noteOn)
+    {
+        if (ring.tryPush({ Time::getHighResolutionTicks(), (uint8) noteNumber, (uint8) velocity, noteOn }))
+            return true;
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /**
+     * Input thread: queues the message if it starts or ends a note (a note-on with velocity 0
+     * ends one).
+     */
+    void pushMessage(const MidiMessage& message)
+    {
+        if (message.isNoteOn())
+            push(message.getNoteNumber(), message.getVelocity(), true);
+        else if (message.isNoteOff())
+            push(message.getNoteNumber(), 0, false);
+    }
+
+    /**
+     * Drawing thread: hands fn every event queued so far, oldest first.
+     * @return number of events
+     */
+    template<typename Fn>
+    size_t drain(Fn&& fn)
+    {
+        return ring.popAll(fn);
+    }
+
+    /**
+     * @return events dropped because the queue was full
+     */
+    int64 getDropped() const
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    SpscRing<LiveNoteEvent> ring;
+    std::atomic<int64> dropped;
+};
+
+/**
+ * What the heatmap shows for live input, owned by the drawing thread.
+ */
+class LiveHeatState
+{
+public:
+    LiveHeatState(double rate = DEFAULT_HEAT_DECAY)
+        : rate(rate), lastTicks(Time::getHighResolutionTicks()), previousTicks(lastTicks)
+    {
+        std::fill(heat, heat + NoteHisto::N, 0.0f);
+        arrivals.reserve(LiveHeatmapInput::DEFAULT_CAPACITY);
+    }
+
+    /**
+     * Brings the state up to a time: decays the heat to it and applies every queued event,
+     * each decayed from when it arrived.
+     * @param now  Time::getHighResolutionTicks() of the frame being drawn
+     * @return number of events applied
+     */
+    size_t update(LiveHeatmapInput& input, int64 now)
+    {
+        double tickSeconds = 1.0 / Time::getHighResolutionTicksPerSecond();
+        float a = (float) std::exp(-rate * (now - lastTicks) * tickSeconds);
+        for (int i = 0; i < NoteHisto::N; ++i)
+            heat[i] *= a;
+        previousTicks = lastTicks;
+        lastTicks = now;
+        return input.drain([&](const LiveNoteEvent& event)
+        {
+            if (event.noteOn)
+            {
+                ++sounding.bucket[event.noteNumber];
+                heat[event.noteNumber] += event.velocity * (float) std::exp(-rate * jmax((int64) 0, now - event.ticks) * tickSeconds);
+            }
+            else if (sounding.bucket[event.noteNumber] > 0)
+            {
+                --sounding.bucket[event.noteNumber];
+            }
+            arrivals.push_back(event.ticks);
+        });
+    }
+
+    /**
+     * Heat of every box, as HeatmapRenderer::getKeyHeat.
+     */
+    void getKeyHeat(HeatmapHeatModel model, HeatmapDisplayMode mode, int* boxHeat) const
+    {
+        if (model == decayingHeat)
+            getDisplayHeat(heat, DECAY_HEAT_PER_STEP, mode, boxHeat);
+        else
+            getDisplayHeat(sounding, mode, boxHeat);
+    }
+
+    /**
+     * Call once the frame's pixels are drawn: records the latency of every event applied since
+     * the last call.
+     */
+    void finishFrame(LatencyStats& latency)
+    {
+        int64 now = Time::getHighResolutionTicks();
+        double tickMs = 1000.0 / Time::getHighResolutionTicksPerSecond();
+        // an event that arrived before the last frame's update could have been in that frame
+        for (int64 ticks : arrivals)
+            latency.record((now - ticks) * tickMs, ticks < previousTicks);
+        arrivals.clear();
+    }
+
+    void reset()
+    {
+        sounding = NoteHisto();
+        std::fill(heat, heat + NoteHisto::N, 0.0f);
+        arrivals.clear();
+        lastTicks = previousTicks = Time::getHighResolutionTicks();
+    }
+
+private:
+    double rate;
+    int64 lastTicks, previousTicks;  // of the last update and the one before
+    NoteHisto sounding;
+    float heat[NoteHisto::N];
+    std::vector<int64> arrivals;  // of the events applied this frame, for finishFrame
+};
+
+/**
+ * Stand-in for a MIDI device: plays a file's notes into a LiveHeatmapInput from its own
+ * thread, at the file's timing or at a fixed number of events per second. Everything it needs
+ * is built before the thread starts, so the thread itself only waits and pushes.
+ */
+class MidiFileReplayThread : public Thread
+{
+public:
+    /**
+     * @param notes            the notes to play
+     * @param input            where they go
+     * @param eventsPerSecond  0 plays the file once with its own timing; otherwise the events
+     *                         are evenly spaced at this rate, and the file loops until stopped
+     */
+    MidiFileReplayThread(const NoteStore& notes, LiveHeatmapInput& input, double eventsPerSecond = 0.0)
+        : Thread("MIDI file replay"), input(input), eventsPerSecond(eventsPerSecond)
+    {
+        events.reserve(2 * (size_t) notes.size());
+        for (int i = 0; i < notes.size(); ++i)
+        {
+            events.push_back({ notes.onset[i], notes.pitch[i], notes.velocity[i], true });
+            events.push_back({ notes.offset[i], notes.pitch[i], 0, false });
+        }
+        // ends before starts at the same time, as in the heatmap
+        std::stable_sort(events.begin(), events.end(), [](const ReplayEvent& a, const ReplayEvent& b)
+        {
+            return a.time < b.time || (a.time == b.time && !a.noteOn && b.noteOn);
+        });
+    }
+
+    ~MidiFileReplayThread()
+    {
+        stopThread(1000);
+    }
+
+    /**
+     * @return events pushed so far
+     */
+    int64 getPushed() const
+    {
+        return pushed.load(std::memory_order_relaxed);
+    }
+
+    void run() override
+    {
+        MIDI_TRACE_THREAD("MIDI file replay");
+        if (events.empty())
+            return;
+        const int64 ticksPerSecond = Time::getHighResolutionTicksPerSecond();
+        const int64 start = Time::getHighResolutionTicks();
+        for (int64 i = 0; eventsPerSecond > 0.0 || i < (int64) events.size(); ++i)
+        {
+            const ReplayEvent& event = events[(size_t) (i % (int64) events.size())];
+            double due = eventsPerSecond > 0.0 ? i / eventsPerSecond : event.time;
+            int64 dueTicks = start + (int64) (due * ticksPerSecond);
+            for (int64 wait; (wait = dueTicks - Time::getHighResolutionTicks()) > 0;)
+            {
+                if (threadShouldExit())
+                    return;
+                // sleep while there's time to, then spin the last stretch
+                if (wait > ticksPerSecond / 500)
+                    sleep(1);
+                else
+                    yield();
+            }
+            if (threadShouldExit())
+                return;
+            input.push(event.noteNumber, event.velocity, event.noteOn);
+            pushed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct ReplayEvent
+    {
+        double time;
+        uint8 noteNumber, velocity;
+        bool noteOn;
+    };
+
+    LiveHeatmapInput& input;
+    double eventsPerSecond;
+    std::vector<ReplayEvent> events;
+    std::atomic<int64> pushed { 0 };
+};
+
+/**
+ * Live latency benchmark from the command line:
+ *   --live <midi file> [--rate 10000] [--seconds 5] [--fps 60] [--width 600] [--height 370]
+ *   [--keys 12|88|128] [--heat decay|sounding]
+ * A MidiFileReplayThread plays the file's events into the queue at --rate events per second,
+ * while this thread stands in for the display: every 1 / fps seconds it drains the queue, draws
+ * the boxes into an RGBA buffer as HeatmapRenderer does, and records each event's latency from
+ * its arrival to the finished pixels. Prints the latency distribution against the frame time.
+ * @return process exit code: 0 if every event was in the first frame drawn after it arrived
+ *         and none were dropped
+ */
+inline int runLiveBench(const StringArray& args, std::ostream& out)
+{
+    File input;
+    double rate = 10000, seconds = 5, fps = 60;
+    int width = 600, height = 370, keys = 12;
+    String heatModel = "decay";
+    for (int i = 0; i < args.size(); i += 2)
+    {
+        const String& arg = args[i];
+        if (i + 1 == args.size())
+        {
+            out << "missing value for " << arg << std::endl;
+            return 1;
+        }
+        const String& value = args[i + 1];
+        if (arg == "--live")
+            input = File::getCurrentWorkingDirectory().getChildFile(value);
+        else if (arg == "--rate")
+            rate = value.getDoubleValue();
+        else if (arg == "--seconds")
+            seconds = value.getDoubleValue();
+        else if (arg == "--fps")
+            fps = value.getDoubleValue();
+        else if (arg == "--width")
+            width = value.getIntValue();
+        else if (arg == "--height")
+            height = value.getIntValue();
+        else if (arg == "--keys")
+            keys = value.getIntValue();
+        else if (arg == "--heat")
+            heatModel = value;
+        else
+        {
+            out << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (!input.existsAsFile() || rate <= 0 || seconds <= 0 || fps <= 0 || (keys != 12 && keys != 88 && keys != 128)
+        || width < keys || height < 1 || (heatModel != "decay" && heatModel != "sounding"))
+    {
+        out << "usage: --live <midi file> [--rate 10000] [--seconds 5] [--fps 60] [--width 600] [--height 370]"
+               " [--keys 12|88|128] [--heat decay|sounding]" << std::endl;
+        return 1;
+    }
+
+    NoteStore notes;
+    try
+    {
+        readInHeatmap(input.getFullPathName(), HeatmapCache(HeatmapCache::getDefaultDirectory()))->copyTo(notes);
+    }
+    catch (...)
+    {
+        out << "can't read " << input.getFullPathName() << std::endl;
+        return 1;
+    }
+    HeatmapDisplayMode mode = keys == 88 ? pianoKeyDisplay : keys == 128 ? allNoteDisplay : pitchClassDisplay;
+    HeatmapHeatModel model = heatModel == "decay" ? decayingHeat : soundingHeat;
+    HeatmapPalette palette;
+    int boxWidth = width / keys;
+    std::vector<uint8_t> pixels((size_t) width * height * 4);
+
+    LiveHeatmapInput queue;
+    LiveHeatState state;
+    LatencyStats latency;
+    MidiFileReplayThread replay(notes, queue, rate);
+    const int64 ticksPerSecond = Time::getHighResolutionTicksPerSecond();
+    const int64 frameTicks = (int64) (ticksPerSecond / fps);
+    int frames = 0;
+    double drawMs = 0.0;
+    replay.startThread(Thread::realtimeAudioPriority);
+    const int64 start = Time::getHighResolutionTicks(), end = start + (int64) (seconds * ticksPerSecond);
+    for (int64 next = start + frameTicks; next < end; next += frameTicks)
+    {
+        for (int64 wait; (wait = next - Time::getHighResolutionTicks()) > 0;)
+        {
+            if (wait > ticksPerSecond / 500)
+                Thread::sleep(1);
+            else
+                Thread::yield();
+        }
+        MIDI_TRACE_SPAN("paint", "paint");
+        int64 drawStart = Time::getHighResolutionTicks();
+        state.update(queue, drawStart);
+        int heat[NoteHisto::N];
+        uint32_t keyPixels[NoteHisto::N];
+        state.getKeyHeat(model, mode, heat);
+        palette.getRGBA(heat, keys, keyPixels);
+        const uint8_t black[] = { 0, 0, 0, 255 };
+        for (int x = 0; x < width; ++x)
+            std::memcpy(pixels.data() + 4 * x, x < keys * boxWidth ? (const void*) &keyPixels[x / boxWidth] : black, 4);
+        for (int y = 1; y < height; ++y)
+            std::memcpy(pixels.data() + (size_t) y * width * 4, pixels.data(), (size_t) width * 4);
+        state.finishFrame(latency);
+        drawMs += (Time::getHighResolutionTicks() - drawStart) * 1000.0 / ticksPerSecond;
+        ++frames;
+    }
+    replay.stopThread(1000);
+
+    double frameMs = 1000.0 / fps;
+    out << replay.getPushed() << " events in " << seconds << "s (" << replay.getPushed() / seconds << "/s), "
+        << queue.getDropped() << " dropped, " << frames << " frames of " << width << "x" << height << " at " << fps
+        << " fps (" << frameMs << "ms), " << (frames > 0 ? drawMs / frames : 0.0) << "ms drawing each" << std::endl;
+    out << "input to pixel latency: mean " << latency.getMean() << "ms, median " << latency.getPercentile(0.5)
+        << "ms, 99% " << latency.getPercentile(0.99) << "ms, max " << latency.getMax() << "ms; "
+        << latency.getMissedFrames() << " events missed the next frame" << std::endl;
+    return latency.getCount() > 0 && latency.getMissedFrames() == 0 && queue.getDropped() == 0 ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file LiveMidiInput.h - a MIDI input device feeding the live heatmap
+ *
+ * The device's callback runs on a MIDI thread, so all it does is hand note events to the
+ * LiveHeatmapInput queue (see LiveHeatmap.h), which neither locks nor allocates.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <memory>
+#include "LiveHeatmap.h"
+
+/**
+ * One open MIDI input device, pushing into a LiveHeatmapInput.
+ */
+class LiveMidiInput  : public MidiInputCallback
+{
+public:
+    /**
+     * @param input  the queue to feed (must outlive this)
+     */
+    LiveMidiInput(LiveHeatmapInput& input) : input(input)
+    {
+    }
+
+    ~LiveMidiInput()
+    {
+        close();
+    }
+
+    /**
+     * Opens and starts the first MIDI input device there is.
+     * @return its name, or an empty string if there is none
+     */
+    String openFirstDevice()
+    {
+        close();
+        auto devices = MidiInput::getAvailableDevices();
+        for (auto& info : devices)
+        {
+            device = MidiInput::openDevice(info.identifier, this);
+            if (device != nullptr)
+            {
+                device->start();
+                return info.name;
+            }
+        }
+        return {};
+    }
+
+    void close()
+    {
+        if (device != nullptr)
+        {
+            device->stop();
+            device = nullptr;
+        }
+    }
+
+    bool isOpen() const
+    {
+        return device != nullptr;
+    }
+
+    void handleIncomingMidiMessage(MidiInput*, const MidiMessage& message) override
+    {
+        input.pushMessage(message);
+    }
+
+private:
+    LiveHeatmapInput& input;
+    std::unique_ptr<MidiInput> device;
+
+    JUCE_DECLARE_NON_COPYABLE (LiveMidiInput)
+};
@@ -6,7 +6,13 @@
  */
 
 #include <JuceHeader.h>
+#include <fstream>
 #include "MainComponent.h"
+#include "CorpusBatch.h"
+#include "Trace.h"
+
+// counts the heap allocations for the trace (nothing unless built with MIDI_TRACE=1)
+MIDI_TRACE_ALLOCATION_HOOKS()
 
 //==============================================================================
 class ParallelMidiApplication  : public JUCEApplication
@@ -24,6 +30,30 @@ public:
     {
         // This method is where you should put your application's initialisation code..
 
+        auto args = getCommandLineParameterArray();
+
+        // --trace <file>: record the hot paths and write them there on quitting (see Trace.h)
+        int traceArg = args.indexOf("--trace");
+        if (traceArg >= 0 && traceArg + 1 < args.size())
+        {
+            traceFile = File::getCurrentWorkingDirectory().getChildFile(args[traceArg + 1]);
+            args.removeRange(traceArg, 2);
+           #if MIDI_TRACE
+            Trace::setThreadName("message thread");
+            Trace::start();
+           #else
+            std::cout << "tracing is compiled out: build with MIDI_TRACE=1 to use --trace" << std::endl;
+           #endif
+        }
+
+        // batch mode: process a corpus of files without opening the window
+        if (args.contains("--batch"))
+        {
+            setApplicationReturnValue(runCorpusBatch(args, std::cout));
+            quit();
+            return;
+        }
+
         mainWindow.reset (new MainWindow (getApplicationName()));
     }
 
@@ -32,6 +62,15 @@ public:
         // Add your application's shutdown code here..
 
         mainWindow = nullptr; // (deletes our window)
+
+       #if MIDI_TRACE
+        if (traceFile != File())
+        {
+            Trace::stop();
+            std::ofstream out(traceFile.getFullPathName().toStdString());
+            Trace::writeChromeJson(out);
+        }
+       #endif
     }
 
     //==============================================================================
@@ -96,6 +135,7 @@ public:
 
 private:
     std::unique_ptr<MainWindow> mainWindow;
+    File traceFile;
 };
 
 //==============================================================================
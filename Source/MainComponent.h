@@ -12,7 +12,9 @@
 #include <JuceHeader.h>
 #include "FileUtils.h"
 #include "MidiUtils.h"
+#include "HeatmapCache.h"
 #include "NoteMapComponent.h"
+#include "LiveMidiInput.h"
 
 const char * PROJECT_JUCER_FILENAME_FLAG = "Final-Project-ParAlgDev.jucer";
 const char * EXMP_SMF_T0_RPATH =           "/source/book1-prelude01.mid";
@@ -29,22 +31,25 @@ public:
     /**
      * Constructor which adds child components, intiates settings & runs main application logic
      */ 
-    MainComponent() : noteMapComponent(), startButton("Start"), animationStatus()
+    MainComponent() : noteMapComponent(), startButton("Start"), liveButton("Live"), animationStatus()
     {
-        HeatmapList * heatMaps;
         try {
-            auto midiFile = readInMidiFile(
-                getProjectFullPath(PROJECT_JUCER_FILENAME_FLAG) + EXMP_SMF_T0_RPATH
+            heatmap = readInHeatmap(
+                getProjectFullPath(PROJECT_JUCER_FILENAME_FLAG) + EXMP_SMF_T0_RPATH,
+                HeatmapCache(HeatmapCache::getDefaultDirectory())
             );
-            auto noteMap = getNoteMap(midiFile);
-            heatMaps = scanNoteMap(noteMap);
-                                   
+
         } catch (...) {
             DBG("Problem reading file");
         }
         
         addAndMakeVisible(startButton);
         startButton.addListener(this);
+
+        // live mode: the first MIDI input device, or replaying the file if there isn't one
+        addAndMakeVisible(liveButton);
+        liveButton.setClickingTogglesState(true);
+        liveButton.addListener(this);
         
         addAndMakeVisible(animationStatus);
         animationStatus.setFont(Font(16.0f, Font::bold));
@@ -53,14 +58,34 @@ public:
         animationStatus.setJustificationType(Justification::centred);
         
         addAndMakeVisible(noteMapComponent);
-        noteMapComponent.setNoteHeatMap(heatMaps);
+        if (heatmap != nullptr)
+            noteMapComponent.setNoteHeatMap(*heatmap);
+
+        addAndMakeVisible(keysBox);
+        keysBox.addItem("12 pitch classes", pitchClassDisplay + 1);
+        keysBox.addItem("88 piano keys", pianoKeyDisplay + 1);
+        keysBox.addItem("128 notes", allNoteDisplay + 1);
+        keysBox.setSelectedId(pitchClassDisplay + 1, dontSendNotification);
+        keysBox.onChange = [this] { noteMapComponent.setDisplayMode((HeatmapDisplayMode) (keysBox.getSelectedId() - 1)); };
+
+        addAndMakeVisible(heatBox);
+        heatBox.addItem("Decaying heat", decayingHeat + 1);
+        heatBox.addItem("Notes sounding", soundingHeat + 1);
+        heatBox.setSelectedId(noteMapComponent.getHeatModel() + 1, dontSendNotification);
+        heatBox.onChange = [this] { noteMapComponent.setHeatModel((HeatmapHeatModel) (heatBox.getSelectedId() - 1)); };
+
+        // scrubbing: seeks the heatmap to the slider's time
+        addAndMakeVisible(positionSlider);
+        positionSlider.setRange(0.0, jmax(noteMapComponent.getDuration(), 0.001));
+        positionSlider.setTextValueSuffix(" s");
+        positionSlider.onValueChange = [this] { noteMapComponent.seek(positionSlider.getValue()); };
            
         setSize(600, 400);
     }
 
     ~MainComponent()
     {
-        
+        stopLive();
     }
 
 
@@ -75,8 +100,12 @@ public:
     {
         auto rect = getBounds();
         auto top = rect.removeFromTop(30);
+        keysBox.setBounds(top.removeFromRight(top.getWidth() / 4));
+        heatBox.setBounds(top.removeFromRight(top.getWidth() / 3));
+        positionSlider.setBounds(rect.removeFromBottom(30));
         noteMapComponent.setBounds(rect);
-        startButton.setBounds(top.removeFromLeft(top.getWidth() / 2));
+        startButton.setBounds(top.removeFromLeft(top.getWidth() / 4));
+        liveButton.setBounds(top.removeFromLeft(top.getWidth() / 3));
         animationStatus.setBounds(top);
         
     }
@@ -92,11 +121,52 @@ private:
             animationStatus.setText(noteMapComponent.isAnimating() ? "Animating!" : "Not Animating", dontSendNotification);
 
         }
+        else if (b == &liveButton)
+        {
+            if (liveButton.getToggleState())
+                startLive();
+            else
+                stopLive();
+        }
     } 
 
+    void startLive()
+    {
+        String source = liveDevice.openFirstDevice();
+        if (source.isEmpty())
+        {
+            // no device: replaying the file stands in for one
+            if (notes.empty() && heatmap != nullptr)
+                heatmap->copyTo(notes);
+            liveReplay.reset(new MidiFileReplayThread(notes, liveInput));
+            liveReplay->startThread(Thread::realtimeAudioPriority);
+            source = "replaying file";
+        }
+        noteMapComponent.setLiveInput(&liveInput);
+        animationStatus.setText("Live: " + source, dontSendNotification);
+    }
+
+    void stopLive()
+    {
+        // stop the producer before the queue's consumer
+        liveDevice.close();
+        liveReplay = nullptr;
+        noteMapComponent.setLiveInput(nullptr);
+        animationStatus.setText("Not Animating", dontSendNotification);
+    }
+
+    std::unique_ptr<CachedHeatmap> heatmap;  // mapped, and played from by noteMapComponent
     NoteMapComponent noteMapComponent;
     TextButton startButton;
+    TextButton liveButton;
     Label animationStatus;
+    Slider positionSlider;
+    ComboBox keysBox;
+    ComboBox heatBox;
+    NoteStore notes;  // of the heatmap, copied out of it when the file is first replayed
+    LiveHeatmapInput liveInput;
+    LiveMidiInput liveDevice { liveInput };
+    std::unique_ptr<MidiFileReplayThread> liveReplay;
 
 
 
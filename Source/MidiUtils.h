@@ -13,9 +13,14 @@
 #include <JuceHeader.h>
 #include <iterator>
 #include <algorithm>
-#include <list>
 #include "FileUtils.h"
+#include "Arena.h"
 #include "NoteHistoScan.h"
+#include "WorkStealingPool.h"
+#include "Trace.h"
+#include "NoteStore.h"
+#include "Heatmap.h"
+#include "HeatmapScan.h"
 
 // program constants
 static const int NUM_MIDI_NOTES = 128;
@@ -33,7 +38,7 @@ typedef MidiMessage NoteOff;
 // Assumes complete midi file with matching noteOns/noteOffs
 struct Note 
 { 
-    Note(NoteOn & noteOn, NoteOff & noteOff)
+    Note(const NoteOn & noteOn, const NoteOff & noteOff)
     {
         this->noteOn = noteOn;
         this->noteOff = noteOff;
@@ -50,69 +55,191 @@ struct Note
 };
 
 // The container for all the midi notes in a midi file or collection of 
-// midi files organized by timestamp key
-typedef std::multimap<double, Note> NoteMap;
+// midi files organized by timestamp key; its nodes come from an Arena if it was made with one
+typedef std::multimap<double, Note, std::less<double>, ArenaAllocator<std::pair<const double, Note>>> NoteMap;
 
-// A single frame in the midi heatmap list
-struct HeatmapFrame 
-{ 
-    HeatmapFrame(double timestamp) : additions(), subtractions(), timestamp(timestamp) {}
+/**
+ * A note as found in a track: pointers to its messages, which stay inside the MidiFile.
+ */
+struct TrackNote
+{
+    double timestamp;
+    const MidiMessage* noteOn;
+    const MidiMessage* noteOff;
+};
 
-    void addNoteEvent(int noteNumber, bool noteOn) {
-        if (noteOn) additions.push_back(noteNumber);
-        else subtractions.push_back(noteNumber);
+/**
+ * Collects the notes of one track, in event (so timestamp) order.
+ */
+inline void getTrackNotes(const MidiMessageSequence& track, std::vector<TrackNote>& notes)
+{
+    notes.reserve(track.getNumEvents() / 2);
+    for (int i = 0; i < track.getNumEvents(); ++i) {
+        const MidiMessageSequence::MidiEventHolder* event = track.getEventPointer(i);
+        // the matching note off is linked by updateMatchedPairs() when the file is read;
+        // a note without one can't be placed and is left out
+        if (event->message.isNoteOn() && event->noteOffObject != nullptr)
+            notes.push_back({ event->message.getTimeStamp(), &event->message, &event->noteOffObject->message });
     }
+}
 
-    double timestamp; 
-    std::list<int> additions, subtractions;
-};
-
-// Final result of the scan which is used to animate the heatmap in order
-typedef std::list<HeatmapFrame> HeatmapList;
+/**
+ * Stable merge of the already sorted runs of notes for tracks [first, last), in parallel.
+ * Ties keep the lower track first, as repeated multimap inserts in track order would.
+ * @param pool  executor to run on
+ */
+inline void mergeTrackNotes(std::vector<TrackNote>& notes, const std::vector<size_t>& offsets, int first, int last,
+                            WorkStealingPool& pool)
+{
+    if (last - first < 2)
+        return;
+    int mid = first + (last - first) / 2;
+    pool.invoke([&] { mergeTrackNotes(notes, offsets, first, mid, pool); },
+                [&] { mergeTrackNotes(notes, offsets, mid, last, pool); });
+    std::inplace_merge(notes.begin() + offsets[first], notes.begin() + offsets[mid], notes.begin() + offsets[last],
+                       [](const TrackNote& a, const TrackNote& b) { return a.timestamp < b.timestamp; });
+}
 
 /**
- * Reads the NoteOn messages from a midi file into a single list
+ * Reads the NoteOn messages from a midi file into a single list.
+ * Tracks are read in parallel, straight from the file's sequences, and merged; simultaneous
+ * notes come out in track order, then event order.
+ * @param arena  where the map's nodes go (see Arena.h), which must outlive it; nullptr for the heap
+ * @param pool  executor to run on
  * @return notes in midi File
  */
-static NoteMap getNoteMap(MidiFile& midiFile)
+inline NoteMap getNoteMap(MidiFile& midiFile, Arena* arena = nullptr, WorkStealingPool& pool = WorkStealingPool::shared())
 {
+    MIDI_TRACE_SPAN("extract notes", "stage");
     midiFile.convertTimestampTicksToSeconds();
-    NoteMap data;
-    // Read tracks
-    for (int t = 0; t < midiFile.getNumTracks(); ++t) {
-        auto track = *midiFile.getTrack(t);
-        // Copy track note events
-        for(int i = 0; i < track.getNumEvents(); ++i){
-            MidiMessage midiMessage = track.getEventPointer(i)->message;
-            if (midiMessage.isNoteOn()) {
-                MidiMessage noteOff = track.getEventPointer(track.getIndexOfMatchingKeyUp(i))->message;
-                Note note( midiMessage, noteOff);
-                //DBG("Adding note with NoteOn = " + std::to_string(note.noteOn->getTimeStamp())
-                //    + " and NoteOff = " + std::to_string(note.noteOff->getTimeStamp()));
-
-                data.insert( { note.noteOn.getTimeStamp(), note }) ;
-            }
-        }
+    int numTracks = midiFile.getNumTracks();
+    std::vector<std::vector<TrackNote>> trackNotes(numTracks);
+    pool.parallelFor(0, numTracks, [&](int t) {
+        getTrackNotes(*midiFile.getTrack(t), trackNotes[t]);
+    });
+
+    std::vector<size_t> offsets(numTracks + 1, 0);
+    for (int t = 0; t < numTracks; ++t)
+        offsets[t + 1] = offsets[t] + trackNotes[t].size();
+    std::vector<TrackNote> notes(offsets[numTracks]);
+    pool.parallelFor(0, numTracks, [&](int t) {
+        std::copy(trackNotes[t].begin(), trackNotes[t].end(), notes.begin() + offsets[t]);
+    });
+    mergeTrackNotes(notes, offsets, 0, numTracks, pool);
+
+    NoteMap data { NoteMap::allocator_type(arena) };
+    for (auto & trackNote : notes) {
+        Note note(*trackNote.noteOn, *trackNote.noteOff);
+        data.emplace_hint(data.end(), trackNote.timestamp, note); // in order, so always at the end
     }
-    for (auto & iter : data)
+    MIDI_TRACE_COUNTER("notes", data.size());
+    MIDI_TRACE_ALLOCATIONS();
+    return data;
+}
+
+/**
+ * Reads the notes of a midi file into a NoteStore, one track per task, sorted by onset with
+ * the same ordering as getNoteMap (simultaneous notes in track order, then event order).
+ * The times in seconds come from a converted copy of the file, so the file itself is left
+ * timed in ticks and can be read again.
+ * @param midiFile  as read by MidiFile::readFrom, still timed in ticks: not one already given
+ *                  to getNoteMap, which converts it to seconds
+ * @param pool  executor to run on
+ * @return notes in midi File
+ */
+inline NoteStore getNoteStore(const MidiFile& midiFile, WorkStealingPool& pool = WorkStealingPool::shared())
+{
+    MIDI_TRACE_SPAN("extract notes", "stage");
+    MidiFile inSeconds(midiFile);
+    inSeconds.convertTimestampTicksToSeconds();
+    int numTracks = midiFile.getNumTracks();
+    std::vector<std::vector<TrackNote>> trackNotes(numTracks), trackSeconds(numTracks);
+    pool.parallelFor(0, numTracks, [&](int t) {
+        // the copy's tracks hold the same notes in the same order, timed in seconds
+        getTrackNotes(*midiFile.getTrack(t), trackNotes[t]);
+        getTrackNotes(*inSeconds.getTrack(t), trackSeconds[t]);
+    });
+
+    std::vector<int> offsets(numTracks + 1, 0);
+    for (int t = 0; t < numTracks; ++t)
+        offsets[t + 1] = offsets[t] + (int) trackNotes[t].size();
+    NoteStore store;
+    store.resize(offsets[numTracks]);
+    pool.parallelFor(0, numTracks, [&](int t) {
+        int i = offsets[t];
+        for (size_t k = 0; k < trackNotes[t].size(); ++k, ++i) {
+            const TrackNote & trackNote = trackNotes[t][k];
+            store.onsetTick[i] = (uint32_t) trackNote.noteOn->getTimeStamp();
+            store.offsetTick[i] = (uint32_t) trackNote.noteOff->getTimeStamp();
+            store.onset[i] = trackSeconds[t][k].noteOn->getTimeStamp();
+            store.offset[i] = trackSeconds[t][k].noteOff->getTimeStamp();
+            store.pitch[i] = (uint8_t) trackNote.noteOn->getNoteNumber();
+            store.velocity[i] = trackNote.noteOn->getVelocity();
+            store.channel[i] = (uint8_t) trackNote.noteOn->getChannel();
+            store.track[i] = (uint16_t) t;
+        }
+    });
+    store.sortByOnset(pool);
+    MIDI_TRACE_COUNTER("notes", store.size());
+    MIDI_TRACE_ALLOCATIONS();
+    return store;
+}
+
+/**
+ * Flattens a NoteMap into one start and one end event per note, ready for sortByChannel.
+ * @return the note events, in NoteMap order
+ */
+inline std::vector<NoteEvent> getNoteEvents(const NoteMap& noteMap)
+{
+    std::vector<NoteEvent> events;
+    events.reserve(noteMap.size() * 2);
+    for (auto & iter : noteMap)
     {
-        DBG("DataMap - Note #" + std::to_string(iter.second.noteOn.getNoteNumber()) + " @ map key: " + std::to_string(iter.first) + " NoteOn = " 
-            + std::to_string(iter.second.noteOn.getTimeStamp()) + " and NoteOff = " + std::to_string(iter.second.noteOff.getTimeStamp()));
+        const Note & note = iter.second;
+        int channel = note.noteOn.getChannel(), noteNumber = note.noteOn.getNoteNumber();
+        events.push_back({ note.noteOn.getTimeStamp(), channel, noteNumber, 1 });
+        events.push_back({ note.noteOff.getTimeStamp(), channel, noteNumber, -1 });
     }
-    return data;
+    return events;
+}
+
+/**
+ * Example of a segmented scan: running per-channel counts of the sounding notes for a whole
+ * NoteMap, computed in one parallel pass rather than one scan per channel.
+ * @param noteMap  the notes
+ * @param events   set to the note events, sorted by channel then time
+ * @return         for each of the events, the notes sounding on its channel just after it
+ */
+inline std::vector<NoteHisto> getChannelNoteHistos(const NoteMap& noteMap, std::vector<NoteEvent>& events)
+{
+    events = getNoteEvents(noteMap);
+    std::vector<unsigned char> heads = sortByChannel(events);
+    return scanChannelNoteHistos(events, heads);
 }
 
 /**
- * Creates a NoteHeatMap from a NoteMap.
+ * Creates a NoteHeatMap from a NoteStore sorted by onset: one frame per distinct time at which
+ * notes start or end, listing the notes that start (in store order) and end (in offset order).
+ * Large stores are built in parallel when there is more than one worker (see HeatmapScan.h).
+ */
+inline HeatmapList * scanNoteMap(const NoteStore & notes)
+{
+    HeatmapList * noteHeatMap = new HeatmapList();
+    buildHeatmap(notes, *noteHeatMap);
+    return noteHeatMap;
+}
+
+/**
+ * Creates a NoteHeatMap from a NoteMap. Its working map comes from the same Arena as the
+ * NoteMap, if any.
  * TODO assumes MidiFile doesn't start with a NoteOff and each NoteOn has matching NoteOff
  */
-static HeatmapList * scanNoteMap(NoteMap & inputNoteMap)
+inline HeatmapList * scanNoteMap(NoteMap & inputNoteMap)
 {
+    MIDI_TRACE_SPAN("build heatmap", "stage");
     HeatmapList * noteHeatMap = new HeatmapList();
 
-    NoteMap pendingNoteOffMap; // holds noteOffs that will also update or create heatmaps
-    
-    int dbgCounter = 1;
+    NoteMap pendingNoteOffMap(inputNoteMap.get_allocator()); // holds noteOffs that will also update or create heatmaps
 
     /* 
      * Iterate through each noteOn in by timestamp key (chronological order)
@@ -121,22 +248,19 @@ static HeatmapList * scanNoteMap(NoteMap & inputNoteMap)
     auto & iter = inputNoteMap.begin();
     while (iter != inputNoteMap.end())
     {
-        DBG("------------LOOP #" + std::to_string(dbgCounter++) + "-----------\nPENDING NoteOffs: " + std::to_string(pendingNoteOffMap.size()));
         // Get time off the current noteOn event we're looking at
         auto timestamp = iter->first;         
         
-        // Initialize the heatmap for the current timestamp
-        HeatmapFrame frame(timestamp);
+        // Start the heatmap frame for the current timestamp
+        noteHeatMap->addFrame(timestamp);
        
         /*
         * Add all noteOns at the current timestamp into the heatmap
         */
-        DBG("Getting Notes that Start and End at " + std::to_string(timestamp));
         while (iter != inputNoteMap.end() && iter->first == timestamp)
         {
             int midiNoteNumber(iter->second.noteOn.getNoteNumber());
-            DBG("Adding noteOn  " + std::to_string(midiNoteNumber) + " - it ends at " + std::to_string(iter->second.noteOff.getTimeStamp()));
-            frame.addNoteEvent(midiNoteNumber, true);
+            noteHeatMap->addNoteEvent(midiNoteNumber, true);
             // Copy note to be added to pendingNoteOff mmap.
             Note off(iter->second);
             // add the note to noteOffs map by its timestamp, to eventually remove it
@@ -147,58 +271,41 @@ static HeatmapList * scanNoteMap(NoteMap & inputNoteMap)
         * Add any note offs occuring at the current timestamp to the heatmap
         */
         auto & offIter = pendingNoteOffMap.begin();
-        while (offIter->first == timestamp)
+        while (offIter != pendingNoteOffMap.end() && offIter->first == timestamp)
         {
             int midiNoteNumber(offIter->second.noteOn.getNoteNumber());
-            DBG("Adding noteOff " + std::to_string(midiNoteNumber));
-            frame.addNoteEvent(midiNoteNumber, false);
+            noteHeatMap->addNoteEvent(midiNoteNumber, false);
             offIter++;
         }
 
-        int numErased = pendingNoteOffMap.erase(timestamp);
-        if(numErased > 0) DBG("Erased " + std::to_string(numErased) + " notes from PendingNoteOffMap");
+        pendingNoteOffMap.erase(timestamp);
         
-        /*
-        * Add the heatMapFrame to HeatmapList 
-        */
-        noteHeatMap->push_back(frame);
-
         /* 
         * Now, check if we need to create any additional Heatmap Frames for of any noteOff event timestamps
         * which happen before the next NoteOn event, or before the end of the song.
         */
         // Get the next NoteOn timestamp, or set it to the previous timestamp if we just processed the final note.
         double nextNoteOnTimestamp = iter == inputNoteMap.end() ? timestamp : iter->first;
-        // Get next pending NoteOff (assumes there will at least 1 pending noteOff after noteOn triggered)
+        // Go through the pending NoteOffs in order, stopping when none are left (a rest, or the end)
         offIter = pendingNoteOffMap.begin();
-        auto nextNoteOffTimestamp = offIter->first; 
-        DBG("NextNoteOffTimestamp = " + std::to_string(nextNoteOffTimestamp));
-        // TODO optimize deletion logic to be inside loop. Need to increment iterator after deleting?
-        std::list<double> noteOffTimestampsToDelete; 
-        while (nextNoteOnTimestamp > nextNoteOffTimestamp || iter == inputNoteMap.end() && offIter != pendingNoteOffMap.end())
+        while (offIter != pendingNoteOffMap.end() && (nextNoteOnTimestamp > offIter->first || iter == inputNoteMap.end()))
         {
+            auto nextNoteOffTimestamp = offIter->first;
             // The heatmap frame for this note release timestamp
-            HeatmapFrame newFrame(nextNoteOffTimestamp);
-
-            DBG("Removing noteOffs at " + std::to_string(nextNoteOffTimestamp));
+            noteHeatMap->addFrame(nextNoteOffTimestamp);
             // remove all notes at timestamp in heatmap
             while(offIter != pendingNoteOffMap.end() && offIter->first == nextNoteOffTimestamp)
             {
                 int midiNoteNumber = offIter->second.noteOn.getNoteNumber(); // (noteOn/Off should have same note#)
-                frame.addNoteEvent(midiNoteNumber, false);
+                noteHeatMap->addNoteEvent(midiNoteNumber, false);
                 offIter++;   
             }
-            noteOffTimestampsToDelete.push_back(nextNoteOffTimestamp);
-            // Add the frame to the list of frames
-            noteHeatMap->push_back(newFrame);
-            if(offIter != pendingNoteOffMap.end())
-                nextNoteOffTimestamp = offIter->first;
         }
-        // remove all noteOffs processed from pendingNoteOffs map
-        int delCount = 0;
-        for (auto ts : noteOffTimestampsToDelete) delCount += pendingNoteOffMap.erase(ts);
-        if(delCount > 0) DBG("Erased " + std::to_string(delCount) + " from PendingNoteOffMap");
+        // remove all noteOffs processed from pendingNoteOffs map (they're the first ones, in order)
+        pendingNoteOffMap.erase(pendingNoteOffMap.begin(), offIter);
     }
+    MIDI_TRACE_COUNTER("frames", noteHeatMap->size());
+    MIDI_TRACE_ALLOCATIONS();
     return noteHeatMap;
 }
 
@@ -8,15 +8,16 @@
   ==============================================================================
 */
 
-#include "GeneralScan.h"
+#pragma once
 
-//class NoteScan : public GeneralScan<double, NoteHisto> {
-//        
-//};
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include "GeneralScanPolicy.h"
+#include "GeneralScanSegmented.h"
 
 /**
- * @class Histo for the NoteHistoScan reductions -- buckets data into 10 interior ranges
- *              plus two outlier ranges
+ * @class NoteHisto for the NoteHistoScan reductions -- a count per MIDI note number
  */
 struct NoteHisto {
     static const int N = 128;
@@ -29,47 +30,281 @@ struct NoteHisto {
     }
 };
 
-//std::ostream &operator<<(std::ostream &out, const NoteHisto &noteHisto) {
-//    //out << "|";
-//    //for (int count: noteHisto.bucket)
-//    //    out << count << "|";
-//    return out;
-//}
+/**
+ * A note starting (delta 1) or ending (delta -1) on a channel; the element type of
+ * NoteHistoPolicy.
+ */
+struct NoteEvent {
+    double timestamp;
+    int channel;
+    int noteNumber;
+    int delta;
+};
+
+/**
+ * Running count of the sounding notes, per note number, for GeneralScanSegmented.
+ */
+struct NoteHistoPolicy {
+    typedef NoteEvent ElemType;
+    typedef NoteHisto TallyType;
+    typedef NoteHisto ResultType;
+
+    NoteHisto init() const {
+        return NoteHisto();
+    }
+
+    NoteHisto prepare(const NoteEvent &datum) const {
+        NoteHisto h;
+        h.bucket[datum.noteNumber] += datum.delta;
+        return h;
+    }
+
+    NoteHisto combine(const NoteHisto &left, const NoteHisto &right) const {
+        NoteHisto h;
+        for (int i = 0; i < h.N; i++)
+            h.bucket[i] = left.bucket[i] + right.bucket[i];
+        return h;
+    }
+
+    NoteHisto gen(const NoteHisto &tally) const {
+        return tally;
+    }
+};
+
+/**
+ * Sorts events into one segment per channel, in time order within each channel (note ends
+ * before note starts at the same time, so a repeated note never counts twice).
+ * @param events  the events to sort
+ * @return        segment-head flags for GeneralScanSegmented, set at each channel's first event
+ */
+inline std::vector<unsigned char> sortByChannel(std::vector<NoteEvent> &events)
+{
+    std::stable_sort(events.begin(), events.end(), [](const NoteEvent &a, const NoteEvent &b) {
+        if (a.channel != b.channel)
+            return a.channel < b.channel;
+        if (a.timestamp != b.timestamp)
+            return a.timestamp < b.timestamp;
+        return a.delta < b.delta;
+    });
+    std::vector<unsigned char> heads(events.size(), 0);
+    for (size_t i = 0; i < events.size(); i++)
+        heads[i] = i == 0 || events[i].channel != events[i - 1].channel;
+    return heads;
+}
+
+/**
+ * Per-channel running NoteHisto counts, all channels in one segmented scan.
+ * @param events  events sorted by sortByChannel
+ * @param heads   the flags returned by sortByChannel
+ * @return        for each event, the notes sounding on its channel just after it
+ */
+inline std::vector<NoteHisto> scanChannelNoteHistos(const std::vector<NoteEvent> &events,
+                                                    const std::vector<unsigned char> &heads)
+{
+    std::vector<NoteHisto> histos(events.size());
+    if (!events.empty()) {
+        GeneralScanSegmented<NoteHistoPolicy> scanner(events, heads);
+        scanner.getScan(&histos);
+    }
+    return histos;
+}
+
+/**
+ * The note events at one timestamp: a run of a time-sorted NoteEvent stream. The element type
+ * of NoteFramePolicy.
+ */
+struct NoteFrame {
+    const NoteEvent *events;
+    int count;
+};
 
 /**
- * Collects a histogram from data.
+ * Running count of the sounding notes, per note number, one frame at a time.
  */
-//class NoteHistoScan : public GeneralScan<int, NoteHisto> {
-//public:
-//    NoteHistoScan(const std::vector<int> *data) : GeneralScan<int, NoteHisto>(data) {
-//    }
-//
-//protected:
-//    virtual NoteHisto init() const {
-//        NoteHisto h;
-//        return h;
-//    }
-//
-//    virtual NoteHisto prepare(const int &datum) const {
-//        NoteHisto h;
-//        int bucket_size = (h.hi - h.lo) / h.N;
-//        if (datum < h.lo)
-//            h.bucket[0]++;
-//        else if (datum >= h.hi)
-//            h.bucket[h.N + 1]++;
-//        else
-//            h.bucket[1 + (datum - h.lo) / bucket_size]++;
-//        return h;
-//    }
-//
-//    virtual NoteHisto combine(const NoteHisto &left, const NoteHisto &right) const {
-//        NoteHisto h;
-//        for (int i = 0; i < h.N + 2; i++)
-//            h.bucket[i] = left.bucket[i] + right.bucket[i];
-//        return h;
-//    }
-//
-//    virtual NoteHisto gen(const NoteHisto &tally) const {
-//        return tally;
-//    }
-//};
+struct NoteFramePolicy {
+    typedef NoteFrame ElemType;
+    typedef NoteHisto TallyType;
+    typedef NoteHisto ResultType;
+
+    NoteHisto init() const {
+        return NoteHisto();
+    }
+
+    NoteHisto prepare(const NoteFrame &datum) const {
+        NoteHisto h;
+        fold(h, datum);
+        return h;
+    }
+
+    NoteHisto combine(const NoteHisto &left, const NoteHisto &right) const {
+        NoteHisto h;
+        for (int i = 0; i < h.N; i++)
+            h.bucket[i] = left.bucket[i] + right.bucket[i];
+        return h;
+    }
+
+    /**
+     * Adds a frame's events straight into the tally; the leaf loops use this in place of
+     * combine(tally, prepare(datum)), which would build and add two whole NoteHistos per frame.
+     */
+    void fold(NoteHisto &tally, const NoteFrame &datum) const {
+        for (int e = 0; e < datum.count; e++)
+            tally.bucket[datum.events[e].noteNumber] += datum.events[e].delta;
+    }
+
+    NoteHisto gen(const NoteHisto &tally) const {
+        return tally;
+    }
+};
+
+/**
+ * Splits a time-sorted event stream into frames, one per distinct timestamp, in parallel:
+ * each block of events counts the frames starting in it, the counts are summed into each
+ * block's first frame number, then every block fills in its frames.
+ * @param events  the events, in time order
+ * @param pool    executor to run on
+ * @return        the frames, in time order, covering every event
+ */
+static std::vector<NoteFrame> getNoteFrames(ScanSpan<const NoteEvent> events,
+                                            WorkStealingPool &pool = WorkStealingPool::shared())
+{
+    static const int FRAME_GRAIN = 1 << 16;
+    const NoteEvent *base = events.data();
+    int n = events.size(), blocks = (n + FRAME_GRAIN - 1) / FRAME_GRAIN;
+    auto isHead = [base](int i) { return i == 0 || base[i].timestamp != base[i - 1].timestamp; };
+
+    std::vector<int> firstFrame(blocks + 1, 0);
+    pool.parallelFor(0, blocks, [&](int b) {
+        int end = std::min(n, (b + 1) * FRAME_GRAIN), heads = 0;
+        for (int i = b * FRAME_GRAIN; i < end; i++)
+            heads += isHead(i);
+        firstFrame[b + 1] = heads;
+    });
+    for (int b = 0; b < blocks; b++)
+        firstFrame[b + 1] += firstFrame[b];
+
+    std::vector<NoteFrame> frames(firstFrame[blocks]);
+    pool.parallelFor(0, blocks, [&](int b) {
+        int end = std::min(n, (b + 1) * FRAME_GRAIN), f = firstFrame[b];
+        for (int i = b * FRAME_GRAIN; i < end; i++)
+            if (isHead(i))
+                frames[f++].events = base + i;
+    });
+    int numFrames = (int) frames.size();
+    pool.parallelFor(0, blocks, [&](int b) {
+        int end = std::min(firstFrame[b + 1], numFrames);
+        for (int f = firstFrame[b]; f < end; f++)
+            frames[f].count = (int) ((f + 1 < numFrames ? frames[f + 1].events : base + n) - frames[f].events);
+    });
+    return frames;
+}
+
+/**
+ * Active-note counts at every frame of a time-sorted stream of note on/off events.
+ *
+ * The stream is split into frames (getNoteFrames) and the frames are scanned with a
+ * GeneralScanPolicy<NoteFramePolicy>, so the result for frame f is how many notes of each
+ * note number are sounding once everything up to and including frame f has happened. Only
+ * one NoteHisto is written per frame, not per event, and within a leaf task the events are
+ * added straight into the running tally.
+ */
+class NoteHistoScan {
+public:
+    /**
+     * @class RawData - a vector of NoteEvent in time order, how the events can be given to the ctor.
+     */
+    typedef std::vector<NoteEvent> RawData;
+
+    /**
+     * @class RawSpan - non-owning view of the events; converts implicitly from a RawData.
+     */
+    typedef ScanSpan<const NoteEvent> RawSpan;
+
+    /**
+     * @class ScanData - a vector of NoteHisto, one per frame, used for scan output.
+     */
+    typedef std::vector<NoteHisto> ScanData;
+
+    /**
+     * Default number of threads to use in the parallelization.
+     */
+    static const int N_THREADS = 16;
+
+    /**
+     * Construct the scanner and find the frames of the given events.
+     * @param raw          note events in time order (may be empty)
+     * @param n_threads    number of threads to use for parallelization, defaults to N_THREADS
+     * @param pool         executor to run on, defaults to WorkStealingPool::shared()
+     */
+    NoteHistoScan(const RawData *raw, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr)
+            : NoteHistoScan(RawSpan(*raw), n_threads, pool) {
+    }
+
+    /**
+     * Construct the scanner over events it doesn't own (which must outlive it).
+     */
+    NoteHistoScan(RawSpan raw, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr)
+            : frames(getNoteFrames(raw, pool != nullptr ? *pool : WorkStealingPool::shared())) {
+        if (frames.size() > 1)
+            scanner.reset(new FrameScan(frames, std::min(n_threads, numFrames() - 1), pool));
+    }
+
+    /**
+     * @return number of frames (distinct timestamps)
+     */
+    int numFrames() const {
+        return (int) frames.size();
+    }
+
+    /**
+     * @return the frames, each pointing into the events the scanner was given
+     */
+    const std::vector<NoteFrame> &getFrames() const {
+        return frames;
+    }
+
+    double timestamp(int f) const {
+        return frames[f].events->timestamp;
+    }
+
+    /**
+     * @return the counts after the last frame (all zero if every note ended)
+     */
+    NoteHisto getReduction() {
+        if (scanner)
+            return scanner->getReduction();
+        NoteHisto h;
+        if (!frames.empty())
+            NoteFramePolicy().fold(h, frames[0]);
+        return h;
+    }
+
+    /**
+     * Get the counts at every frame.
+     * @param output  scan results (vector is indexed by frame number)
+     */
+    void getScan(ScanData *output) {
+        if ((int) output->size() < numFrames())
+            throw std::invalid_argument("output is smaller than the data");
+        getScan(output->data());
+    }
+
+    /**
+     * Get the counts at every frame into any random-access output.
+     * @param output  random-access iterator, pointer or ScanSpan; output[f] gets the counts
+     *                at frame f
+     */
+    template<typename OutputIt>
+    void getScan(OutputIt output) {
+        if (scanner)
+            scanner->getScan(output);
+        else if (!frames.empty())
+            output[0] = getReduction();
+    }
+
+private:
+    typedef GeneralScanPolicy<NoteFramePolicy> FrameScan;
+
+    std::vector<NoteFrame> frames;
+    std::unique_ptr<FrameScan> scanner;  // the engine needs at least two frames
+};
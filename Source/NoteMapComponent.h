@@ -12,6 +12,12 @@
 
 #include <JuceHeader.h>
 #include "MidiUtils.h"
+#include "HeatmapCache.h"
+#include "HeatmapKeyframes.h"
+#include "HeatmapDecay.h"
+#include "HeatmapPalette.h"
+#include "LiveHeatmap.h"
+#include "Trace.h"
 #include <chrono>
 #include <ctime>
 #include <iterator>
@@ -19,16 +25,22 @@
 //==============================================================================
 /*
 * Note Heatmap Visualization Class
+* Keeps the notes sounding per note number as frames play, or reads the precomputed decaying
+* heat (see HeatmapDecay.h) for the time shown, and draws a box per key of the display mode
+* coloured from the palette (see HeatmapPalette.h). In live mode it instead shows what comes in
+* from a LiveHeatmapInput, redrawing every display frame (see LiveHeatmap.h)
 */
-class NoteMapComponent  : public Component
+class NoteMapComponent  : public Component, private Timer
 {
 public:
 
     void animate() 
     {
-        if (!animating)
+        if (!animating && liveInput == nullptr)
         {
-            currentFrame = noteMap->begin();
+            currentFrame = 0;
+            timeElapsed = 0.0;
+            sounding = NoteHisto();
             resized();
             startTime = std::chrono::steady_clock::now();
             animating = true;
@@ -41,62 +53,160 @@ public:
         return animating;
     }
 
-    NoteMapComponent() //: rectangles()
+    /**
+     * Jumps to a time in the piece: the boxes show the notes sounding then (restored from the
+     * nearest keyframe, see HeatmapKeyframes.h), and the animation carries on from there.
+     * @param seconds  time from the start of the piece
+     */
+    void seek(double seconds)
     {
-        animating = false;
-        noteMap = nullptr;
-        nDisplayBoxes = 12;
-       
+        currentFrame = keyframes.seek(seconds, sounding);
+        timeElapsed = seconds;
+        startTime = std::chrono::steady_clock::now() - std::chrono::microseconds((long long) (seconds * 100000.0));
+        if (currentFrame == noteMap.size()) animating = false;
+        repaint();
+    }
+
+    /**
+     * @return time of the last frame, in seconds
+     */
+    double getDuration() const
+    {
+        return !noteMap.empty() ? noteMap.timestamp(noteMap.size() - 1) : 0.0;
+    }
+
+    /**
+     * Shows a box per pitch class, per piano key or per MIDI note number.
+     */
+    void setDisplayMode(HeatmapDisplayMode mode)
+    {
+        displayMode = mode;
+        updateRectanglePositions();
+        repaint();
+    }
+
+    HeatmapDisplayMode getDisplayMode() const
+    {
+        return displayMode;
+    }
+
+    /**
+     * Colours the boxes by the notes sounding or by the decaying heat.
+     */
+    void setHeatModel(HeatmapHeatModel model)
+    {
+        heatModel = model;
+        keyframes.stateBefore(currentFrame, sounding);  // not kept up while decaying
+        repaint();
+    }
 
-        colours = new Colour[nDisplayBoxes];
-        rectangles = new Rectangle<int>[nDisplayBoxes];
-        for (int i = 0; i < nDisplayBoxes; ++i)
+    HeatmapHeatModel getHeatModel() const
+    {
+        return heatModel;
+    }
+
+    /**
+     * Shows live input instead of the heatmap: every frame drains the queue and draws the
+     * result, and the input-to-pixel latency is shown in the corner.
+     * @param input  the queue to drain (must outlive live mode), or nullptr to leave live mode
+     */
+    void setLiveInput(LiveHeatmapInput* input)
+    {
+        liveInput = input;
+        liveState.reset();
+        liveLatency.reset();
+        if (liveInput != nullptr)
         {
-            //rectangles[i];
-            colours[i] = Colours::darkblue;
-        
+            liveInput->drain([](const LiveNoteEvent&) {});  // left over from an earlier session
+            animating = false;
+            startTimerHz(LIVE_FPS);
         }
+        else
+        {
+            stopTimer();
+        }
+        repaint();
+    }
+
+    bool isLive() const
+    {
+        return liveInput != nullptr;
+    }
+
+    const LatencyStats& getLatency() const
+    {
+        return liveLatency;
+    }
+
+    NoteMapComponent()
+    {
+        animating = false;
         updateRectanglePositions();
-        
     }
 
     ~NoteMapComponent()
     {
-        delete[] colours;
     }
     
-    std::list<HeatmapFrame>::iterator currentFrame, prevFrame;
+    int currentFrame = 0; // index of the next frame to show
     std::chrono::time_point<std::chrono::steady_clock> startTime;
-    double timeElapsed = 0.0;
+    double timeElapsed = 0.0; // seconds into the piece shown
     void paint (Graphics& g) override
     {
-        if (animating) 
+        MIDI_TRACE_SPAN("paint", "paint");
+        if (animating && currentFrame < noteMap.size())
         {
             auto sPassed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count() / 100000.0f;
-            if (sPassed >= currentFrame->timestamp)
+            timeElapsed = sPassed;
+            // the decaying heat is precomputed for every frame, so only the counts replay frames
+            if (heatModel == decayingHeat)
+                currentFrame = keyframes.frameAfter(sPassed);
+            // every frame that is due, as adds to the counts; the colours are worked out once below
+            while (currentFrame < noteMap.size() && sPassed >= noteMap.timestamp(currentFrame))
             {
-                //DBG("SPassed = " + std::to_string(sPassed));
-
-                for (auto noteNumber : currentFrame->additions)
-                {
-                    int bucket = noteNumber % 12;
-                    colours[bucket] = colours[bucket].brighter();
-                }
-                for (auto noteNumber : currentFrame->subtractions)
-                {
-                    int bucket = noteNumber % 12;
-                    colours[bucket] = colours[bucket].darker();
-                }
-                
-                if (currentFrame++ == noteMap->end()) animating == false;
+                HeatmapFrame frame = noteMap.frame(currentFrame++);
+                for (auto noteNumber : frame.additions)
+                    ++sounding.bucket[noteNumber];
+                for (auto noteNumber : frame.subtractions)
+                    --sounding.bucket[noteNumber];
             }
-            
+            if (currentFrame == noteMap.size()) animating = false;
+        }
+
+        int nKeys = getNumDisplayKeys(displayMode);
+        int heat[NoteHisto::N];
+        Colour colours[NoteHisto::N];
+        if (liveInput != nullptr)
+        {
+            liveState.update(*liveInput, Time::getHighResolutionTicks());
+            liveState.getKeyHeat(heatModel, displayMode, heat);
+        }
+        else if (heatModel == decayingHeat)
+        {
+            float keyHeat[HeatmapDecay::N];
+            decay.heatAt(timeElapsed, keyHeat);
+            getDisplayHeat(keyHeat, DECAY_HEAT_PER_STEP, displayMode, heat);
+        }
+        else
+        {
+            getDisplayHeat(sounding, displayMode, heat);
         }
-        for (int i = 0; i < nDisplayBoxes; ++i)
+        palette.getColours(heat, nKeys, colours);
+        for (int i = 0; i < nKeys; ++i)
         {
             g.setColour(colours[i]);
             g.fillRect(rectangles[i]);
         }
+
+        if (liveInput != nullptr)
+        {
+            liveState.finishFrame(liveLatency);
+            g.setColour(Colours::white);
+            g.drawText("input to pixel: mean " + String(liveLatency.getMean(), 1) + " ms, max "
+                       + String(liveLatency.getMax(), 1) + " ms, " + String(liveLatency.getMissedFrames())
+                       + " late, " + String(liveInput->getDropped()) + " dropped",
+                       getLocalBounds().removeFromBottom(20).reduced(4, 0), Justification::centredLeft);
+        }
     }
 
     void resized() override
@@ -106,40 +216,56 @@ public:
     }
     
 
-    void setNoteHeatMap(HeatmapList *heatmapList) 
+    /**
+     * Plays the frames, keyframes and decaying heat straight from a cache entry: nothing is
+     * copied or computed.
+     * @param heatmap  the entry (see HeatmapCache.h), which must outlive its use here
+     */
+    void setNoteHeatMap(const CachedHeatmap& heatmap)
     {
-        this->noteMap = heatmapList;
-        DBG("Set NoteHeatMap List. Frames to animate: " + std::to_string(noteMap->size()));
+        noteMap = heatmap.getFrames();
+        keyframes = heatmap.getKeyframes();
+        decay = heatmap.getDecay();
+        DBG("Set NoteHeatMap List. Frames to animate: " + std::to_string(noteMap.size()));
         //findMostHits(); // TODO implement findMostHits using reduction or other parallel technique
     }
     //void findMostHits();
 private:
+    /**
+     * Frames per second drawn in live mode.
+     */
+    static const int LIVE_FPS = 60;
+
+    void timerCallback() override
+    {
+        repaint();
+    }
+
     //int maxHits; //TODO 
     void updateRectanglePositions()
     {
         DBG("Updating Rectangle Positions");
+        int nKeys = getNumDisplayKeys(displayMode);
         auto rectTemplate(getBounds());
-        int rectWidth = rectTemplate.getWidth() / nDisplayBoxes;
-        rectTemplate.setWidth(rectWidth);
-        for (int i = 0; i < nDisplayBoxes; ++i)
-        {
-            //auto rectBounds = bounds.removeFromLeft(width);
-
-            rectangles[i].setBounds(i * rectWidth, rectTemplate.getY(), rectTemplate.getWidth(), rectTemplate.getHeight());
-            //auto thisRect = rectangles[i];
-            //DBG(thisRect.get)
-        }
+        int rectWidth = rectTemplate.getWidth() / nKeys;
+        rectangles.resize(nKeys);
+        for (int i = 0; i < nKeys; ++i)
+            rectangles[i].setBounds(i * rectWidth, rectTemplate.getY(), rectWidth, rectTemplate.getHeight());
     }
     
     bool animating;
     double playbackRate = 5.0;
-    int nDisplayBoxes;
-    HeatmapList * noteMap;
-    Colour * colours;
-    Rectangle<int> * rectangles;
-   
-
-    
+    HeatmapDisplayMode displayMode = pitchClassDisplay;
+    HeatmapHeatModel heatModel = decayingHeat;
+    HeatmapView noteMap;  // the frames of a cache entry
+    HeatmapKeyframes keyframes;
+    HeatmapDecay decay;
+    NoteHisto sounding;  // notes sounding per note number, as of currentFrame
+    HeatmapPalette palette;
+    std::vector<Rectangle<int>> rectangles;
+    LiveHeatmapInput* liveInput = nullptr;
+    LiveHeatState liveState;
+    LatencyStats liveLatency;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (NoteMapComponent)
 };
@@ -0,0 +1,134 @@
+/**
+ * @file NoteStore.h - notes as flat, onset-sorted columns
+ *
+ * A NoteMap node holds two complete MidiMessages plus the tree links, well over 100 bytes per
+ * note, and iterating it chases pointers. A NoteStore keeps one contiguous array per field
+ * (29 bytes per note in all), so a pass over one field streams through memory, and each column
+ * can be handed to the GeneralScan classes as is (their RawSpan converts from a vector).
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#include "WorkStealingPool.h"
+#include "ParallelSort.h"
+
+/**
+ * Structure of arrays for a set of notes: element i of every column belongs to note i.
+ * After sortByOnset the notes are in onset order, simultaneous notes keeping the order they
+ * were added in.
+ */
+struct NoteStore
+{
+    std::vector<double> onset, offset;  // seconds
+    std::vector<uint32_t> onsetTick, offsetTick;  // the same times in MIDI ticks, exact for comparing
+    std::vector<uint8_t> pitch, velocity, channel;  // MIDI note number, velocity, channel 1-16
+    std::vector<uint16_t> track;
+
+    int size() const
+    {
+        return (int) onset.size();
+    }
+
+    bool empty() const
+    {
+        return onset.empty();
+    }
+
+    void resize(int n)
+    {
+        onset.resize(n);
+        offset.resize(n);
+        onsetTick.resize(n);
+        offsetTick.resize(n);
+        pitch.resize(n);
+        velocity.resize(n);
+        channel.resize(n);
+        track.resize(n);
+    }
+
+    void reserve(int n)
+    {
+        onset.reserve(n);
+        offset.reserve(n);
+        onsetTick.reserve(n);
+        offsetTick.reserve(n);
+        pitch.reserve(n);
+        velocity.reserve(n);
+        channel.reserve(n);
+        track.reserve(n);
+    }
+
+    void clear()
+    {
+        resize(0);
+    }
+
+    void add(double noteOnset, double noteOffset, int notePitch, int noteVelocity, int noteChannel, int noteTrack,
+             uint32_t noteOnsetTick, uint32_t noteOffsetTick)
+    {
+        onset.push_back(noteOnset);
+        offset.push_back(noteOffset);
+        onsetTick.push_back(noteOnsetTick);
+        offsetTick.push_back(noteOffsetTick);
+        pitch.push_back((uint8_t) notePitch);
+        velocity.push_back((uint8_t) noteVelocity);
+        channel.push_back((uint8_t) noteChannel);
+        track.push_back((uint16_t) noteTrack);
+    }
+
+    /**
+     * Stable sort of all the columns by onset: a parallel sort of the note indices, then each
+     * column gathered into its new order in parallel.
+     */
+    void sortByOnset(WorkStealingPool &pool = WorkStealingPool::shared())
+    {
+        std::vector<int> order(size());
+        std::iota(order.begin(), order.end(), 0);
+        const double *on = onset.data();
+        parallelStableSort(order.begin(), order.end(), [on](int a, int b) { return on[a] < on[b]; }, pool);
+        permute(order, pool);
+    }
+
+    /**
+     * @return the note indices in offset order (notes ending together stay in onset order)
+     */
+    std::vector<int> offsetOrder(WorkStealingPool &pool = WorkStealingPool::shared()) const
+    {
+        std::vector<int> order(size());
+        std::iota(order.begin(), order.end(), 0);
+        const double *off = offset.data();
+        parallelStableSort(order.begin(), order.end(), [off](int a, int b) { return off[a] < off[b]; }, pool);
+        return order;
+    }
+
+    /**
+     * Reorder every column so that new note i is old note order[i].
+     */
+    void permute(const std::vector<int> &order, WorkStealingPool &pool = WorkStealingPool::shared())
+    {
+        pool.invoke([&] { pool.invoke([&] { gather(onset, order, pool); }, [&] { gather(offset, order, pool); }); },
+                    [&] { pool.invoke([&] { gather(pitch, order, pool); }, [&] { gather(velocity, order, pool); }); });
+        pool.invoke([&] { gather(channel, order, pool); }, [&] { gather(track, order, pool); });
+        pool.invoke([&] { gather(onsetTick, order, pool); }, [&] { gather(offsetTick, order, pool); });
+    }
+
+private:
+    static const int GATHER_GRAIN = 1 << 16;
+
+    template<typename T>
+    static void gather(std::vector<T> &column, const std::vector<int> &order, WorkStealingPool &pool)
+    {
+        std::vector<T> sorted(order.size());
+        int n = (int) order.size(), blocks = (n + GATHER_GRAIN - 1) / GATHER_GRAIN;
+        pool.parallelFor(0, blocks, [&](int b) {
+            int end = std::min(n, (b + 1) * GATHER_GRAIN);
+            for (int i = b * GATHER_GRAIN; i < end; ++i)
+                sorted[i] = column[order[i]];
+        });
+        column.swap(sorted);
+    }
+};
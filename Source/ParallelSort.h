@@ -0,0 +1,119 @@
+/**
+ * @file ParallelSort.h - sorting and merging on the WorkStealingPool
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include "WorkStealingPool.h"
+
+/**
+ * Stable sort of [first, last) in parallel: runs of up to grain elements are sorted
+ * concurrently with std::stable_sort, then merged pairwise up a fork/join tree.
+ * @param first  random-access iterator to the first element
+ * @param last   one past the last element
+ * @param comp   strict weak ordering
+ * @param pool   executor to run on
+ * @param grain  largest run sorted by a single task
+ */
+template<typename RandomIt, typename Compare>
+void parallelStableSort(RandomIt first, RandomIt last, Compare comp,
+                        WorkStealingPool &pool = WorkStealingPool::shared(), int grain = 1 << 14) {
+    auto n = std::distance(first, last);
+    if (n <= grain) {
+        std::stable_sort(first, last, comp);
+        return;
+    }
+    RandomIt mid = first + n / 2;
+    pool.invoke([&] { parallelStableSort(first, mid, comp, pool, grain); },
+                [&] { parallelStableSort(mid, last, comp, pool, grain); });
+    std::inplace_merge(first, mid, last, comp);
+}
+
+/**
+ * Stable merge of the sorted ranges [first1, last1) and [first2, last2) into out, in parallel:
+ * the longer range is split at its middle, the other at the matching position (by binary
+ * search), and the two halves are merged concurrently. As with std::merge, of equal elements
+ * those from the first range come first. The output must not overlap either input.
+ * @param out    random-access iterator to the start of room for both ranges
+ * @param comp   strict weak ordering
+ * @param pool   executor to run on
+ * @param grain  largest merge done by a single task
+ * @return       out advanced past the merged elements
+ */
+template<typename RandomIt1, typename RandomIt2, typename OutputIt, typename Compare>
+OutputIt parallelMerge(RandomIt1 first1, RandomIt1 last1, RandomIt2 first2, RandomIt2 last2, OutputIt out,
+                       Compare comp, WorkStealingPool &pool = WorkStealingPool::shared(), int grain = 1 << 14) {
+    auto n1 = std::distance(first1, last1), n2 = std::distance(first2, last2);
+    if (n1 + n2 <= grain)
+        return std::merge(first1, last1, first2, last2, out, comp);
+    RandomIt1 mid1;
+    RandomIt2 mid2;
+    if (n1 >= n2) {
+        mid1 = first1 + n1 / 2;
+        mid2 = std::lower_bound(first2, last2, *mid1, comp);  // only the smaller ones go before *mid1
+    } else {
+        mid2 = first2 + n2 / 2;
+        mid1 = std::upper_bound(first1, last1, *mid2, comp);  // equal ones go before *mid2
+    }
+    OutputIt mid = out + (std::distance(first1, mid1) + std::distance(first2, mid2));
+    pool.invoke([&] { parallelMerge(first1, mid1, first2, mid2, out, comp, pool, grain); },
+                [&] { parallelMerge(mid1, last1, mid2, last2, mid, comp, pool, grain); });
+    return out + (n1 + n2);
+}
+
+/**
+ * Stable LSD radix sort of unsigned integer keys in parallel, carrying a value along with each
+ * key. Each pass sorts by one byte: every block of grain elements counts its digits, a prefix
+ * sum over (digit, block) gives each block the positions its elements go to, and the blocks
+ * scatter concurrently. Only as many passes are made as the largest key has bytes.
+ * @param keys    unsigned integer keys, sorted in place
+ * @param values  one value per key, reordered with the keys
+ * @param pool    executor to run on
+ * @param grain   elements per block
+ */
+template<typename Key, typename Value>
+void parallelRadixSort(std::vector<Key> &keys, std::vector<Value> &values,
+                       WorkStealingPool &pool = WorkStealingPool::shared(), int grain = 1 << 16) {
+    static const int RADIX = 256;
+    int n = (int) keys.size(), blocks = (n + grain - 1) / grain;
+    if (n < 2)
+        return;
+
+    std::vector<Key> blockMax(blocks);
+    pool.parallelFor(0, blocks, [&](int b) {
+        blockMax[b] = *std::max_element(keys.begin() + b * grain, keys.begin() + std::min(n, (b + 1) * grain));
+    });
+    Key maxKey = *std::max_element(blockMax.begin(), blockMax.end());
+
+    std::vector<Key> keyBuffer(n);
+    std::vector<Value> valueBuffer(n);
+    std::vector<int> positions(blocks * RADIX);
+    for (int shift = 0; shift < (int) sizeof(Key) * 8 && (maxKey >> shift) != 0; shift += 8) {
+        pool.parallelFor(0, blocks, [&](int b) {
+            int *count = &positions[b * RADIX], end = std::min(n, (b + 1) * grain);
+            std::fill(count, count + RADIX, 0);
+            for (int i = b * grain; i < end; i++)
+                count[(keys[i] >> shift) & (RADIX - 1)]++;
+        });
+        int sum = 0;  // digit-major, so each digit's elements stay in block order
+        for (int d = 0; d < RADIX; d++)
+            for (int b = 0; b < blocks; b++) {
+                int count = positions[b * RADIX + d];
+                positions[b * RADIX + d] = sum;
+                sum += count;
+            }
+        pool.parallelFor(0, blocks, [&](int b) {
+            int *next = &positions[b * RADIX], end = std::min(n, (b + 1) * grain);
+            for (int i = b * grain; i < end; i++) {
+                int to = next[(keys[i] >> shift) & (RADIX - 1)]++;
+                keyBuffer[to] = keys[i];
+                valueBuffer[to] = std::move(values[i]);
+            }
+        });
+        keys.swap(keyBuffer);
+        values.swap(valueBuffer);
+    }
+}
@@ -0,0 +1,608 @@
+/**
+ * @file ScanKernels.h - SIMD leaf loops for GeneralScanPolicy
+ *
+ * When a policy's tally is a plain int, float or double and the policy names its combine
+ * operation (a typedef called Operator, one of std::plus, std::multiplies, ScanKernels::Maximum
+ * or ScanKernels::Minimum for the tally type), the leaf loops of GeneralScanPolicy run through
+ * the vectorized kernels here instead of one element at a time:
+ *   - reduce keeps several vector accumulators in flight and folds them at the end;
+ *   - scan does an in-register (Hillis-Steele) prefix scan of each vector and carries the last
+ *     lane into the next one.
+ * prepare and gen are still the policy's own, applied to cache-sized blocks around the kernel.
+ * AVX2 is used when the CPU has it (checked once at runtime), otherwise SSE2; non-x86 builds and
+ * unsupported type/operator combinations use the scalar loops.
+ *
+ * Declaring Operator is a promise that combine(a, b) == Operator()(a, b). Floating-point results
+ * may differ in the last bits from the scalar loops since the vector lanes reassociate the
+ * operation (just as splitting the work across threads already does).
+ */
+
+#pragma once
+
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCAN_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define SCAN_KERNELS_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SCAN_KERNELS_AVX2 __attribute__((target("avx2")))
+#else
+#define SCAN_KERNELS_AVX2
+#endif
+
+namespace ScanKernels {
+
+/**
+ * Max as a function object, for use as a policy Operator.
+ */
+template<typename T>
+struct Maximum {
+    T operator()(const T &left, const T &right) const {
+        return left > right ? left : right;
+    }
+};
+
+/**
+ * Min as a function object, for use as a policy Operator.
+ */
+template<typename T>
+struct Minimum {
+    T operator()(const T &left, const T &right) const {
+        return left < right ? left : right;
+    }
+};
+
+typedef std::integral_constant<int, 0> Plus;
+typedef std::integral_constant<int, 1> Times;
+typedef std::integral_constant<int, 2> Max;
+typedef std::integral_constant<int, 3> Min;
+typedef std::integral_constant<int, -1> Unknown;
+
+/**
+ * Maps an Operator function object to one of the kernel operation tags.
+ */
+template<typename Op>
+struct KindOf {
+    typedef Unknown type;
+};
+
+template<typename T>
+struct KindOf<std::plus<T>> {
+    typedef Plus type;
+};
+
+template<typename T>
+struct KindOf<std::multiplies<T>> {
+    typedef Times type;
+};
+
+template<typename T>
+struct KindOf<Maximum<T>> {
+    typedef Max type;
+};
+
+template<typename T>
+struct KindOf<Minimum<T>> {
+    typedef Min type;
+};
+
+template<typename T>
+inline T identity(Plus) {
+    return T(0);
+}
+
+template<typename T>
+inline T identity(Times) {
+    return T(1);
+}
+
+template<typename T>
+inline T identity(Max) {
+    return std::numeric_limits<T>::lowest();
+}
+
+template<typename T>
+inline T identity(Min) {
+    return std::numeric_limits<T>::max();
+}
+
+template<typename T>
+inline T apply(T a, T b, Plus) {
+    return a + b;
+}
+
+template<typename T>
+inline T apply(T a, T b, Times) {
+    return a * b;
+}
+
+template<typename T>
+inline T apply(T a, T b, Max) {
+    return a > b ? a : b;
+}
+
+template<typename T>
+inline T apply(T a, T b, Min) {
+    return a < b ? a : b;
+}
+
+/**
+ * Which (tally type, operation) pairs have vector kernels.
+ */
+template<typename T, typename Kind>
+struct Supported {
+    static const bool value = SCAN_KERNELS_X86 &&
+                              (std::is_same<T, float>::value || std::is_same<T, double>::value ||
+                               (std::is_same<T, int>::value && !std::is_same<Kind, Times>::value)) &&
+                              !std::is_same<Kind, Unknown>::value;
+};
+
+#if SCAN_KERNELS_X86
+
+/**
+ * Lane index for shifting a vector up by k lanes (lanes below k are refilled with the identity).
+ */
+constexpr int from(int lane, int k) {
+    return lane >= k ? lane - k : 0;
+}
+
+/*
+ * Vector "instruction sets": one struct per (ISA, lane type) with the handful of operations
+ * the kernels need. shift<K> moves every lane up by K and fills the bottom K with id; last
+ * broadcasts the top lane.
+ */
+
+struct Sse2Int {
+    typedef int T;
+    typedef __m128i V;
+    static const int W = 4;
+
+    static V load(const T *p) { return _mm_loadu_si128((const __m128i *) p); }
+    static void store(T *p, V x) { _mm_storeu_si128((__m128i *) p, x); }
+    static V set1(T x) { return _mm_set1_epi32(x); }
+    static V last(V x) { return _mm_shuffle_epi32(x, 0xFF); }
+
+    template<int K>
+    static V shift(V x, V id) {
+        if (K >= W)
+            return id;
+        V mask = _mm_setr_epi32(K > 0 ? -1 : 0, K > 1 ? -1 : 0, K > 2 ? -1 : 0, 0);
+        return _mm_or_si128(_mm_and_si128(mask, id), _mm_andnot_si128(mask, _mm_slli_si128(x, (K * 4) & 15)));
+    }
+
+    static V apply(V a, V b, Plus) { return _mm_add_epi32(a, b); }
+    static V apply(V a, V b, Max) {
+        V gt = _mm_cmpgt_epi32(a, b);
+        return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+    }
+    static V apply(V a, V b, Min) {
+        V lt = _mm_cmplt_epi32(a, b);
+        return _mm_or_si128(_mm_and_si128(lt, a), _mm_andnot_si128(lt, b));
+    }
+};
+
+struct Sse2Float {
+    typedef float T;
+    typedef __m128 V;
+    static const int W = 4;
+
+    static V load(const T *p) { return _mm_loadu_ps(p); }
+    static void store(T *p, V x) { _mm_storeu_ps(p, x); }
+    static V set1(T x) { return _mm_set1_ps(x); }
+    static V last(V x) { return _mm_shuffle_ps(x, x, 0xFF); }
+
+    template<int K>
+    static V shift(V x, V id) {
+        if (K >= W)
+            return id;
+        V mask = _mm_castsi128_ps(_mm_setr_epi32(K > 0 ? -1 : 0, K > 1 ? -1 : 0, K > 2 ? -1 : 0, 0));
+        V shifted = _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), (K * 4) & 15));
+        return _mm_or_ps(_mm_and_ps(mask, id), _mm_andnot_ps(mask, shifted));
+    }
+
+    static V apply(V a, V b, Plus) { return _mm_add_ps(a, b); }
+    static V apply(V a, V b, Times) { return _mm_mul_ps(a, b); }
+    static V apply(V a, V b, Max) { return _mm_max_ps(a, b); }
+    static V apply(V a, V b, Min) { return _mm_min_ps(a, b); }
+};
+
+struct Sse2Double {
+    typedef double T;
+    typedef __m128d V;
+    static const int W = 2;
+
+    static V load(const T *p) { return _mm_loadu_pd(p); }
+    static void store(T *p, V x) { _mm_storeu_pd(p, x); }
+    static V set1(T x) { return _mm_set1_pd(x); }
+    static V last(V x) { return _mm_unpackhi_pd(x, x); }
+
+    template<int K>
+    static V shift(V x, V id) {
+        if (K >= W)
+            return id;
+        return _mm_move_sd(_mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(x), 8)), id);
+    }
+
+    static V apply(V a, V b, Plus) { return _mm_add_pd(a, b); }
+    static V apply(V a, V b, Times) { return _mm_mul_pd(a, b); }
+    static V apply(V a, V b, Max) { return _mm_max_pd(a, b); }
+    static V apply(V a, V b, Min) { return _mm_min_pd(a, b); }
+};
+
+struct Avx2Int {
+    typedef int T;
+    typedef __m256i V;
+    static const int W = 8;
+
+    SCAN_KERNELS_AVX2 static V load(const T *p) { return _mm256_loadu_si256((const __m256i *) p); }
+    SCAN_KERNELS_AVX2 static void store(T *p, V x) { _mm256_storeu_si256((__m256i *) p, x); }
+    SCAN_KERNELS_AVX2 static V set1(T x) { return _mm256_set1_epi32(x); }
+    SCAN_KERNELS_AVX2 static V last(V x) { return _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(7)); }
+
+    template<int K>
+    SCAN_KERNELS_AVX2 static V shift(V x, V id) {
+        if (K >= W)
+            return id;
+        V up = _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(from(0, K), from(1, K), from(2, K), from(3, K),
+                                                                from(4, K), from(5, K), from(6, K), from(7, K)));
+        return _mm256_blend_epi32(up, id, ((1 << K) - 1) & 0xFF);
+    }
+
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Plus) { return _mm256_add_epi32(a, b); }
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Max) { return _mm256_max_epi32(a, b); }
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Min) { return _mm256_min_epi32(a, b); }
+};
+
+struct Avx2Float {
+    typedef float T;
+    typedef __m256 V;
+    static const int W = 8;
+
+    SCAN_KERNELS_AVX2 static V load(const T *p) { return _mm256_loadu_ps(p); }
+    SCAN_KERNELS_AVX2 static void store(T *p, V x) { _mm256_storeu_ps(p, x); }
+    SCAN_KERNELS_AVX2 static V set1(T x) { return _mm256_set1_ps(x); }
+    SCAN_KERNELS_AVX2 static V last(V x) { return _mm256_permutevar8x32_ps(x, _mm256_set1_epi32(7)); }
+
+    template<int K>
+    SCAN_KERNELS_AVX2 static V shift(V x, V id) {
+        if (K >= W)
+            return id;
+        V up = _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(from(0, K), from(1, K), from(2, K), from(3, K),
+                                                             from(4, K), from(5, K), from(6, K), from(7, K)));
+        return _mm256_blend_ps(up, id, ((1 << K) - 1) & 0xFF);
+    }
+
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Plus) { return _mm256_add_ps(a, b); }
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Times) { return _mm256_mul_ps(a, b); }
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Max) { return _mm256_max_ps(a, b); }
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Min) { return _mm256_min_ps(a, b); }
+};
+
+struct Avx2Double {
+    typedef double T;
+    typedef __m256d V;
+    static const int W = 4;
+
+    SCAN_KERNELS_AVX2 static V load(const T *p) { return _mm256_loadu_pd(p); }
+    SCAN_KERNELS_AVX2 static void store(T *p, V x) { _mm256_storeu_pd(p, x); }
+    SCAN_KERNELS_AVX2 static V set1(T x) { return _mm256_set1_pd(x); }
+    SCAN_KERNELS_AVX2 static V last(V x) { return _mm256_permute4x64_pd(x, 0xFF); }
+
+    template<int K>
+    SCAN_KERNELS_AVX2 static V shift(V x, V id) {
+        if (K >= W)
+            return id;
+        V up = _mm256_permute4x64_pd(x, from(0, K) | from(1, K) << 2 | from(2, K) << 4 | from(3, K) << 6);
+        return _mm256_blend_pd(up, id, ((1 << K) - 1) & 0xF);
+    }
+
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Plus) { return _mm256_add_pd(a, b); }
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Times) { return _mm256_mul_pd(a, b); }
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Max) { return _mm256_max_pd(a, b); }
+    SCAN_KERNELS_AVX2 static V apply(V a, V b, Min) { return _mm256_min_pd(a, b); }
+};
+
+/*
+ * The two kernels, stamped out once per target so that the AVX2 copies may inline the AVX2
+ * intrinsics (GCC and Clang refuse to inline them into functions compiled for plain SSE2).
+ */
+#define SCAN_KERNELS_LOOPS(TARGET)                                                                  \
+    template<typename Isa, typename Kind>                                                           \
+    TARGET typename Isa::T reduce(const typename Isa::T *x, int n, Kind kind) {                     \
+        typedef typename Isa::T T;                                                                  \
+        typedef typename Isa::V V;                                                                  \
+        V id = Isa::set1(identity<T>(kind));                                                        \
+        V a0 = id, a1 = id, a2 = id, a3 = id;                                                       \
+        int i = 0;                                                                                  \
+        for (; i + 4 * Isa::W <= n; i += 4 * Isa::W) {                                              \
+            a0 = Isa::apply(a0, Isa::load(x + i), kind);                                            \
+            a1 = Isa::apply(a1, Isa::load(x + i + Isa::W), kind);                                   \
+            a2 = Isa::apply(a2, Isa::load(x + i + 2 * Isa::W), kind);                               \
+            a3 = Isa::apply(a3, Isa::load(x + i + 3 * Isa::W), kind);                               \
+        }                                                                                           \
+        for (; i + Isa::W <= n; i += Isa::W)                                                        \
+            a0 = Isa::apply(a0, Isa::load(x + i), kind);                                            \
+        a0 = Isa::apply(Isa::apply(a0, a1, kind), Isa::apply(a2, a3, kind), kind);                  \
+        T lanes[Isa::W];                                                                            \
+        Isa::store(lanes, a0);                                                                      \
+        T total = lanes[0];                                                                         \
+        for (int k = 1; k < Isa::W; k++)                                                            \
+            total = apply(total, lanes[k], kind);                                                   \
+        for (; i < n; i++)                                                                          \
+            total = apply(total, x[i], kind);                                                       \
+        return total;                                                                               \
+    }                                                                                               \
+                                                                                                    \
+    template<typename Isa, typename Kind>                                                           \
+    TARGET typename Isa::T scan(typename Isa::T *x, int n, typename Isa::T prior, Kind kind) {      \
+        typedef typename Isa::T T;                                                                  \
+        typedef typename Isa::V V;                                                                  \
+        V id = Isa::set1(identity<T>(kind));                                                        \
+        V carry = Isa::set1(prior);                                                                 \
+        int i = 0;                                                                                  \
+        for (; i + Isa::W <= n; i += Isa::W) {                                                      \
+            V v = Isa::load(x + i);                                                                 \
+            v = Isa::apply(v, Isa::template shift<1>(v, id), kind);                                 \
+            if (Isa::W > 2)                                                                         \
+                v = Isa::apply(v, Isa::template shift<2>(v, id), kind);                             \
+            if (Isa::W > 4)                                                                         \
+                v = Isa::apply(v, Isa::template shift<4>(v, id), kind);                             \
+            v = Isa::apply(carry, v, kind);                                                         \
+            Isa::store(x + i, v);                                                                   \
+            carry = Isa::last(v);                                                                   \
+        }                                                                                           \
+        T tally = i > 0 ? x[i - 1] : prior;                                                         \
+        for (; i < n; i++)                                                                          \
+            x[i] = tally = apply(tally, x[i], kind);                                                \
+        return tally;                                                                               \
+    }
+
+namespace sse2 {
+SCAN_KERNELS_LOOPS()
+}
+
+namespace avx2 {
+SCAN_KERNELS_LOOPS(SCAN_KERNELS_AVX2)
+}
+
+#undef SCAN_KERNELS_LOOPS
+
+/**
+ * @return true if the CPU (and OS) support AVX2; checked once
+ */
+inline bool hasAvx2() {
+    static const bool avx2 = [] {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+        if (!osxsave || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }();
+    return avx2;
+}
+
+template<typename T>
+struct IsaFor;
+
+template<>
+struct IsaFor<int> {
+    typedef Sse2Int Sse2;
+    typedef Avx2Int Avx2;
+};
+
+template<>
+struct IsaFor<float> {
+    typedef Sse2Float Sse2;
+    typedef Avx2Float Avx2;
+};
+
+template<>
+struct IsaFor<double> {
+    typedef Sse2Double Sse2;
+    typedef Avx2Double Avx2;
+};
+
+/**
+ * Vector reduction of x[0..n) with the best available instruction set.
+ */
+template<typename T, typename Kind>
+T reduce(const T *x, int n, Kind kind) {
+    if (hasAvx2())
+        return avx2::reduce<typename IsaFor<T>::Avx2>(x, n, kind);
+    return sse2::reduce<typename IsaFor<T>::Sse2>(x, n, kind);
+}
+
+/**
+ * Vector in-place inclusive scan of x[0..n), starting from prior.
+ * @return  the last tally (prior if n is 0)
+ */
+template<typename T, typename Kind>
+T scan(T *x, int n, T prior, Kind kind) {
+    if (hasAvx2())
+        return avx2::scan<typename IsaFor<T>::Avx2>(x, n, prior, kind);
+    return sse2::scan<typename IsaFor<T>::Sse2>(x, n, prior, kind);
+}
+
+#endif // SCAN_KERNELS_X86
+
+template<typename...>
+struct VoidType {
+    typedef void type;
+};
+
+/**
+ * The kernel operation tag for a policy: Unknown unless it has an Operator typedef naming one
+ * of the supported operations.
+ */
+template<typename Policy, typename Enable = void>
+struct PolicyKind {
+    typedef Unknown type;
+};
+
+template<typename Policy>
+struct PolicyKind<Policy, typename VoidType<typename Policy::Operator>::type> {
+    typedef typename KindOf<typename Policy::Operator>::type type;
+};
+
+/**
+ * True if the leaf loops for Policy can use the vector kernels.
+ */
+template<typename Policy>
+struct Vectorizable {
+    typedef typename Policy::TallyType T;
+    static const bool value = Supported<T, typename PolicyKind<Policy>::type>::value &&
+                              std::is_same<typename Policy::ResultType, T>::value;
+};
+
+/**
+ * True if Policy has an optional void fold(TallyType &tally, const ElemType &datum) const,
+ * equivalent to tally = combine(tally, prepare(datum)) but without building the temporaries
+ * (worth having when the tally is big, e.g., a histogram).
+ */
+template<typename Policy, typename = void>
+struct HasFold : std::false_type {
+};
+
+template<typename Policy>
+struct HasFold<Policy, typename VoidType<decltype(std::declval<const Policy &>().fold(
+        std::declval<typename Policy::TallyType &>(), std::declval<const typename Policy::ElemType &>()))>::type>
+        : std::true_type {
+};
+
+/**
+ * Leaf loops of GeneralScanPolicy: reduce or scan a contiguous run of the data.
+ * This is the scalar version, used for anything that isn't Vectorizable.
+ */
+template<typename Policy, typename Enable = void>
+struct Leaf {
+    typedef typename Policy::ElemType ElemType;
+    typedef typename Policy::TallyType TallyType;
+    typedef typename Policy::ResultType ResultType;
+
+    static TallyType reduce(const Policy &policy, const ElemType *in, int n, TallyType tally) {
+        for (int j = 0; j < n; j++)
+            accumulate(policy, tally, in[j], HasFold<Policy>());
+        return tally;
+    }
+
+    /**
+     * Inclusive or exclusive scan of in[0..n) into out[0..n); in and out may be the same memory.
+     * @return the tally including all n elements
+     */
+    template<typename OutputIt>
+    static TallyType scan(const Policy &policy, const ElemType *in, int n, TallyType tally, OutputIt out,
+                          bool inclusive = true) {
+        for (int j = 0; j < n; j++) {
+            if (inclusive) {
+                accumulate(policy, tally, in[j], HasFold<Policy>());
+                out[j] = policy.gen(tally);
+            } else {
+                TallyType prior = tally;  // in[j] is read before out[j] is written, for in-place scans
+                accumulate(policy, tally, in[j], HasFold<Policy>());
+                out[j] = policy.gen(prior);
+            }
+        }
+        return tally;
+    }
+
+private:
+    static void accumulate(const Policy &policy, TallyType &tally, const ElemType &datum, std::true_type) {
+        policy.fold(tally, datum);
+    }
+
+    static void accumulate(const Policy &policy, TallyType &tally, const ElemType &datum, std::false_type) {
+        tally = policy.combine(tally, policy.prepare(datum));
+    }
+};
+
+#if SCAN_KERNELS_X86
+
+/**
+ * Vectorized leaf loops. The data is prepared in blocks that stay in L1 (into a stack buffer
+ * for reduce, straight into the output for scan), then the block goes through the kernel.
+ */
+template<typename Policy>
+struct Leaf<Policy, typename std::enable_if<Vectorizable<Policy>::value>::type> {
+    typedef typename Policy::ElemType ElemType;
+    typedef typename Policy::TallyType T;
+    typedef typename PolicyKind<Policy>::type Kind;
+
+    static const int BLOCK = 2048;
+
+    static T reduce(const Policy &policy, const ElemType *in, int n, T tally) {
+        T block[BLOCK];
+        for (int j = 0; j < n; j += BLOCK) {
+            int m = n - j < BLOCK ? n - j : BLOCK;
+            for (int k = 0; k < m; k++)
+                block[k] = policy.prepare(in[j + k]);
+            tally = policy.combine(tally, ScanKernels::reduce(block, m, Kind()));
+        }
+        return tally;
+    }
+
+    /**
+     * Scan straight into a contiguous output (which may be the input itself).
+     */
+    static T scan(const Policy &policy, const ElemType *in, int n, T tally, T *out, bool inclusive = true) {
+        for (int j = 0; j < n; j += BLOCK) {
+            int m = n - j < BLOCK ? n - j : BLOCK;
+            tally = scanBlock(policy, in + j, m, tally, out + j, inclusive);
+        }
+        return tally;
+    }
+
+    /**
+     * Scan into any other random-access output, by way of a stack buffer.
+     */
+    template<typename OutputIt>
+    static T scan(const Policy &policy, const ElemType *in, int n, T tally, OutputIt out, bool inclusive = true) {
+        T block[BLOCK];
+        for (int j = 0; j < n; j += BLOCK) {
+            int m = n - j < BLOCK ? n - j : BLOCK;
+            tally = scanBlock(policy, in + j, m, tally, block, inclusive);
+            for (int k = 0; k < m; k++)
+                out[j + k] = block[k];
+        }
+        return tally;
+    }
+
+private:
+    static T scanBlock(const Policy &policy, const ElemType *in, int m, T tally, T *block, bool inclusive) {
+        for (int k = 0; k < m; k++)
+            block[k] = policy.prepare(in[k]);
+        T prior = tally;
+        tally = ScanKernels::scan(block, m, tally, Kind());
+        if (inclusive) {
+            for (int k = 0; k < m; k++)
+                block[k] = policy.gen(block[k]);
+        } else {
+            for (int k = 0; k < m; k++) {
+                T next = block[k];
+                block[k] = policy.gen(prior);
+                prior = next;
+            }
+        }
+        return tally;
+    }
+};
+
+#endif // SCAN_KERNELS_X86
+
+} // namespace ScanKernels
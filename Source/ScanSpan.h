@@ -0,0 +1,88 @@
+/**
+ * @file ScanSpan.h - non-owning view of contiguous scan input or output
+ *
+ * Lets the scan classes read from (and write to) memory they don't own, e.g. a memory-mapped
+ * file or a plain array, without first copying it into a std::vector.
+ */
+
+#pragma once
+
+#include <type_traits>
+#include <vector>
+
+/**
+ * Pointer and element count for a contiguous run of T. Converts implicitly from std::vector
+ * (any allocator), so APIs taking a ScanSpan accept vectors directly.
+ *
+ * @tparam T  element type; use const T for read-only views
+ */
+template<typename T>
+class ScanSpan {
+public:
+    typedef typename std::remove_const<T>::type value_type;
+
+    ScanSpan() : first(nullptr), count(0) {}
+
+    ScanSpan(T *data, int size) : first(data), count(size) {}
+
+    ScanSpan(T *begin, T *end) : first(begin), count((int) (end - begin)) {}
+
+    template<typename Alloc>
+    ScanSpan(std::vector<value_type, Alloc> &v) : first(v.data()), count((int) v.size()) {}
+
+    template<typename Alloc>
+    ScanSpan(const std::vector<value_type, Alloc> &v) : first(v.data()), count((int) v.size()) {}
+
+    /**
+     * A mutable span converts to a read-only one.
+     */
+    ScanSpan(const ScanSpan<value_type> &other) : first(other.data()), count(other.size()) {}
+
+    T *data() const {
+        return first;
+    }
+
+    int size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    T &operator[](int i) const {
+        return first[i];
+    }
+
+    T *begin() const {
+        return first;
+    }
+
+    T *end() const {
+        return first + count;
+    }
+
+    /**
+     * @return the view of count elements starting at offset
+     */
+    ScanSpan subspan(int offset, int count) const {
+        return ScanSpan(first + offset, count);
+    }
+
+private:
+    T *first;
+    int count;
+};
+
+/**
+ * Position k of a scan output: pointers and iterators advance, a span becomes a pointer.
+ */
+template<typename OutputIt>
+OutputIt outputAt(OutputIt output, int k) {
+    return output + k;
+}
+
+template<typename T>
+T *outputAt(const ScanSpan<T> &output, int k) {
+    return output.data() + k;
+}
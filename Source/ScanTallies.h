@@ -0,0 +1,220 @@
+/**
+ * @file ScanTallies.h - the example reduce/scan operations, for any of the scan engines
+ *
+ * Each tally is a template over the engine it derives from (GeneralScan, GeneralScanRecursive,
+ * GeneralScanSchwartz or GeneralScanLookback, all of which take the same four overrides), so the
+ * examples and the benchmark can run the same operations on every engine.
+ */
+
+#pragma once
+
+#include <iostream>
+#include <limits>
+
+/**
+ * Sum reduction.
+ * @tparam Scan  engine over int, e.g., GeneralScan<int>
+ */
+template<typename Scan>
+class SumTally : public Scan {
+public:
+    using Scan::Scan;
+
+protected:
+    virtual int init() const {
+        return 0;
+    }
+
+    virtual int prepare(const int &datum) const {
+        return datum;
+    }
+
+    virtual int combine(const int &left, const int &right) const {
+        return left + right;
+    }
+
+    virtual int gen(const int &tally) const {
+        return tally;
+    }
+};
+
+/**
+ * Max reduction.
+ * @tparam Scan     engine over NumType, e.g., GeneralScan<int>
+ * @tparam NumType  the type of object being maximized. Must support > operator.
+ */
+template<typename Scan, typename NumType = typename Scan::RawData::value_type>
+class MaxTally : public Scan {
+public:
+    using Scan::Scan;
+
+protected:
+    virtual NumType init() const {
+        return std::numeric_limits<NumType>::min();
+    }
+
+    virtual NumType prepare(const NumType &datum) const {
+        return datum;
+    }
+
+    virtual NumType combine(const NumType &left, const NumType &right) const {
+        if (left > right)
+            return left;
+        else
+            return right;
+    }
+
+    virtual NumType gen(const NumType &tally) const {
+        return tally;
+    }
+};
+
+/**
+ * TallyType for LowTen
+ */
+struct Ten {
+    int ten[10];
+};
+
+inline std::ostream &operator<<(std::ostream &out, const Ten &ten) {
+    out << "[";
+    for (int i = 0; i < 9; i++)
+        out << ten.ten[i] << ", ";
+    out << ten.ten[9] << "]";
+    return out;
+}
+
+/**
+ * Result is ten lowest numbers seen so far.
+ * @tparam Scan  engine from int to Ten, e.g., GeneralScan<int, Ten>
+ */
+template<typename Scan>
+class LowTenTally : public Scan {
+public:
+    using Scan::Scan;
+
+protected:
+    virtual Ten init() const {
+        Ten t;
+        for (int i = 0; i < 10; i++)
+            t.ten[i] = std::numeric_limits<int>::max();
+        return t;
+    }
+
+    virtual Ten prepare(const int &datum) const {
+        Ten t;
+        for (int i = 1; i < 10; i++)
+            t.ten[i] = std::numeric_limits<int>::max();
+        t.ten[0] = datum;
+        return t;
+    }
+
+    /**
+     * A little mini-merge of the two sides.
+     * @param left  lowest ten of some set
+     * @param right lowest ten of another set
+     * @return      lowest ten of combined set
+     */
+    virtual Ten combine(const Ten &left, const Ten &right) const {
+        Ten t;
+        int r = 0, l = 0;
+        for (int i = 0; i < 10; i++)
+            if (left.ten[l] < right.ten[r])
+                t.ten[i] = left.ten[l++];
+            else
+                t.ten[i] = right.ten[r++];
+        return t;
+    }
+
+    virtual Ten gen(const Ten &tally) const {
+        return tally;
+    }
+};
+
+/**
+ * @class Histo for the HistoScan reductions -- buckets data into 10 interior ranges
+ *              plus two outlier ranges
+ */
+struct Histo {
+    static const int N = 10;
+    int bucket[N + 2];
+    int hi, lo;
+
+    Histo() : hi(100), lo(0) {
+        for (int i = 0; i < N + 2; i++)
+            bucket[i] = 0;
+    }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const Histo &histo) {
+    out << "|";
+    for (int count: histo.bucket)
+        out << count << "|";
+    return out;
+}
+
+/**
+ * Collects a histogram from data.
+ * @tparam Scan  engine from int to Histo, e.g., GeneralScan<int, Histo>
+ */
+template<typename Scan>
+class HistoTally : public Scan {
+public:
+    using Scan::Scan;
+
+protected:
+    virtual Histo init() const {
+        Histo h;
+        return h;
+    }
+
+    virtual Histo prepare(const int &datum) const {
+        Histo h;
+        int bucket_size = (h.hi - h.lo) / h.N;
+        if (datum < h.lo)
+            h.bucket[0]++;
+        else if (datum >= h.hi)
+            h.bucket[h.N + 1]++;
+        else
+            h.bucket[1 + (datum - h.lo) / bucket_size]++;
+        return h;
+    }
+
+    virtual Histo combine(const Histo &left, const Histo &right) const {
+        Histo h;
+        for (int i = 0; i < h.N + 2; i++)
+            h.bucket[i] = left.bucket[i] + right.bucket[i];
+        return h;
+    }
+
+    virtual Histo gen(const Histo &tally) const {
+        return tally;
+    }
+};
+
+/**
+ * The reduce/scan from Exam 1: probability of no misses so far.
+ * @tparam Scan  engine over double, e.g., GeneralScan<double>
+ */
+template<typename Scan>
+class ExamTally : public Scan {
+public:
+    using Scan::Scan;
+
+protected:
+    virtual double init() const {
+        return 1.0;
+    }
+
+    virtual double prepare(const double &probability_of_miss) const {
+        return 1.0 - probability_of_miss;
+    }
+
+    virtual double combine(const double &left, const double &right) const {
+        return left * right;
+    }
+
+    virtual double gen(const double &tally) const {
+        return tally;
+    }
+};
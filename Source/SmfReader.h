@@ -0,0 +1,311 @@
+/**
+ * @file SmfReader.h - Standard MIDI File notes straight from the file's bytes
+ *
+ * Reading through juce::MidiFile builds a MidiMessage (and a sequence entry) for every event
+ * and getNoteStore then copies the notes out again. SmfReader decodes the track chunks in
+ * place, e.g. from a memory-mapped file, one track per task, and keeps only what a NoteStore
+ * needs: per track, a pending note per (channel, note number) and one compact record per note,
+ * reserved up front, so nothing is allocated per event.
+ *
+ * Notes are paired as juce::MidiFile::readFrom pairs them: a note ends at the
+ * next note-off (or velocity 0 note-on) of its channel and number, or where the same note starts
+ * again; a note that never ends is left out. Times are converted to seconds with the tempo
+ * changes of all the tracks, as MidiFile::convertTimestampTicksToSeconds does.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "WorkStealingPool.h"
+#include "Trace.h"
+#include "NoteStore.h"
+
+class SmfReader
+{
+public:
+    /**
+     * Reads the header and finds the track chunks; the bytes must outlive the reader.
+     * @throws invalid_argument if the bytes don't start with a MIDI file header
+     */
+    SmfReader(const uint8_t* bytes, size_t size) : bytes(bytes), size(size)
+    {
+        if (size < 14 || !hasTag(0, "MThd"))
+            throw std::invalid_argument("not a Standard MIDI File");
+        size_t headerSize = readUint32(4);
+        if (headerSize < 6)
+            throw std::invalid_argument("MIDI file header too short");
+        format = readUint16(8);
+        timeFormat = (int16_t) readUint16(12);
+
+        int expectedTracks = readUint16(10);
+        size_t pos = 8 + headerSize;
+        while (pos + 8 <= size && (int) tracks.size() < expectedTracks)
+        {
+            size_t chunkSize = readUint32(pos + 4);
+            size_t start = pos + 8, end = std::min(size, start + chunkSize);  // a cut-off file keeps what it has
+            if (hasTag(pos, "MTrk"))
+                tracks.push_back({ start, end });
+            pos = end;
+        }
+    }
+
+    int getFormat() const
+    {
+        return format;
+    }
+
+    int getNumTracks() const
+    {
+        return (int) tracks.size();
+    }
+
+    /**
+     * @return ticks per quarter note, or if negative, the SMPTE format (as juce::MidiFile)
+     */
+    int getTimeFormat() const
+    {
+        return timeFormat;
+    }
+
+    /**
+     * Decodes every track in parallel into a NoteStore sorted by onset, with the same order as
+     * getNoteStore (simultaneous notes in track order, then event order).
+     */
+    NoteStore readNotes(WorkStealingPool& pool = WorkStealingPool::shared()) const
+    {
+        MIDI_TRACE_SPAN("extract notes", "stage");
+        int numTracks = getNumTracks();
+        std::vector<std::vector<SmfNote>> trackNotes(numTracks);
+        std::vector<std::vector<TempoChange>> trackTempos(numTracks);
+        pool.parallelFor(0, numTracks, [&](int t) {
+            readTrack(tracks[t], trackNotes[t], trackTempos[t]);
+        }, numTracks);
+        TempoMap tempoMap(trackTempos, timeFormat);
+
+        std::vector<int> offsets(numTracks + 1, 0);
+        for (int t = 0; t < numTracks; ++t)
+            offsets[t + 1] = offsets[t] + (int) trackNotes[t].size();
+        NoteStore store;
+        store.resize(offsets[numTracks]);
+        pool.parallelFor(0, numTracks, [&](int t) {
+            int i = offsets[t];
+            for (const SmfNote& note : trackNotes[t])
+            {
+                store.onsetTick[i] = note.onTick;
+                store.offsetTick[i] = note.offTick;
+                store.onset[i] = tempoMap.seconds(note.onTick);
+                store.offset[i] = tempoMap.seconds(note.offTick);
+                store.pitch[i] = note.pitch;
+                store.velocity[i] = note.velocity;
+                store.channel[i] = (uint8_t) (note.channel + 1);
+                store.track[i] = (uint16_t) t;
+                ++i;
+            }
+        }, numTracks);
+        store.sortByOnset(pool);
+        MIDI_TRACE_COUNTER("notes", store.size());
+        MIDI_TRACE_ALLOCATIONS();
+        return store;
+    }
+
+private:
+    struct Chunk
+    {
+        size_t start, end;
+    };
+
+    struct SmfNote
+    {
+        uint32_t onTick, offTick;
+        uint8_t pitch, velocity, channel;
+    };
+
+    struct TempoChange
+    {
+        uint32_t tick;
+        uint32_t microsPerQuarter;
+    };
+
+    /**
+     * Ticks to seconds: the tempo changes of all tracks in tick order, with the time at each.
+     */
+    class TempoMap
+    {
+    public:
+        TempoMap(const std::vector<std::vector<TempoChange>>& trackTempos, int timeFormat)
+        {
+            if (timeFormat < 0)
+            {
+                secondsPerTick = 1.0 / (-(timeFormat >> 8) * (timeFormat & 0xff));
+                return;
+            }
+            double quarter = timeFormat > 0 ? 1.0 / timeFormat : 0.0;
+            secondsPerTick = 0.5 * quarter;  // 120 bpm until the first tempo change
+            for (auto& tempos : trackTempos)
+                changes.insert(changes.end(), tempos.begin(), tempos.end());
+            std::stable_sort(changes.begin(), changes.end(),
+                             [](const TempoChange& a, const TempoChange& b) { return a.tick < b.tick; });
+            double time = 0.0, rate = secondsPerTick;
+            uint32_t tick = 0;
+            for (auto& change : changes)
+            {
+                time += (change.tick - tick) * rate;
+                tick = change.tick;
+                rate = change.microsPerQuarter * 1e-6 * quarter;
+                times.push_back(time);
+                rates.push_back(rate);
+            }
+        }
+
+        double seconds(uint32_t tick) const
+        {
+            auto next = std::upper_bound(changes.begin(), changes.end(), tick,
+                                         [](uint32_t t, const TempoChange& change) { return t < change.tick; });
+            if (next == changes.begin())
+                return tick * secondsPerTick;
+            size_t c = (size_t) (next - changes.begin()) - 1;
+            return times[c] + (tick - changes[c].tick) * rates[c];
+        }
+
+    private:
+        std::vector<TempoChange> changes;
+        std::vector<double> times, rates;  // seconds at each change, and per tick after it
+        double secondsPerTick;
+    };
+
+    const uint8_t* bytes;
+    size_t size;
+    int format, timeFormat;
+    std::vector<Chunk> tracks;
+
+    bool hasTag(size_t pos, const char* tag) const
+    {
+        return std::equal(tag, tag + 4, bytes + pos, [](char c, uint8_t b) { return (uint8_t) c == b; });
+    }
+
+    uint32_t readUint16(size_t pos) const
+    {
+        return (uint32_t) bytes[pos] << 8 | bytes[pos + 1];
+    }
+
+    uint32_t readUint32(size_t pos) const
+    {
+        return readUint16(pos) << 16 | readUint16(pos + 2);
+    }
+
+    /**
+     * Reads a variable-length quantity at pos, moving pos past it.
+     * @return false if the chunk ends first
+     */
+    static bool readVarLength(const uint8_t* data, size_t end, size_t& pos, uint32_t& value)
+    {
+        value = 0;
+        for (int i = 0; i < 4 && pos < end; ++i)
+        {
+            uint8_t byte = data[pos++];
+            value = value << 7 | (byte & 0x7f);
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * Decodes one track chunk. Stops quietly at the end-of-track event or at a truncated event.
+     */
+    void readTrack(const Chunk& chunk, std::vector<SmfNote>& notes, std::vector<TempoChange>& tempos) const
+    {
+        static const int NO_NOTE = -1;
+        int pending[16][128];  // index in notes of the sounding note, per channel and number
+        std::fill(&pending[0][0], &pending[0][0] + 16 * 128, NO_NOTE);
+        notes.reserve((chunk.end - chunk.start) / 6);  // a note takes at least two 3-byte events
+        bool unmatched = false;
+
+        const uint8_t* data = bytes;
+        size_t pos = chunk.start, end = chunk.end;
+        uint32_t tick = 0, delta, length;
+        uint8_t runningStatus = 0;
+        while (pos < end && readVarLength(data, end, pos, delta))
+        {
+            tick += delta;
+            if (pos >= end)
+                break;
+            uint8_t status = data[pos];
+            if (status >= 0xf0)
+            {
+                ++pos;
+                if (status == 0xff)
+                {
+                    if (pos >= end)
+                        break;
+                    uint8_t type = data[pos++];
+                    if (!readVarLength(data, end, pos, length) || length > end - pos)
+                        break;
+                    if (type == 0x2f)
+                        break;
+                    if (type == 0x51 && length == 3)
+                        tempos.push_back({ tick, (uint32_t) data[pos] << 16 | (uint32_t) data[pos + 1] << 8 | data[pos + 2] });
+                }
+                else if (status == 0xf0 || status == 0xf7)
+                {
+                    if (!readVarLength(data, end, pos, length) || length > end - pos)
+                        break;
+                }
+                else
+                {
+                    length = 0;  // not valid in a file; skip the status byte alone
+                }
+                pos += length;
+                continue;
+            }
+            if (status & 0x80)
+            {
+                runningStatus = status;
+                ++pos;
+            }
+            else if (runningStatus == 0)
+            {
+                break;
+            }
+            uint8_t type = runningStatus & 0xf0, channel = runningStatus & 0x0f;
+            size_t dataBytes = type == 0xc0 || type == 0xd0 ? 1 : 2;
+            if (dataBytes > end - pos)
+                break;
+            uint8_t noteNumber = data[pos] & 0x7f, velocity = dataBytes > 1 ? data[pos + 1] & 0x7f : 0;
+            pos += dataBytes;
+
+            if (type != 0x90 && type != 0x80)
+                continue;
+            bool noteOn = type == 0x90 && velocity > 0;
+            int& sounding = pending[channel][noteNumber];
+            // MidiFile puts note-offs before note-ons at the same time, so a note-off never ends
+            // a note that only just started
+            if (sounding != NO_NOTE && (noteOn || notes[sounding].onTick != tick))
+            {
+                notes[sounding].offTick = tick;  // a note-off, or the same note starting over
+                sounding = NO_NOTE;
+            }
+            if (noteOn)
+            {
+                sounding = (int) notes.size();
+                notes.push_back({ tick, tick, noteNumber, velocity, channel });
+            }
+        }
+
+        for (auto& channelNotes : pending)
+            for (int sounding : channelNotes)
+                if (sounding != NO_NOTE)
+                {
+                    notes[sounding].offTick = UINT32_MAX;
+                    unmatched = true;
+                }
+        if (unmatched)
+            notes.erase(std::remove_if(notes.begin(), notes.end(),
+                                       [](const SmfNote& note) { return note.offTick == UINT32_MAX; }),
+                        notes.end());
+    }
+};
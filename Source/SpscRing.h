@@ -0,0 +1,113 @@
+/**
+ * @file SpscRing.h - bounded lock-free queue for one producer thread and one consumer thread
+ *
+ * For handing events from a thread that must never block or allocate (a MIDI input callback)
+ * to one that does the work (the message thread). The slots are allocated once up front; each
+ * side only ever writes its own index, with a release store that publishes the slots it has
+ * filled or emptied, and reads the other side's index with an acquire load. Each side also
+ * keeps a cached copy of the other's index and only reloads it when the ring looks full or
+ * empty, so the two threads don't trade the index cache lines on every call.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Fixed-capacity single-producer, single-consumer ring buffer.
+ * @tparam T  element type; copied in and out, so keep it small and trivially copyable
+ */
+template<typename T>
+class SpscRing {
+public:
+    /**
+     * Allocates the slots (the only allocation the ring makes).
+     * @param capacity  elements the ring holds, rounded up to a power of 2
+     */
+    explicit SpscRing(size_t capacity) : head(0), cachedTail(0), tail(0), cachedHead(0) {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+    /**
+     * Producer side: adds an element unless the ring is full. Wait-free.
+     * @return false (and nothing added) if the ring was full
+     */
+    bool tryPush(const T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cachedHead == slots.size()) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t - cachedHead == slots.size())
+                return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side: takes the oldest element, if any. Wait-free.
+     * @return false if the ring was empty
+     */
+    bool tryPop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h == cachedTail)
+                return false;
+        }
+        item = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side: hands every element pushed so far to fn, oldest first, and frees their
+     * slots with a single store.
+     * @return number of elements taken
+     */
+    template<typename Fn>
+    size_t popAll(Fn &&fn) {
+        size_t h = head.load(std::memory_order_relaxed);
+        cachedTail = tail.load(std::memory_order_acquire);
+        for (size_t i = h; i != cachedTail; i++)
+            fn(slots[i & mask]);
+        head.store(cachedTail, std::memory_order_release);
+        return cachedTail - h;
+    }
+
+    /**
+     * @return elements waiting; exact only when called from the producer or consumer thread
+     *         while the other is idle
+     */
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    static const size_t CACHE_LINE = 64;
+
+    // the consumer's index and its copy of the producer's, then the producer's pair, padded
+    // onto lines of their own (padding rather than alignas: C++14 new ignores over-alignment)
+    std::vector<T> slots;
+    size_t mask;
+    char padding0[CACHE_LINE];
+    std::atomic<size_t> head;
+    size_t cachedTail;
+    char padding1[CACHE_LINE];
+    std::atomic<size_t> tail;
+    size_t cachedHead;
+    char padding2[CACHE_LINE];
+};
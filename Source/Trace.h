@@ -0,0 +1,304 @@
+/**
+ * @file Trace.h - spans and counters on the hot paths, exported as a Chrome trace
+ *
+ * Built with MIDI_TRACE=1 (a preprocessor definition, e.g. in the Projucer exporter settings),
+ * the MIDI_TRACE_* macros record a span for every stage of the pipeline (file read, note
+ * extraction, heatmap build), every task a WorkStealingPool worker runs and every paint, plus
+ * counters of the notes, frames and heap allocations. Trace::writeChromeJson writes them in the
+ * Trace Event format read by chrome://tracing and ui.perfetto.dev, one row per thread.
+ *
+ * Recording stays off the locks: each thread appends to a buffer of its own, registered once
+ * the first time it records, and an event is two clock reads and a copy of two string literals'
+ * pointers. Built without MIDI_TRACE (the default) the macros expand to nothing, so the hot
+ * paths have no trace code at all.
+ */
+
+#pragma once
+
+#ifndef MIDI_TRACE
+#define MIDI_TRACE 0
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * One recorded event: a span ('X') or a counter value ('C'). Names and categories must be
+ * string literals (or otherwise outlive the trace).
+ */
+struct TraceEvent {
+    const char *name;
+    const char *category;
+    char phase;
+    int64_t begin;        // ns since the trace's epoch
+    int64_t duration;     // ns, spans only
+    int64_t value;        // counters: the value; spans: heap allocations made by the thread during it
+};
+
+/**
+ * The process-wide trace: a buffer of events per thread that has recorded any.
+ */
+class Trace {
+public:
+    /**
+     * Starts recording (events from before are kept).
+     */
+    static void start() {
+        enabled().store(true, std::memory_order_relaxed);
+    }
+
+    /**
+     * Stops recording; spans open now are still recorded when they end.
+     */
+    static void stop() {
+        enabled().store(false, std::memory_order_relaxed);
+    }
+
+    static bool isEnabled() {
+        return enabled().load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return ns since the trace's epoch (the first call)
+     */
+    static int64_t now() {
+        static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    /**
+     * Records an event on the calling thread's buffer.
+     */
+    static void record(const TraceEvent &event) {
+        thread().events.push_back(event);
+    }
+
+    /**
+     * Records a counter's value at this time.
+     */
+    static void counter(const char *name, int64_t value) {
+        if (isEnabled())
+            record({name, "counter", 'C', now(), 0, value});
+    }
+
+    /**
+     * Names the calling thread's row in the trace.
+     */
+    static void setThreadName(const std::string &name) {
+        ThreadBuffer &buffer = thread();
+        std::lock_guard<std::mutex> guard(registry().lock);
+        buffer.name = name;
+    }
+
+    /**
+     * Heap allocations counted by MIDI_TRACE_ALLOCATION_HOOKS, by all threads.
+     */
+    static std::atomic<int64_t> &allocations() {
+        static std::atomic<int64_t> count(0);
+        return count;
+    }
+
+    /**
+     * Heap allocations counted by MIDI_TRACE_ALLOCATION_HOOKS, by the calling thread.
+     */
+    static int64_t &threadAllocations() {
+        static thread_local int64_t count = 0;
+        return count;
+    }
+
+    /**
+     * Counts an allocation; called by the operator new that MIDI_TRACE_ALLOCATION_HOOKS defines.
+     */
+    static void countAllocation() {
+        ++threadAllocations();
+        allocations().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return events recorded so far, on all threads
+     */
+    static size_t size() {
+        std::lock_guard<std::mutex> guard(registry().lock);
+        size_t n = 0;
+        for (auto &buffer : registry().threads)
+            n += buffer->events.size();
+        return n;
+    }
+
+    /**
+     * Drops every event recorded (the thread names are kept). Call only while no thread records.
+     */
+    static void clear() {
+        std::lock_guard<std::mutex> guard(registry().lock);
+        for (auto &buffer : registry().threads)
+            buffer->events.clear();
+    }
+
+    /**
+     * Writes everything recorded as a Chrome trace (JSON object format, times in µs). Call only
+     * while no thread records, e.g. after stop() once the traced work has returned.
+     */
+    static void writeChromeJson(std::ostream &out) {
+        std::lock_guard<std::mutex> guard(registry().lock);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        const char *separator = "\n";
+        for (auto &buffer : registry().threads) {
+            if (!buffer->name.empty()) {
+                out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+                    << ",\"args\":{\"name\":\"";
+                writeEscaped(out, buffer->name.c_str());
+                out << "\"}}";
+                separator = ",\n";
+            }
+            for (const TraceEvent &event : buffer->events) {
+                out << separator << "{\"name\":\"";
+                writeEscaped(out, event.name);
+                out << "\",\"cat\":\"" << event.category << "\",\"ph\":\"" << event.phase
+                    << "\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":" << event.begin / 1000 << '.'
+                    << digits(event.begin % 1000);
+                if (event.phase == 'X')
+                    out << ",\"dur\":" << event.duration / 1000 << '.' << digits(event.duration % 1000)
+                        << ",\"args\":{\"allocations\":" << event.value << "}}";
+                else
+                    out << ",\"args\":{\"value\":" << event.value << "}}";
+                separator = ",\n";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+private:
+    struct ThreadBuffer {
+        int tid;
+        std::string name;
+        std::vector<TraceEvent> events;
+    };
+
+    struct Registry {
+        std::mutex lock;
+        std::vector<std::unique_ptr<ThreadBuffer>> threads;  // never shrinks, so buffers outlive their threads
+    };
+
+    static std::atomic<bool> &enabled() {
+        static std::atomic<bool> flag(false);
+        return flag;
+    }
+
+    static Registry &registry() {
+        static Registry *r = new Registry();  // never destroyed: threads may record during exit
+        return *r;
+    }
+
+    static ThreadBuffer &thread() {
+        static thread_local ThreadBuffer *buffer = nullptr;
+        if (buffer == nullptr) {
+            std::unique_ptr<ThreadBuffer> created(new ThreadBuffer());
+            created->events.reserve(1 << 14);
+            std::lock_guard<std::mutex> guard(registry().lock);
+            created->tid = (int) registry().threads.size() + 1;
+            buffer = created.get();
+            registry().threads.push_back(std::move(created));
+        }
+        return *buffer;
+    }
+
+    static std::string digits(int64_t fraction) {
+        std::string s = std::to_string(fraction);
+        return std::string(3 - s.size(), '0') + s;
+    }
+
+    static void writeEscaped(std::ostream &out, const char *s) {
+        for (; *s != 0; s++) {
+            if (*s == '"' || *s == '\\')
+                out << '\\';
+            if ((unsigned char) *s >= 0x20)
+                out << *s;
+        }
+    }
+};
+
+/**
+ * Records a span from construction to destruction on the calling thread, if the trace was on
+ * when it began.
+ */
+class TraceSpan {
+public:
+    TraceSpan(const char *name, const char *category)
+            : name(name), category(category), begin(Trace::isEnabled() ? Trace::now() : -1),
+              allocations(Trace::threadAllocations()) {
+    }
+
+    ~TraceSpan() {
+        if (begin >= 0)
+            Trace::record({name, category, 'X', begin, Trace::now() - begin, Trace::threadAllocations() - allocations});
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    const char *category;
+    int64_t begin;
+    int64_t allocations;
+};
+
+#define MIDI_TRACE_JOIN2(a, b) a##b
+#define MIDI_TRACE_JOIN(a, b) MIDI_TRACE_JOIN2(a, b)
+
+#if MIDI_TRACE
+
+/** Records a span over the rest of the enclosing scope. */
+#define MIDI_TRACE_SPAN(name, category) TraceSpan MIDI_TRACE_JOIN(traceSpan, __LINE__)(name, category)
+/** Records a counter's value. */
+#define MIDI_TRACE_COUNTER(name, value) Trace::counter(name, (int64_t) (value))
+/** Records the heap allocations counted so far, as the "allocations" counter. */
+#define MIDI_TRACE_ALLOCATIONS() Trace::counter("allocations", Trace::allocations().load(std::memory_order_relaxed))
+/** Names the calling thread's row. */
+#define MIDI_TRACE_THREAD(name) Trace::setThreadName(name)
+
+/**
+ * Expand once, at namespace scope in the file with main(), to count heap allocations: defines
+ * the replaceable global operator new and delete on top of malloc and free.
+ */
+#define MIDI_TRACE_ALLOCATION_HOOKS() \
+    void *operator new(std::size_t size) { \
+        Trace::countAllocation(); \
+        if (void *p = std::malloc(size > 0 ? size : 1)) \
+            return p; \
+        throw std::bad_alloc(); \
+    } \
+    void *operator new[](std::size_t size) { \
+        return operator new(size); \
+    } \
+    void *operator new(std::size_t size, const std::nothrow_t &) noexcept { \
+        Trace::countAllocation(); \
+        return std::malloc(size > 0 ? size : 1); \
+    } \
+    void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept { \
+        return operator new(size, tag); \
+    } \
+    void operator delete(void *p) noexcept { std::free(p); } \
+    void operator delete[](void *p) noexcept { std::free(p); } \
+    void operator delete(void *p, std::size_t) noexcept { std::free(p); } \
+    void operator delete[](void *p, std::size_t) noexcept { std::free(p); } \
+    void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); } \
+    void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+
+#else
+
+#define MIDI_TRACE_SPAN(name, category)
+#define MIDI_TRACE_COUNTER(name, value)
+#define MIDI_TRACE_ALLOCATIONS()
+#define MIDI_TRACE_THREAD(name)
+#define MIDI_TRACE_ALLOCATION_HOOKS()
+
+#endif
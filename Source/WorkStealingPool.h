@@ -0,0 +1,349 @@
+/**
+ * @file WorkStealingPool.h - long-lived fork/join executor shared by the GeneralScan family
+ *
+ * Replaces the std::async-per-tree-node forking in the scan classes: the worker threads are
+ * created once and reused by every reduce/scan call. Each worker owns a deque of tasks; it
+ * pushes and pops its own tasks LIFO and steals from the other end of its peers' deques when
+ * it runs dry, so uneven subtrees (e.g., when the thread count is not a power of 2) balance out.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "Trace.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOGDI
+#define NOGDI
+#endif
+#include <windows.h>
+#endif
+
+/**
+ * Fixed-size pool of worker threads with per-worker work-stealing deques.
+ *
+ * Work is expressed as nested fork/join pairs via invoke(left, right). A worker that waits for
+ * a forked task keeps executing other queued tasks in the meantime, so arbitrarily deep
+ * recursion never blocks a thread. Threads that are not workers of this pool (e.g., the
+ * message thread) hand the whole job to the pool and block until it is done, so exactly
+ * size() threads do the work.
+ */
+class WorkStealingPool {
+public:
+    /**
+     * Start the worker threads.
+     * @param n_workers  number of worker threads, defaults to the hardware concurrency
+     * @param cores      CPU numbers to pin the workers to; worker w is pinned to
+     *                   cores[w % cores.size()]. Empty leaves placement to the OS.
+     *                   (Pinning is a no-op on platforms without thread affinity, e.g. macOS.)
+     */
+    explicit WorkStealingPool(int n_workers = defaultWorkers(), const std::vector<int> &cores = std::vector<int>())
+            : queues(n_workers < 1 ? 2 : n_workers + 1), pending(0), sleepers(0), stopping(false) {
+        if (n_workers < 1)
+            n_workers = 1;
+        for (int w = 0; w < n_workers; w++)
+            workers.emplace_back(&WorkStealingPool::work, this, w, cores.empty() ? -1 : cores[w % cores.size()]);
+    }
+
+    /**
+     * Stops and joins the workers. Must not be called while work is still outstanding.
+     */
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> guard(idleLock);
+            stopping = true;
+        }
+        idle.notify_all();
+        for (std::thread &worker: workers)
+            worker.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    /**
+     * Process-wide pool used by the scan classes when none is given to them.
+     */
+    static WorkStealingPool &shared() {
+        static WorkStealingPool pool;
+        return pool;
+    }
+
+    /**
+     * @return the hardware concurrency, or 1 if it cannot be determined
+     */
+    static int defaultWorkers() {
+        int n = (int) std::thread::hardware_concurrency();
+        return n < 1 ? 1 : n;
+    }
+
+    /**
+     * Number of leaf tasks a scan should split its tree into for the given thread count.
+     * Powers of 2 map one task per thread. Other counts would leave the heap-ordered tree with
+     * leaf tasks of two different sizes, so they are rounded up to a power of 2 and over-split
+     * by 4 to give the stealing workers enough equal-sized pieces to balance.
+     * @param n_threads  requested parallelism
+     * @return           a power of 2
+     */
+    static int tasksFor(int n_threads) {
+        int tasks = 1;
+        while (tasks < n_threads)
+            tasks *= 2;
+        if (tasks != n_threads && n_threads > 1)
+            tasks *= 4;
+        return tasks;
+    }
+
+    /**
+     * @return number of worker threads
+     */
+    int size() const {
+        return (int) workers.size();
+    }
+
+    /**
+     * @return true if the calling thread is one of this pool's workers
+     */
+    bool isWorker() const {
+        return self().pool == this;
+    }
+
+    /**
+     * Run fn on the pool and wait for it to complete (including everything it forks).
+     * Called from a worker, fn just runs inline.
+     * @param fn  callable taking no arguments; exceptions it throws are rethrown here
+     */
+    template<typename Fn>
+    void run(Fn &&fn) {
+        if (isWorker()) {
+            fn();
+            return;
+        }
+        Latch latch;
+        Task task(&call<Fn>, address(fn), &latch);
+        push(size(), &task);  // the injection queue, only ever stolen from
+        {
+            std::unique_lock<std::mutex> guard(latch.lock);
+            latch.finished.wait(guard, [&latch] { return latch.done; });
+        }
+        if (task.error)
+            std::rethrow_exception(task.error);
+    }
+
+    /**
+     * Fork/join: run left and right in parallel and return when both are done.
+     * The left side is made available for stealing while this thread runs the right side.
+     * @param left   callable taking no arguments
+     * @param right  callable taking no arguments
+     */
+    template<typename Left, typename Right>
+    void invoke(Left &&left, Right &&right) {
+        if (!isWorker()) {
+            run([&] { invoke(left, right); });
+            return;
+        }
+        Task task(&call<Left>, address(left), nullptr);
+        push(self().index, &task);
+        std::exception_ptr error;
+        try {
+            right();
+        } catch (...) {
+            error = std::current_exception();  // left still has to finish before we unwind
+        }
+        while (!task.done.load(std::memory_order_acquire)) {
+            Task *other = take(self().index);
+            if (other != nullptr)
+                execute(other);
+            else
+                std::this_thread::yield();
+        }
+        if (!error)
+            error = task.error;
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    /**
+     * Run fn(i) for every i in [first, last), split recursively into at most `tasks` pieces.
+     * @param first  first index
+     * @param last   one past the last index
+     * @param tasks  number of pieces to split the range into (defaults to 4 per worker)
+     * @param fn     callable taking an int
+     */
+    template<typename Fn>
+    void parallelFor(int first, int last, Fn &&fn, int tasks = 0) {
+        if (tasks < 1)
+            tasks = 4 * size();
+        if (last - first <= 1 || tasks <= 1) {
+            for (int i = first; i < last; i++)
+                fn(i);
+            return;
+        }
+        int mid = first + (last - first) / 2;
+        invoke([&] { parallelFor(first, mid, fn, tasks / 2); },
+               [&] { parallelFor(mid, last, fn, tasks - tasks / 2); });
+    }
+
+private:
+    struct Latch {
+        std::mutex lock;
+        std::condition_variable finished;
+        bool done = false;
+    };
+
+    /**
+     * A forked piece of work. Tasks live on the stack of the thread that forked them, which
+     * doesn't return until the task is done, so queuing them never allocates.
+     */
+    struct Task {
+        Task(void (*fn)(void *), void *arg, Latch *latch) : fn(fn), arg(arg), latch(latch), done(false) {}
+
+        void (*fn)(void *);
+        void *arg;
+        Latch *latch;  // set for tasks injected by non-worker threads
+        std::atomic<bool> done;
+        std::exception_ptr error;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task *> tasks;
+    };
+
+    struct WorkerId {
+        const WorkStealingPool *pool = nullptr;
+        int index = -1;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<Queue> queues;  // one per worker plus the injection queue at the end
+    std::atomic<int> pending;   // tasks sitting in the queues
+    std::atomic<int> sleepers;
+    std::mutex idleLock;
+    std::condition_variable idle;
+    bool stopping;
+
+    static WorkerId &self() {
+        static thread_local WorkerId id;
+        return id;
+    }
+
+    template<typename Fn>
+    static void *address(Fn &fn) {
+        return const_cast<void *>(static_cast<const void *>(&fn));
+    }
+
+    template<typename Fn>
+    static void call(void *fn) {
+        (*static_cast<typename std::remove_reference<Fn>::type *>(fn))();
+    }
+
+    void push(int q, Task *task) {
+        {
+            std::lock_guard<std::mutex> guard(queues[q].lock);
+            queues[q].tasks.push_back(task);
+        }
+        pending.fetch_add(1);  // seq_cst pairs with the sleepers/pending checks in work()
+        if (sleepers.load() > 0) {
+            { std::lock_guard<std::mutex> guard(idleLock); }
+            idle.notify_one();
+        }
+    }
+
+    /**
+     * Pop our own newest task, or else steal the oldest one from somebody else.
+     */
+    Task *take(int q) {
+        if (pending.load(std::memory_order_acquire) == 0)
+            return nullptr;
+        int n = (int) queues.size();
+        if (q < size()) {
+            std::lock_guard<std::mutex> guard(queues[q].lock);
+            if (!queues[q].tasks.empty()) {
+                Task *task = queues[q].tasks.back();
+                queues[q].tasks.pop_back();
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+        for (int i = 1; i <= n; i++) {
+            Queue &victim = queues[(q + i) % n];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                Task *task = victim.tasks.front();
+                victim.tasks.pop_front();
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    static void execute(Task *task) {
+        Latch *latch = task->latch;
+        try {
+            MIDI_TRACE_SPAN("task", "pool");
+            task->fn(task->arg);
+        } catch (...) {
+            task->error = std::current_exception();
+        }
+        // the task may be destroyed by its owner as soon as it is marked done
+        if (latch != nullptr) {
+            std::lock_guard<std::mutex> guard(latch->lock);
+            latch->done = true;
+            latch->finished.notify_one();
+        } else {
+            task->done.store(true, std::memory_order_release);
+        }
+    }
+
+    void work(int index, int core) {
+        self().pool = this;
+        self().index = index;
+        MIDI_TRACE_THREAD("pool worker " + std::to_string(index));
+        if (core >= 0)
+            pin(core);
+        for (;;) {
+            Task *task = take(index);
+            if (task != nullptr) {
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(idleLock);
+            sleepers.fetch_add(1);
+            idle.wait(guard, [this] { return stopping || pending.load() > 0; });
+            sleepers.fetch_sub(1);
+            if (stopping)
+                return;
+        }
+    }
+
+    static void pin(int core) {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << core);
+#else
+        (void) core;
+#endif
+    }
+};
@@ -9,7 +9,26 @@
 #include <iostream>
 #include <chrono>
 #include <random>
+#include <deque>
+#include <numeric>
+#include <sstream>
+#include <map>
 #include "GeneralScan.h"
+#include "GeneralScanSchwartz.h"
+#include "GeneralScanPolicy.h"
+#include "GeneralScanLookback.h"
+#include "GeneralScanSegmented.h"
+#include "GeneralScanStream.h"
+#include "ScanTallies.h"
+#include "NoteStore.h"
+#include "HeatmapScan.h"
+#include "HeatmapKeyframes.h"
+#include "HeatmapDecay.h"
+#include "SmfReader.h"
+#include "SpscRing.h"
+#include "Trace.h"
+#include "Arena.h"
+#include "MidiUtils.h"
 
 /**
  * A max reduce/scan class using GeneralScan
@@ -17,92 +36,19 @@
  * @tparam NumType  the type of object being maximized. Must support > operator.
  */
 template<typename NumType>
-class MaxScan : public GeneralScan<NumType> {
+class MaxScan : public MaxTally<GeneralScan<NumType>> {
 public:
-    MaxScan(const typename GeneralScan<NumType>::RawData *data) : GeneralScan<NumType>(data, 1) {
-    }
-
-protected:
-    virtual NumType init() const {
-        return std::numeric_limits<NumType>::min();
-    }
-
-    virtual NumType prepare(const NumType &datum) const {
-        return datum;
-    }
-
-    virtual NumType combine(const NumType &left, const NumType &right) const {
-        if (left > right)
-            return left;
-        else
-            return right;
-    }
-
-    virtual NumType gen(const NumType &tally) const {
-        return tally;
+    MaxScan(const typename GeneralScan<NumType>::RawData *data) : MaxTally<GeneralScan<NumType>>(data, 1) {
     }
 };
 
-/**
- * TallyType for LowTen
- */
-struct Ten {
-    int ten[10];
-};
-
-std::ostream &operator<<(std::ostream &out, const Ten &ten) {
-    out << "[";
-    for (int i = 0; i < 9; i++)
-        out << ten.ten[i] << ", ";
-    out << ten.ten[9] << "]";
-    return out;
-}
-
 /**
  * Result is ten lowest numbers seen so far.
  */
-class LowTen : public GeneralScan<int, Ten> {
+class LowTen : public LowTenTally<GeneralScan<int, Ten>> {
 public:
-    LowTen(const std::vector<int> *data) : GeneralScan<int, Ten>(data) {
-    }
-
-protected:
-    virtual Ten init() const {
-        Ten t;
-        for (int i = 0; i < 10; i++)
-            t.ten[i] = std::numeric_limits<int>::max();
-        return t;
-    }
-
-    virtual Ten prepare(const int &datum) const {
-        Ten t;
-        for (int i = 1; i < 10; i++)
-            t.ten[i] = std::numeric_limits<int>::max();
-        t.ten[0] = datum;
-        return t;
+    LowTen(const std::vector<int> *data) : LowTenTally<GeneralScan<int, Ten>>(data) {
     }
-
-    /**
-     * A little mini-merge of the two sides.
-     * @param left  lowest ten of some set
-     * @param right lowest ten of another set
-     * @return      lowest ten of combined set
-     */
-    virtual Ten combine(const Ten &left, const Ten &right) const {
-        Ten t;
-        int r = 0, l = 0;
-        for (int i = 0; i < 10; i++)
-            if (left.ten[l] < right.ten[r])
-                t.ten[i] = left.ten[l++];
-            else
-                t.ten[i] = right.ten[r++];
-        return t;
-    }
-
-    virtual Ten gen(const Ten &tally) const {
-        return tally;
-    }
-
 };
 
 /**
@@ -154,113 +100,141 @@ protected:
 };
 
 /**
- * @class Histo for the HistoScan reductions -- buckets data into 10 interior ranges
- *              plus two outlier ranges
+ * Collects a histogram from data.
  */
-struct Histo {
-    static const int N = 10;
-    int bucket[N + 2];
-    int hi, lo;
-
-    Histo() : hi(100), lo(0) {
-        for (int i = 0; i < N + 2; i++)
-            bucket[i] = 0;
+class HistoScan : public HistoTally<GeneralScan<int, Histo>> {
+public:
+    HistoScan(const std::vector<int> *data) : HistoTally<GeneralScan<int, Histo>>(data) {
     }
 };
 
-std::ostream &operator<<(std::ostream &out, const Histo &histo) {
-    out << "|";
-    for (int count: histo.bucket)
-        out << count << "|";
-    return out;
-}
-
 /**
- * Collects a histogram from data.
+ * @class ExamHeap  implements the reduce/scan from Exam 1 using GeneralScan class
  */
-class HistoScan : public GeneralScan<int, Histo> {
+class ExamHeap : public ExamTally<GeneralScan<double>> {
 public:
-    HistoScan(const std::vector<int> *data) : GeneralScan<int, Histo>(data) {
+    ExamHeap(const std::vector<double> *data) : ExamTally<GeneralScan<double>>(data) {
     }
+};
 
-protected:
-    virtual Histo init() const {
-        Histo h;
-        return h;
+/**
+ * @class SumHeap  classic sum reduction
+ */
+class SumHeap : public SumTally<GeneralScan<int>> {
+public:
+    SumHeap(const std::vector<int> *data, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr)
+            : SumTally<GeneralScan<int>>(data, n_threads, pool) {
     }
 
-    virtual Histo prepare(const int &datum) const {
-        Histo h;
-        int bucket_size = (h.hi - h.lo) / h.N;
-        if (datum < h.lo)
-            h.bucket[0]++;
-        else if (datum >= h.hi)
-            h.bucket[h.N + 1]++;
-        else
-            h.bucket[1 + (datum - h.lo) / bucket_size]++;
-        return h;
+    SumHeap(RawSpan data, int n_threads = N_THREADS, WorkStealingPool *pool = nullptr)
+            : SumTally<GeneralScan<int>>(data, n_threads, pool) {
     }
+};
 
-    virtual Histo combine(const Histo &left, const Histo &right) const {
-        Histo h;
-        for (int i = 0; i < h.N + 2; i++)
-            h.bucket[i] = left.bucket[i] + right.bucket[i];
-        return h;
+/**
+ * @class SumSchwartz  classic sum reduction using the tight-loop GeneralScanSchwartz
+ */
+class SumSchwartz : public SumTally<GeneralScanSchwartz<int>> {
+public:
+    SumSchwartz(const std::vector<int> *data) : SumTally<GeneralScanSchwartz<int>>(data) {
     }
 
-    virtual Histo gen(const Histo &tally) const {
-        return tally;
+    SumSchwartz(RawSpan data) : SumTally<GeneralScanSchwartz<int>>(data) {
     }
 };
 
 /**
- * @class ExamHeap  implements the reduce/scan from Exam 1 using GeneralScan class
+ * @class SumLookback  classic sum reduction using the single-pass GeneralScanLookback
  */
-class ExamHeap : public GeneralScan<double> {
+class SumLookback : public SumTally<GeneralScanLookback<int>> {
 public:
-    ExamHeap(const std::vector<double> *data) : GeneralScan<double>(data) {
+    SumLookback(const std::vector<int> *data, int n_threads = N_THREADS, int chunk = CHUNK)
+            : SumTally<GeneralScanLookback<int>>(data, n_threads, nullptr, chunk) {
     }
 
-protected:
-    virtual double init() const {
-        return 1.0;
+    SumLookback(RawSpan data, int n_threads = N_THREADS, int chunk = CHUNK)
+            : SumTally<GeneralScanLookback<int>>(data, n_threads, nullptr, chunk) {
     }
+};
 
-    virtual double prepare(const double &probability_of_miss) const {
-        return 1.0 - probability_of_miss;
+
+/**
+ * @class SumPolicy  classic sum reduction as a GeneralScanPolicy policy
+ */
+struct SumPolicy {
+    typedef int ElemType;
+    typedef int TallyType;
+    typedef int ResultType;
+    typedef std::plus<int> Operator;  // lets the leaf loops use the SIMD kernels
+
+    int init() const {
+        return 0;
     }
 
-    virtual double combine(const double &left, const double &right) const {
-        return left * right;
+    int prepare(const int &datum) const {
+        return datum;
     }
 
-    virtual double gen(const double &tally) const {
+    int combine(const int &left, const int &right) const {
+        return left + right;
+    }
+
+    int gen(const int &tally) const {
         return tally;
     }
 };
 
 /**
- * @class SumHeap  classic sum reduction
+ * @class MaxPolicy  max reduction as a GeneralScanPolicy policy
+ *
+ * @tparam NumType  the type of object being maximized. Must support > operator.
  */
-class SumHeap : public GeneralScan<int> {
-public:
-    SumHeap(const std::vector<int> *data) : GeneralScan<int>(data) {
-    }
+template<typename NumType>
+struct MaxPolicy {
+    typedef NumType ElemType;
+    typedef NumType TallyType;
+    typedef NumType ResultType;
+    typedef ScanKernels::Maximum<NumType> Operator;
 
-protected:
-    virtual int init() const {
-        return 0;
+    NumType init() const {
+        return std::numeric_limits<NumType>::min();
     }
 
-    virtual int prepare(const int &datum) const {
+    NumType prepare(const NumType &datum) const {
         return datum;
     }
 
-    virtual int combine(const int &left, const int &right) const {
-        return left + right;
+    NumType combine(const NumType &left, const NumType &right) const {
+        return left > right ? left : right;
     }
 
-    virtual int gen(const int &tally) const {
+    NumType gen(const NumType &tally) const {
+        return tally;
+    }
+};
+
+/**
+ * @class ExamPolicy  the ExamHeap reduce/scan as a GeneralScanPolicy policy
+ */
+struct ExamPolicy {
+    typedef double ElemType;
+    typedef double TallyType;
+    typedef double ResultType;
+    typedef std::multiplies<double> Operator;
+
+    double init() const {
+        return 1.0;
+    }
+
+    double prepare(const double &probability_of_miss) const {
+        return 1.0 - probability_of_miss;
+    }
+
+    double combine(const double &left, const double &right) const {
+        return left * right;
+    }
+
+    double gen(const double &tally) const {
         return tally;
     }
 };
@@ -271,7 +245,7 @@ protected:
  */
 bool test_exam1() {
     using namespace std;
-    const int N = 1 << 3;  // FIXME must be power of 2 for now
+    const int N = 1 << 3;
     vector<double> data(N, 1e-3);  // put a small value in each element of the data array
     vector<double> prefix(N, 1.0);
 
@@ -301,7 +275,7 @@ bool test_exam1() {
 
 bool test_hw2() {
     using namespace std;
-    const int N = 1 << 27;  // FIXME must be power of 2 for now
+    const int N = 1 << 27;
     vector<int> data(N, 1);  // put a 1 in each element of the data array
     vector<int> prefix(N, 1);
     data[0] = 100;
@@ -329,7 +303,7 @@ bool test_hw2() {
 
 bool test_max_scan() {
     using namespace std;
-    const int N = 1 << 27;  // FIXME must be power of 2 for now
+    const int N = 1 << 27;
     vector<int> data(N, 1);  // put a 1 in each element of the data array
     vector<int> prefix(N, 1);
     data[3000] = 12345;
@@ -364,7 +338,7 @@ bool test_max_scan() {
 
 bool test_low_ten() {
     using namespace std;
-    const int N = 1 << 10;  // FIXME must be power of 2 for now
+    const int N = 1 << 10;
     vector<int> data(N);
     for (int i = 0; i < N; i++)
         data[i] = rand() % 100;
@@ -391,7 +365,7 @@ bool test_low_ten() {
 
 bool test_avg_low_ten() {
     using namespace std;
-    const int N = 1 << 10;  // FIXME must be power of 2 for now
+    const int N = 1 << 10;
     vector<int> data(N);
     for (int i = 0; i < N; i++)
         data[i] = rand() % 100;
@@ -418,7 +392,7 @@ bool test_avg_low_ten() {
 
 bool test_histo() {
     using namespace std;
-    const int N = 1 << 10;  // FIXME must be power of 2 for now
+    const int N = 1 << 10;
     vector<int> data(N);
     for (int i = 0; i < N; i++)
         data[i] = rand() % 100;
@@ -443,6 +417,1143 @@ bool test_histo() {
     return true;
 }
 
+/**
+ * Sum scan over data sizes that are not powers of 2.
+ * @return  if the test was successful
+ */
+bool test_odd_sizes() {
+    using namespace std;
+    for (int N : {1, 3, 5, 1000, 70001}) {
+        vector<int> data(N);
+        for (int i = 0; i < N; i++)
+            data[i] = rand() % 100;
+        vector<int> prefix(N);
+
+        SumHeap heap(&data);
+        heap.getScan(&prefix);
+
+        int check = 0;
+        for (int i = 0; i < N; i++) {
+            check += data[i];
+            if (prefix[i] != check) {
+                cout << "FAILED RESULT for N = " << N << " at " << i << endl;
+                return false;
+            }
+        }
+        if (heap.getReduction() != check) {
+            cout << "FAILED REDUCTION for N = " << N << endl;
+            return false;
+        }
+    }
+    cout << "odd sizes: ok" << endl;
+    return true;
+}
+
+/**
+ * Report the speedup of SumHeap over every thread count from 1 to the number of cores,
+ * including the ones that are not powers of 2.
+ * @return  if all the scans were correct
+ */
+bool test_pool_scaling() {
+    using namespace std;
+    const int N = 1 << 24;
+    vector<int> data(N, 1);
+    vector<int> prefix(N);
+    double baseline = 0.0;
+
+    cout << "threads,ms,speedup,efficiency" << endl;
+    for (int threads = 1; threads <= WorkStealingPool::defaultWorkers(); threads++) {
+        WorkStealingPool pool(threads);
+
+        // start timer
+        auto start = chrono::steady_clock::now();
+
+        SumHeap heap(&data, threads, &pool);
+        int total = heap.getReduction();
+        heap.getScan(&prefix);
+
+        // stop timer
+        auto end = chrono::steady_clock::now();
+        auto elpased = chrono::duration<double, milli>(end - start).count();
+
+        if (total != N || prefix[N - 1] != N || prefix[N / 3] != N / 3 + 1) {
+            cout << "FAILED RESULT with " << threads << " threads" << endl;
+            return false;
+        }
+        if (threads == 1)
+            baseline = elpased;
+        cout << threads << "," << elpased << "," << baseline / elpased << ","
+             << baseline / elpased / threads << endl;
+    }
+    return true;
+}
+
+/**
+ * Time a reduce plus scan on any of the scan classes.
+ * @return  elapsed milliseconds
+ */
+template<typename Scanner>
+double time_scan(Scanner &scanner, std::vector<typename Scanner::ScanData::value_type> *prefix) {
+    auto start = std::chrono::steady_clock::now();
+    scanner.getReduction();
+    scanner.getScan(prefix);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * Side-by-side timings of the virtual-dispatch scans against GeneralScanPolicy on the
+ * test_hw2 (sum) and test_max_scan (max) workloads.
+ * @return  if the policy results match the virtual ones
+ */
+bool test_static_dispatch() {
+    using namespace std;
+    const int N = 1 << 27;
+    vector<int> data(N, 1);
+    vector<int> expected(N), prefix(N);
+
+    data[0] = 100;
+    SumHeap sum_virtual(&data);
+    SumSchwartz sum_schwartz(&data);
+    GeneralScanPolicy<SumPolicy> sum_policy(&data);
+    cout << "hw2 GeneralScan: " << time_scan(sum_virtual, &expected) << "ms" << endl;
+    cout << "hw2 GeneralScanSchwartz: " << time_scan(sum_schwartz, &prefix) << "ms" << endl;
+    cout << "hw2 GeneralScanPolicy: " << time_scan(sum_policy, &prefix) << "ms" << endl;
+    if (prefix != expected) {
+        cout << "FAILED hw2 policy result" << endl;
+        return false;
+    }
+
+    data[0] = 1;
+    data[3000] = 12345;
+    data[9000] = 67890;
+    MaxScan<int> max_virtual(&data);
+    GeneralScanPolicy<MaxPolicy<int>> max_policy(&data, 1);
+    cout << "max scan GeneralScan: " << time_scan(max_virtual, &expected) << "ms" << endl;
+    cout << "max scan GeneralScanPolicy: " << time_scan(max_policy, &prefix) << "ms" << endl;
+    if (prefix != expected) {
+        cout << "FAILED max scan policy result" << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Check the SIMD leaf kernels against the scalar leaf loops (the policies without an Operator
+ * typedef) on sizes that exercise the vector tails, then time them on the 2^27 workloads.
+ * @return  if the results matched
+ */
+bool test_simd_kernels() {
+    using namespace std;
+    struct ScalarSum : SumPolicy {
+        typedef void Operator;  // hides SumPolicy's, so this one takes the scalar leaf loops
+    };
+    static_assert(ScanKernels::Vectorizable<SumPolicy>::value, "SumPolicy should vectorize");
+    static_assert(!ScanKernels::Vectorizable<ScalarSum>::value, "ScalarSum shouldn't vectorize");
+
+    for (int N : {2, 7, 31, 1000, 4099, 100003}) {
+        vector<int> data(N);
+        vector<double> misses(N);
+        for (int i = 0; i < N; i++) {
+            data[i] = rand() % 1000 - 500;
+            misses[i] = (rand() % 100) * 1e-5;
+        }
+        vector<int> expected(N), prefix(N);
+        GeneralScanPolicy<ScalarSum> scalar(&data, 1);
+        GeneralScanPolicy<SumPolicy> sum(&data, 1);
+        scalar.getScan(&expected);
+        sum.getScan(&prefix);
+        if (prefix != expected || sum.getReduction() != scalar.getReduction()) {
+            cout << "FAILED sum kernel for N = " << N << endl;
+            return false;
+        }
+        GeneralScanPolicy<MaxPolicy<int>> max_scan(&data, 1);
+        max_scan.getScan(&prefix);
+        int check = numeric_limits<int>::min();
+        for (int i = 0; i < N; i++) {
+            check = max(check, data[i]);
+            if (prefix[i] != check) {
+                cout << "FAILED max kernel for N = " << N << " at " << i << endl;
+                return false;
+            }
+        }
+        vector<double> product(N);
+        GeneralScanPolicy<ExamPolicy> exam(&misses, 1);
+        exam.getScan(&product);
+        double tally = 1.0;
+        for (int i = 0; i < N; i++) {
+            tally *= 1.0 - misses[i];
+            if (abs(product[i] - tally) > 1e-8) {
+                cout << "FAILED product kernel for N = " << N << " at " << i << endl;
+                return false;
+            }
+        }
+    }
+
+    const int N = 1 << 27;
+    vector<int> data(N, 1);
+    vector<int> prefix(N);
+    data[0] = 100;
+    GeneralScanPolicy<ScalarSum> scalar(&data);
+    GeneralScanPolicy<SumPolicy> simd(&data);
+    double scalar_ms = time_scan(scalar, &prefix);
+    double simd_ms = time_scan(simd, &prefix);
+    double bytes = 3.0 * N * sizeof(int);  // read for reduce, read and write for scan
+    cout << "hw2 scalar leaves: " << scalar_ms << "ms, " << bytes / scalar_ms / 1e6 << " GB/s" << endl;
+    cout << "hw2 simd leaves" << (ScanKernels::hasAvx2() ? " (avx2): " : " (sse2): ") << simd_ms << "ms, "
+         << bytes / simd_ms / 1e6 << " GB/s" << endl;
+    return prefix[N - 1] == N + 99;
+}
+
+/**
+ * Check GeneralScanLookback against SumHeap, then time it against the two-pass
+ * GeneralScanSchwartz on the test_hw2 workload.
+ * @return  if the results matched
+ */
+bool test_lookback() {
+    using namespace std;
+    for (int N : {1, 5, 1000, 70001}) {
+        vector<int> data(N);
+        for (int i = 0; i < N; i++)
+            data[i] = rand() % 100;
+        vector<int> expected(N), prefix(N);
+        SumHeap heap(&data);
+        heap.getScan(&expected);
+        for (int chunk : {1, 7, 1024}) {
+            SumLookback lookback(&data, 4, chunk);
+            lookback.getScan(&prefix);
+            if (prefix != expected || lookback.getReduction() != heap.getReduction()) {
+                cout << "FAILED lookback for N = " << N << ", chunk = " << chunk << endl;
+                return false;
+            }
+        }
+    }
+
+    const int N = 1 << 27;
+    vector<int> data(N, 1);
+    vector<int> expected(N), prefix(N);
+    data[0] = 100;
+    SumSchwartz two_pass(&data);
+    SumLookback one_pass(&data);
+    cout << "hw2 GeneralScanSchwartz: " << time_scan(two_pass, &expected) << "ms" << endl;
+    auto start = chrono::steady_clock::now();
+    one_pass.getScan(&prefix);
+    auto end = chrono::steady_clock::now();
+    cout << "hw2 GeneralScanLookback: " << chrono::duration<double, milli>(end - start).count() << "ms" << endl;
+    return prefix == expected && one_pass.getReduction() == N + 99;
+}
+
+bool test_spans() {
+    using namespace std;
+    const int N = 100003;
+    int *raw = new int[N];
+    for (int i = 0; i < N; i++)
+        raw[i] = rand() % 100 - 50;
+    vector<int> inclusive(N), exclusive(N);
+    partial_sum(raw, raw + N, inclusive.begin());
+    exclusive[0] = 0;
+    copy(inclusive.begin(), inclusive.end() - 1, exclusive.begin() + 1);
+
+    // scanning a plain array into a span, an iterator and a pointer
+    bool ok = true;
+    vector<int> out(N);
+    deque<int> other(N);
+    SumHeap heap(ScanSpan<const int>(raw, N));
+    heap.getScan(ScanSpan<int>(out));
+    ok = ok && out == inclusive;
+    heap.getExclusiveScan(out.begin());
+    ok = ok && out == exclusive;
+    GeneralScanPolicy<SumPolicy> policy(ScanSpan<const int>(raw, N), 4);
+    policy.getExclusiveScan(other.begin());
+    ok = ok && equal(other.begin(), other.end(), exclusive.begin());
+    SumLookback lookback(ScanSpan<const int>(raw, N), 4, 1000);
+    lookback.getExclusiveScan(out.data());
+    ok = ok && out == exclusive;
+    if (!ok) {
+        cout << "FAILED span scans" << endl;
+        return false;
+    }
+
+    // in place, once per engine
+    vector<int> data(raw, raw + N);
+    SumSchwartz schwartz(data);
+    schwartz.getScan(data.data());
+    ok = ok && data == inclusive;
+    data.assign(raw, raw + N);
+    SumHeap in_heap(data, 4);
+    in_heap.getExclusiveScan(data.begin());
+    ok = ok && data == exclusive;
+    data.assign(raw, raw + N);
+    GeneralScanPolicy<SumPolicy> in_policy(data, 4);
+    in_policy.getExclusiveScan(data.data());
+    ok = ok && data == exclusive;
+    data.assign(raw, raw + N);
+    SumLookback in_lookback(data, 4, 1000);
+    in_lookback.getScan(data.data());
+    ok = ok && data == inclusive;
+    delete[] raw;
+    return ok;
+}
+
+bool test_segmented() {
+    using namespace std;
+    const int N = 1 << 20;
+    vector<int> data(N), offsets;
+    vector<unsigned char> heads(N, 0);
+    for (int i = 0; i < N; i += 1 + rand() % 8) {  // lots of tiny segments
+        offsets.push_back(i);
+        heads[i] = 1;
+    }
+    for (int i = 0; i < N; i++)
+        data[i] = rand() % 100;
+    vector<int> expected(N), exclusive(N);
+    for (int i = 0; i < N; i++) {
+        exclusive[i] = heads[i] ? 0 : expected[i - 1];
+        expected[i] = exclusive[i] + data[i];
+    }
+
+    vector<int> prefix(N);
+    auto start = chrono::steady_clock::now();
+    GeneralScanSegmented<SumPolicy> flagged(data, heads, 4);
+    flagged.getScan(&prefix);
+    auto end = chrono::steady_clock::now();
+    if (prefix != expected) {
+        cout << "FAILED segmented scan with head flags" << endl;
+        return false;
+    }
+    cout << offsets.size() << " segments, one segmented scan: "
+         << chrono::duration<double, milli>(end - start).count() << "ms" << endl;
+
+    GeneralScanSegmented<SumPolicy> offset(data, offsets, 3);
+    offset.getExclusiveScan(&prefix);
+    if (prefix != exclusive) {
+        cout << "FAILED segmented exclusive scan with offsets" << endl;
+        return false;
+    }
+
+    // the old way: a scanner per segment
+    start = chrono::steady_clock::now();
+    for (size_t s = 0; s < offsets.size(); s++) {
+        int first = offsets[s], last = s + 1 < offsets.size() ? offsets[s + 1] : N;
+        SumHeap heap(ScanSpan<const int>(data.data() + first, last - first), 1);
+        heap.getScan(prefix.data() + first);
+    }
+    end = chrono::steady_clock::now();
+    cout << offsets.size() << " segments, scanner per segment: "
+         << chrono::duration<double, milli>(end - start).count() << "ms" << endl;
+    return prefix == expected;
+}
+
+bool test_stream() {
+    using namespace std;
+    const int N = 1 << 22;
+    vector<int> data(N);
+    for (int i = 0; i < N; i++)
+        data[i] = rand() % 100;
+    vector<int> expected(N);
+    GeneralScanPolicy<SumPolicy> full(&data);
+    full.getScan(&expected);
+
+    // batches of every size from one element to larger than the parallel threshold
+    GeneralScanStream<SumPolicy> stream(4);
+    vector<int> prefix;
+    for (int i = 0, batch = 1; i < N; i += batch, batch = 1 + rand() % 100000)
+        stream.append(ScanSpan<const int>(data.data() + i, min(batch, N - i)), &prefix);
+    if (prefix != expected || stream.getReduction() != full.getReduction()) {
+        cout << "FAILED stream of batches" << endl;
+        return false;
+    }
+
+    // appending 1000 more elements vs rescanning everything
+    vector<int> more(1000, 1);
+    auto start = chrono::steady_clock::now();
+    stream.append(more, &prefix);
+    auto end = chrono::steady_clock::now();
+    cout << "append 1000 to " << N << ": " << chrono::duration<double, micro>(end - start).count() << "us" << endl;
+    data.insert(data.end(), more.begin(), more.end());
+    expected.resize(data.size());
+    GeneralScanPolicy<SumPolicy> rebuilt(&data);
+    cout << "rescan " << data.size() << ": " << time_scan(rebuilt, &expected) << "ms" << endl;
+    return prefix == expected && stream.size() == (long long) data.size();
+}
+
+bool test_note_store() {
+    using namespace std;
+    const int N = 1 << 20;
+    NoteStore notes;
+    notes.reserve(N);
+    for (int i = 0; i < N; i++) {
+        uint32_t onTick = rand() % 10000, offTick = onTick + 1 + rand() % 100;
+        notes.add(onTick * 0.01, offTick * 0.01, i % 128, 100, 1 + i % 16, i % 40, onTick, offTick);
+    }
+    NoteStore added = notes;  // the sort must match a serial stable sort
+    vector<int> order(N);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&added](int a, int b) { return added.onset[a] < added.onset[b]; });
+
+    auto start = chrono::steady_clock::now();
+    notes.sortByOnset();
+    auto end = chrono::steady_clock::now();
+    cout << "sort " << N << " notes: " << chrono::duration<double, milli>(end - start).count() << "ms" << endl;
+    for (int i = 0; i < N; i++)
+        if (notes.onset[i] != added.onset[order[i]] || notes.pitch[i] != added.pitch[order[i]]
+                || notes.offsetTick[i] != added.offsetTick[order[i]]
+                || notes.track[i] != added.track[order[i]] || notes.channel[i] != added.channel[order[i]]) {
+            cout << "FAILED note store order at " << i << endl;
+            return false;
+        }
+
+    // columns go straight into the scans, e.g. the time the sound has lasted until, so far
+    vector<double> until(N);
+    GeneralScanPolicy<MaxPolicy<double>> lastEnd(notes.offset);
+    lastEnd.getScan(&until);
+    double check = 0.0;
+    for (int i = 0; i < N; i++) {
+        check = max(check, notes.offset[i]);
+        if (until[i] != check) {
+            cout << "FAILED scan of the offset column at " << i << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_note_histo_scan() {
+    using namespace std;
+    const int N = 1 << 20;
+    NoteStore notes;
+    notes.reserve(N);
+    for (int i = 0; i < N; i++) {
+        uint32_t onTick = rand() % 200000, offTick = onTick + 1 + rand() % 400;
+        notes.add(onTick * 0.005, offTick * 0.005, 21 + rand() % 88, 100, 1 + i % 16, i % 40, onTick, offTick);
+    }
+    notes.sortByOnset();
+
+    HeatmapList serial, parallel;
+    auto start = chrono::steady_clock::now();
+    sweepHeatmap(notes, serial);
+    auto end = chrono::steady_clock::now();
+    double sweepMs = chrono::duration<double, milli>(end - start).count();
+    int workers = WorkStealingPool::shared().size();  // the scans only gain with more than two
+    start = chrono::steady_clock::now();
+    scanHeatmap(notes, parallel);
+    end = chrono::steady_clock::now();
+    double scanMs = chrono::duration<double, milli>(end - start).count();
+    cout << "heatmap of " << N << " notes, " << serial.size() << " frames: sweep " << sweepMs << "ms, scan "
+         << scanMs << "ms (speedup " << sweepMs / scanMs << " on " << workers << " workers)" << endl;
+    if (parallel.timestamps != serial.timestamps || parallel.offsets != serial.offsets
+            || parallel.splits != serial.splits || parallel.events != serial.events) {
+        cout << "FAILED parallel heatmap differs from the sweep" << endl;
+        return false;
+    }
+    vector<uint32_t> ticks(notes.onsetTick);  // one frame per distinct tick
+    ticks.insert(ticks.end(), notes.offsetTick.begin(), notes.offsetTick.end());
+    sort(ticks.begin(), ticks.end());
+    if (serial.size() != unique(ticks.begin(), ticks.end()) - ticks.begin()) {
+        cout << "FAILED heatmap has " << serial.size() << " frames" << endl;
+        return false;
+    }
+
+    // the active-note counts at every frame, against replaying the frames one by one
+    vector<NoteEvent> events = getNoteEvents(notes);
+    vector<NoteHisto> counts(serial.size());
+    start = chrono::steady_clock::now();
+    NoteHistoScan scanner(events);
+    scanner.getScan(&counts);
+    end = chrono::steady_clock::now();
+    double countMs = chrono::duration<double, milli>(end - start).count();
+    vector<NoteHisto> replay(serial.size());
+    start = chrono::steady_clock::now();
+    NoteHisto sounding;
+    for (int f = 0; f < serial.size(); f++) {
+        HeatmapFrame frame = serial.frame(f);
+        for (uint8_t note : frame.additions)
+            sounding.bucket[note]++;
+        for (uint8_t note : frame.subtractions)
+            sounding.bucket[note]--;
+        replay[f] = sounding;
+    }
+    end = chrono::steady_clock::now();
+    double replayMs = chrono::duration<double, milli>(end - start).count();
+    cout << "active-note counts: serial " << replayMs << "ms, NoteHistoScan " << countMs << "ms (speedup "
+         << replayMs / countMs << " on " << workers << " workers)" << endl;
+    if (scanner.numFrames() != serial.size()) {
+        cout << "FAILED NoteHistoScan found " << scanner.numFrames() << " frames" << endl;
+        return false;
+    }
+    for (int f = 0; f < serial.size(); f++)
+        if (!equal(counts[f].bucket, counts[f].bucket + NoteHisto::N, replay[f].bucket)
+                || scanner.timestamp(f) != serial.timestamp(f)) {
+            cout << "FAILED NoteHistoScan counts at frame " << f << endl;
+            return false;
+        }
+    NoteHisto last = scanner.getReduction();
+    for (int count : last.bucket)
+        if (count != 0) {
+            cout << "FAILED notes still sounding at the end" << endl;
+            return false;
+        }
+
+    // fewer frames than the engine can split
+    vector<NoteEvent> chord = {{1.0, 1, 60, 1}, {1.0, 1, 64, 1}};
+    NoteHistoScan one(chord);
+    vector<NoteHisto> oneCount(1);
+    one.getScan(&oneCount);
+    NoteHistoScan none(vector<NoteEvent>{});
+    if (one.numFrames() != 1 || oneCount[0].bucket[60] != 1 || oneCount[0].bucket[64] != 1
+            || none.numFrames() != 0) {
+        cout << "FAILED NoteHistoScan with under two frames" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool test_radix_sort() {
+    using namespace std;
+    const int N = 1 << 22;
+    vector<uint64_t> keys(N);
+    vector<int> values(N);
+    for (int i = 0; i < N; i++) {
+        keys[i] = ((uint64_t) rand() << 8 | rand() % 256) % 3000000;  // plenty of ties
+        values[i] = i;
+    }
+    vector<pair<uint64_t, int>> expected(N);
+    for (int i = 0; i < N; i++)
+        expected[i] = make_pair(keys[i], values[i]);
+    auto start = chrono::steady_clock::now();
+    stable_sort(expected.begin(), expected.end(),
+                [](const pair<uint64_t, int> &a, const pair<uint64_t, int> &b) { return a.first < b.first; });
+    auto end = chrono::steady_clock::now();
+    double stableMs = chrono::duration<double, milli>(end - start).count();
+    start = chrono::steady_clock::now();
+    parallelRadixSort(keys, values);
+    end = chrono::steady_clock::now();
+    double radixMs = chrono::duration<double, milli>(end - start).count();
+    cout << "sort " << N << " keys: stable_sort " << stableMs << "ms, radix " << radixMs << "ms" << endl;
+    for (int i = 0; i < N; i++)
+        if (keys[i] != expected[i].first || values[i] != expected[i].second) {
+            cout << "FAILED radix sort at " << i << endl;
+            return false;
+        }
+    return true;
+}
+
+/**
+ * Helpers for building MIDI files in memory: a chunk header, a variable-length quantity, and
+ * a format 1 file from its track chunks' bytes.
+ */
+static void appendChunkHeader(std::vector<uint8_t> &file, const char *tag, uint32_t length) {
+    file.insert(file.end(), tag, tag + 4);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        file.push_back((uint8_t) (length >> shift));
+}
+
+static void appendVarLength(std::vector<uint8_t> &track, uint32_t value) {
+    uint8_t bytes[4];
+    int n = 0;
+    do {
+        bytes[n++] = value & 0x7f;
+        value >>= 7;
+    } while (value != 0);
+    while (n > 1)
+        track.push_back(bytes[--n] | 0x80);
+    track.push_back(bytes[0]);
+}
+
+static std::vector<uint8_t> makeMidiFile(const std::vector<std::vector<uint8_t>> &tracks, int division) {
+    std::vector<uint8_t> file;
+    appendChunkHeader(file, "MThd", 6);
+    uint8_t header[] = {0, 1, (uint8_t) (tracks.size() >> 8), (uint8_t) tracks.size(),
+                        (uint8_t) (division >> 8), (uint8_t) division};
+    file.insert(file.end(), header, header + 6);
+    for (auto &track : tracks) {
+        appendChunkHeader(file, "MTrk", (uint32_t) track.size());
+        file.insert(file.end(), track.begin(), track.end());
+    }
+    return file;
+}
+
+bool test_smf_reader() {
+    using namespace std;
+    // track 0: tempo changes; track 1: running status, velocity 0 note-offs, a restarted note,
+    // a sysex, and notes that never end
+    vector<uint8_t> tempo = {0, 0xff, 0x51, 3, 0x07, 0xa1, 0x20};  // 500000us per quarter at 0
+    appendVarLength(tempo, 480);
+    uint8_t faster[] = {0xff, 0x51, 3, 0x03, 0xd0, 0x90, 0, 0xff, 0x2f, 0};  // 250000us at 480
+    tempo.insert(tempo.end(), faster, faster + sizeof(faster));
+    vector<uint8_t> notes = {0, 0x90, 60, 100, 0, 64, 90, 50, 0x91, 70, 80, 50, 0x90, 67, 70,
+                             50, 0xf0, 2, 0x7e, 0xf7, 50, 0x90, 67, 71, 100, 0x80, 67, 0, 100, 0x90, 72, 1, 0, 72, 0};
+    appendVarLength(notes, 80);
+    uint8_t rest[] = {0x90, 60, 0, 0x83, 0x60, 0x80, 64, 0, 0, 0xff, 0x2f, 0};  // 60 ends at 480, 64 at 960
+    notes.insert(notes.end(), rest, rest + sizeof(rest));
+    vector<uint8_t> file = makeMidiFile({tempo, notes}, 480);
+
+    SmfReader reader(file.data(), file.size());
+    NoteStore store = reader.readNotes();
+    // onset tick, offset tick, pitch, velocity, channel
+    uint32_t expected[][5] = {{0, 480, 60, 100, 1}, {0, 960, 64, 90, 1}, {100, 200, 67, 70, 1}, {200, 300, 67, 71, 1}};
+    auto seconds = [](uint32_t tick) { return tick < 480 ? tick / 960.0 : 0.5 + (tick - 480) / 1920.0; };
+    if (reader.getNumTracks() != 2 || reader.getTimeFormat() != 480 || store.size() != 4) {
+        cout << "FAILED reading the MIDI file header or notes: " << store.size() << " notes" << endl;
+        return false;
+    }
+    for (int i = 0; i < 4; i++)
+        if (store.onsetTick[i] != expected[i][0] || store.offsetTick[i] != expected[i][1]
+                || store.pitch[i] != expected[i][2] || store.velocity[i] != expected[i][3]
+                || store.channel[i] != expected[i][4] || store.track[i] != 1
+                || abs(store.onset[i] - seconds(expected[i][0])) > 1e-12
+                || abs(store.offset[i] - seconds(expected[i][1])) > 1e-12) {
+            cout << "FAILED MIDI file note " << i << endl;
+            return false;
+        }
+    bool threw = false;
+    try {
+        SmfReader notMidi(notes.data(), notes.size());
+    } catch (const invalid_argument &) {
+        threw = true;
+    }
+    if (!threw) {
+        cout << "FAILED reading a file that isn't MIDI" << endl;
+        return false;
+    }
+
+    // 16 tracks of 64k notes, chords of 4 with running status
+    const int TRACKS = 16, NOTES = 1 << 16;
+    vector<vector<uint8_t>> tracks(TRACKS);
+    for (int t = 0; t < TRACKS; t++) {
+        auto &track = tracks[t];
+        track.push_back(0);
+        track.push_back((uint8_t) (0x90 | t));
+        for (int i = 0; i < NOTES; i += 4) {
+            for (int k = 0; k < 4; k++) {
+                if (k > 0)
+                    track.push_back(0);
+                track.push_back((uint8_t) (36 + (i + k * 7) % 60));
+                track.push_back(100);
+            }
+            for (int k = 0; k < 4; k++) {
+                appendVarLength(track, k == 0 ? 1 + i % 300 : 0);
+                track.push_back((uint8_t) (36 + (i + k * 7) % 60));
+                track.push_back(0);
+            }
+            track.push_back(0);
+        }
+        track.pop_back();
+        uint8_t end[] = {0, 0xff, 0x2f, 0};
+        track.insert(track.end(), end, end + sizeof(end));
+    }
+    file = makeMidiFile(tracks, 96);
+    auto start = chrono::steady_clock::now();
+    store = SmfReader(file.data(), file.size()).readNotes();
+    auto end = chrono::steady_clock::now();
+    double ms = chrono::duration<double, milli>(end - start).count();
+    cout << "read " << store.size() << " notes from " << file.size() / 1e6 << "MB of MIDI file: " << ms << "ms ("
+         << store.size() / (ms / 1000) << " notes/s)" << endl;
+    if (store.size() != TRACKS * NOTES) {
+        cout << "FAILED large MIDI file has " << store.size() << " notes" << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * A format 1 MIDI file of random notes: every track plays on channels of its own, each
+ * (channel, note number) one note at a time, with some notes starting on the tick another ends.
+ */
+static std::vector<uint8_t> makeRandomMidiFile(int numTracks, int notesPerTrack, int division) {
+    struct Event {
+        uint32_t tick;
+        int on, channel, noteNumber;
+    };
+    std::vector<std::vector<uint8_t>> tracks(numTracks);
+    for (int t = 0; t < numTracks; t++) {
+        std::vector<Event> events;
+        std::vector<uint32_t> busyUntil(4 * 128, 0);
+        for (int i = 0; i < notesPerTrack; i++) {
+            int channel = (t * 4 + rand() % 4) % 16, noteNumber = 36 + rand() % 48;
+            uint32_t &busy = busyUntil[(channel % 4) * 128 + noteNumber];
+            uint32_t onTick = std::max(busy, (uint32_t) (rand() % (notesPerTrack * 4)));
+            busy = onTick + 1 + rand() % 200;
+            events.push_back({onTick, 1, channel, noteNumber});
+            events.push_back({busy, 0, channel, noteNumber});
+        }
+        std::stable_sort(events.begin(), events.end(), [](const Event &a, const Event &b) {
+            return a.tick != b.tick ? a.tick < b.tick : a.on < b.on;  // note-offs first
+        });
+        auto &track = tracks[t];
+        uint32_t tick = 0;
+        for (const Event &event : events) {
+            appendVarLength(track, event.tick - tick);
+            tick = event.tick;
+            bool asNoteOn = event.on || rand() % 2;  // half the note-offs as velocity 0 note-ons
+            track.push_back((uint8_t) ((asNoteOn ? 0x90 : 0x80) | event.channel));
+            track.push_back((uint8_t) event.noteNumber);
+            track.push_back((uint8_t) (event.on ? 1 + rand() % 127 : 0));
+        }
+        uint8_t end[] = {0, 0xff, 0x2f, 0};
+        track.insert(track.end(), end, end + sizeof(end));
+    }
+    return makeMidiFile(tracks, division);
+}
+
+/**
+ * Check the per-channel NoteHisto example (getChannelNoteHistos) on a NoteMap read from a MIDI
+ * file against counting each channel's notes one event at a time.
+ * @return  if the counts matched
+ */
+bool test_channel_note_histos() {
+    using namespace std;
+    vector<uint8_t> file = makeRandomMidiFile(4, 1 << 13, 96);
+    MemoryInputStream in(file.data(), file.size(), false);
+    MidiFile midiFile;
+    if (!midiFile.readFrom(in)) {
+        cout << "FAILED reading the MIDI file" << endl;
+        return false;
+    }
+    NoteMap noteMap = getNoteMap(midiFile);
+
+    vector<NoteEvent> events;
+    auto start = chrono::steady_clock::now();
+    vector<NoteHisto> histos = getChannelNoteHistos(noteMap, events);
+    auto end = chrono::steady_clock::now();
+    if (events.size() != 2 * noteMap.size() || histos.size() != events.size()) {
+        cout << "FAILED per-channel counts: " << events.size() << " events for " << noteMap.size() << " notes"
+             << endl;
+        return false;
+    }
+
+    // the events one at a time, a NoteHisto per channel
+    vector<NoteHisto> counts(17);
+    int channels = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        const NoteEvent &event = events[i];
+        if (i == 0 || event.channel != events[i - 1].channel) {
+            if (i > 0 && event.channel < events[i - 1].channel) {
+                cout << "FAILED per-channel events out of channel order at " << i << endl;
+                return false;
+            }
+            channels++;
+        } else if (event.timestamp < events[i - 1].timestamp) {
+            cout << "FAILED per-channel events out of time order at " << i << endl;
+            return false;
+        }
+        int &count = counts[event.channel].bucket[event.noteNumber];
+        count += event.delta;
+        if (count < 0 || !equal(histos[i].bucket, histos[i].bucket + NoteHisto::N, counts[event.channel].bucket)) {
+            cout << "FAILED per-channel counts at event " << i << " (channel " << event.channel << ")" << endl;
+            return false;
+        }
+    }
+    for (const NoteHisto &count : counts)
+        if (count_if(count.bucket, count.bucket + NoteHisto::N, [](int c) { return c != 0; }) > 0) {
+            cout << "FAILED per-channel counts: notes still sounding at the end" << endl;
+            return false;
+        }
+
+    // the starts alone never balance out, so each channel has to count from zero again
+    vector<NoteEvent> starts;
+    copy_if(events.begin(), events.end(), back_inserter(starts), [](const NoteEvent &e) { return e.delta > 0; });
+    vector<unsigned char> heads = sortByChannel(starts);
+    histos = scanChannelNoteHistos(starts, heads);
+    counts.assign(17, NoteHisto());
+    for (size_t i = 0; i < starts.size(); i++) {
+        NoteHisto &count = counts[starts[i].channel];
+        count.bucket[starts[i].noteNumber]++;
+        if (!equal(histos[i].bucket, histos[i].bucket + NoteHisto::N, count.bucket)) {
+            cout << "FAILED per-channel note starts at event " << i << endl;
+            return false;
+        }
+    }
+    cout << noteMap.size() << " notes on " << channels << " channels, per-channel counts: "
+         << chrono::duration<double, milli>(end - start).count() << "ms" << endl;
+    return channels == 16;
+}
+
+/**
+ * Check getNoteStore against SmfReader on the same file, and that the MidiFile can be read again
+ * afterwards, by getNoteStore or getNoteMap.
+ * @return  if the notes matched
+ */
+bool test_midi_file_notes() {
+    using namespace std;
+    vector<uint8_t> file = makeRandomMidiFile(4, 1 << 12, 96);
+    MemoryInputStream in(file.data(), file.size(), false);
+    MidiFile midiFile;
+    if (!midiFile.readFrom(in)) {
+        cout << "FAILED reading the MIDI file" << endl;
+        return false;
+    }
+    NoteStore expected = SmfReader(file.data(), file.size()).readNotes();
+    auto same = [&expected](const NoteStore &notes) {
+        if (notes.size() != expected.size())
+            return false;
+        for (int i = 0; i < notes.size(); i++)
+            if (notes.onsetTick[i] != expected.onsetTick[i] || notes.offsetTick[i] != expected.offsetTick[i]
+                    || abs(notes.onset[i] - expected.onset[i]) > 1e-9 || abs(notes.offset[i] - expected.offset[i]) > 1e-9
+                    || notes.pitch[i] != expected.pitch[i] || notes.velocity[i] != expected.velocity[i]
+                    || notes.channel[i] != expected.channel[i] || notes.track[i] != expected.track[i])
+                return false;
+        return true;
+    };
+    if (!same(getNoteStore(midiFile))) {
+        cout << "FAILED getNoteStore" << endl;
+        return false;
+    }
+    if (!same(getNoteStore(midiFile))) {
+        cout << "FAILED getNoteStore on a MidiFile read before" << endl;
+        return false;
+    }
+    NoteMap noteMap = getNoteMap(midiFile);
+    int i = 0;
+    for (auto &iter : noteMap)
+        if (abs(iter.first - expected.onset[i++]) > 1e-9) {
+            cout << "FAILED getNoteMap after getNoteStore at note " << i - 1 << endl;
+            return false;
+        }
+    return i == expected.size();
+}
+
+bool test_heatmap_keyframes() {
+    using namespace std;
+    const int N = 1 << 18;
+    NoteStore notes;
+    notes.reserve(N);
+    for (int i = 0; i < N; i++) {
+        uint32_t onTick = rand() % 100000, offTick = onTick + 1 + rand() % 400;
+        notes.add(onTick * 0.005, offTick * 0.005, 21 + rand() % 88, 100, 1 + i % 16, i % 40, onTick, offTick);
+    }
+    notes.sortByOnset();
+    HeatmapList heatmap;
+    sweepHeatmap(notes, heatmap);
+
+    auto start = chrono::steady_clock::now();
+    HeatmapKeyframes keyframes(heatmap);
+    auto end = chrono::steady_clock::now();
+    cout << "keyframes of " << heatmap.size() << " frames: " << keyframes.numKeyframes() << " in "
+         << chrono::duration<double, milli>(end - start).count() << "ms" << endl;
+
+    // the state before every frame, against replaying from the start, also with the keyframes
+    // read back
+    HeatmapKeyframes readBack(heatmap, &keyframes.keyframe(0));
+    NoteHisto sounding, state, stored;
+    for (int f = 0; f <= heatmap.size(); f++) {
+        keyframes.stateBefore(f, state);
+        readBack.stateBefore(f, stored);
+        if (!equal(state.bucket, state.bucket + NoteHisto::N, sounding.bucket)
+            || !equal(stored.bucket, stored.bucket + NoteHisto::N, sounding.bucket)) {
+            cout << "FAILED keyframe state before frame " << f << endl;
+            return false;
+        }
+        if (f < heatmap.size()) {
+            HeatmapFrame frame = heatmap.frame(f);
+            for (uint8_t note : frame.additions)
+                sounding.bucket[note]++;
+            for (uint8_t note : frame.subtractions)
+                sounding.bucket[note]--;
+        }
+    }
+
+    // seeking lands after the frames at or before the time
+    double last = heatmap.timestamp(heatmap.size() - 1);
+    double times[] = {-1.0, 0.0, heatmap.timestamp(1000), heatmap.timestamp(1000) + 1e-9, last / 2, last, last + 1};
+    for (double time : times) {
+        int f = keyframes.seek(time, state);
+        if ((f > 0 && heatmap.timestamp(f - 1) > time) || (f < heatmap.size() && heatmap.timestamp(f) <= time)) {
+            cout << "FAILED seek to " << time << " gave frame " << f << endl;
+            return false;
+        }
+    }
+    const int SEEKS = 10000;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < SEEKS; i++)
+        keyframes.seek(last * (rand() % 1000) / 1000, state);
+    end = chrono::steady_clock::now();
+    cout << "seek: " << chrono::duration<double, micro>(end - start).count() / SEEKS << "us" << endl;
+
+    HeatmapList empty;
+    HeatmapKeyframes none(empty);
+    if (none.seek(1.0, state) != 0 || state.bucket[60] != 0 || HeatmapKeyframes().seek(1.0, state) != 0) {
+        cout << "FAILED seek with no frames" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool test_affine_scan() {
+    using namespace std;
+    const int N = 1 << 20;
+    typedef AffineMap<double, 1> Affine;
+    vector<Affine> data(N);
+    for (int i = 0; i < N; i++) {
+        data[i].decay = exp(-0.01 * (rand() % 100));  // decay, then a velocity
+        data[i].heat[0] = rand() % 128;
+    }
+    vector<Affine> prefix(N);
+
+    // the same policy HeatmapDecay scans its frames with, on a single key
+    auto start = chrono::steady_clock::now();
+    GeneralScanPolicy<AffinePolicy<double, 1>> scanner(&data);
+    scanner.getScan(&prefix);
+    auto end = chrono::steady_clock::now();
+
+    double h = 0.0;
+    for (int i = 0; i < N; i++) {
+        h = data[i].decay * h + data[i].heat[0];
+        if (abs(prefix[i].heat[0] - h) > 1e-9 * max(1.0, h)) {
+            cout << "FAILED affine scan at " << i << ": h -> " << prefix[i].decay << " * h + " << prefix[i].heat[0]
+                 << ", expected " << h << endl;
+            return false;
+        }
+    }
+    Affine total = scanner.getReduction();
+    cout << "affine scan: h -> " << total.decay << " * h + " << total.heat[0] << " in "
+         << chrono::duration<double, milli>(end - start).count() << "ms" << endl;
+    return true;
+}
+
+bool test_heatmap_decay() {
+    using namespace std;
+    const int N = 1 << 16;
+    const double RATE = 3.0;
+    NoteStore notes;
+    notes.reserve(N);
+    for (int i = 0; i < N; i++) {
+        uint32_t onTick = rand() % 100000, offTick = onTick + 1 + rand() % 400;
+        notes.add(onTick * 0.005, offTick * 0.005, rand() % 128, 1 + rand() % 127, 1 + i % 16, i % 40, onTick,
+                  offTick);
+    }
+    notes.sortByOnset();
+    HeatmapList heatmap;
+    sweepHeatmap(notes, heatmap);
+
+    auto start = chrono::steady_clock::now();
+    HeatmapDecay decay(heatmap, notes, RATE);
+    auto end = chrono::steady_clock::now();
+    cout << "decaying heat of " << heatmap.size() << " frames in " << chrono::duration<double, milli>(end - start).count()
+         << "ms" << endl;
+
+    // every frame against integrating the notes one at a time
+    vector<double> heat(HeatmapDecay::N, 0.0);
+    double last = 0.0;
+    int n = 0;
+    for (int f = 0; f < heatmap.size(); f++) {
+        double t = heatmap.timestamp(f);
+        for (double &h : heat)
+            h *= exp(-RATE * (t - last));
+        last = t;
+        for (; n < notes.size() && notes.onset[n] <= t; n++)
+            heat[notes.pitch[n]] += notes.velocity[n];
+        float frame[HeatmapDecay::N];
+        decay.frameHeat(f, frame);
+        for (int k = 0; k < HeatmapDecay::N; k++)
+            if (abs(frame[k] - heat[k]) > 1e-3 * max(1.0, heat[k])) {
+                cout << "FAILED heat of key " << k << " at frame " << f << ": " << frame[k] << ", expected "
+                     << heat[k] << endl;
+                return false;
+            }
+    }
+
+    // between frames the heat keeps fading, the same when read back from the keyframes
+    float at[HeatmapDecay::N], frame[HeatmapDecay::N], stored[HeatmapDecay::N];
+    int f = heatmap.size() / 2;
+    double t = (heatmap.timestamp(f) + heatmap.timestamp(f + 1)) / 2;
+    decay.heatAt(t, at);
+    decay.frameHeat(f, frame);
+    HeatmapDecay readBack(heatmap, &decay.keyframe(0), decay.firstNotes(), notes.pitch.data(), notes.velocity.data(),
+                          RATE);
+    readBack.heatAt(t, stored);
+    for (int k = 0; k < HeatmapDecay::N; k++)
+        if (abs(at[k] - frame[k] * exp(-RATE * (t - heatmap.timestamp(f)))) > 1e-3 || stored[k] != at[k]) {
+            cout << "FAILED heat of key " << k << " at " << t << endl;
+            return false;
+        }
+    decay.heatAt(-1.0, at);
+    HeatmapList empty;
+    if (at[60] != 0.0f || HeatmapDecay(empty, NoteStore()).numFrames() != 0) {
+        cout << "FAILED heat before the first frame" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool test_spsc_ring() {
+    using namespace std;
+    const long long N = 1 << 20;
+    SpscRing<long long> ring(1000);
+    if (ring.capacity() != 1024) {
+        cout << "FAILED ring capacity " << ring.capacity() << endl;
+        return false;
+    }
+
+    // one thread pushes 0, 1, 2, ... as fast as it can; this one takes them, alternating
+    // between single pops and draining everything, and checks the order; either side yields
+    // when it can't go on, so the test also finishes on a single core
+    auto start = chrono::steady_clock::now();
+    thread producer([&] {
+        for (long long i = 0; i < N; i++)
+            while (!ring.tryPush(i))
+                this_thread::yield();
+    });
+    long long next = 0, item;
+    bool ordered = true;
+    while (next < N) {
+        if (next % 2 == 0 && ring.tryPop(item))
+            ordered = ordered && item == next++;
+        else if (ring.popAll([&](long long got) { ordered = ordered && got == next++; }) == 0)
+            this_thread::yield();
+    }
+    producer.join();
+    auto end = chrono::steady_clock::now();
+    if (!ordered || ring.tryPop(item) || ring.size() != 0) {
+        cout << "FAILED ring lost or reordered items" << endl;
+        return false;
+    }
+    cout << "spsc ring: " << N / chrono::duration<double>(end - start).count() << " items/s" << endl;
+    return true;
+}
+
+bool test_trace() {
+    using namespace std;
+    const int N = 1 << 20;
+    Trace::clear();
+
+    // spans cost only a flag check while the trace is off
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < N; i++)
+        TraceSpan span("off", "test");
+    auto end = chrono::steady_clock::now();
+    double offNs = chrono::duration<double, nano>(end - start).count() / N;
+    if (Trace::size() != 0) {
+        cout << "FAILED trace recorded while off" << endl;
+        return false;
+    }
+
+    // every worker records into its own buffer
+    WorkStealingPool pool(4);
+    Trace::start();
+    start = chrono::steady_clock::now();
+    pool.parallelFor(0, N, [](int) {
+        TraceSpan span("on", "test");
+    }, 64);
+    end = chrono::steady_clock::now();
+    Trace::counter("spans", N);
+    Trace::stop();
+    double onNs = chrono::duration<double, nano>(end - start).count() / N;
+    if (Trace::size() != (size_t) N + 1) {
+        cout << "FAILED trace has " << Trace::size() << " events, expected " << N + 1 << endl;
+        return false;
+    }
+
+    ostringstream json;
+    Trace::writeChromeJson(json);
+    string text = json.str();
+    if (text.compare(0, 39, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") != 0
+        || text.find("\"name\":\"spans\",\"cat\":\"counter\",\"ph\":\"C\"") == string::npos
+        || text.find("\"args\":{\"value\":1048576}") == string::npos || text.substr(text.size() - 4) != "\n]}\n") {
+        cout << "FAILED trace JSON" << endl;
+        return false;
+    }
+    Trace::clear();
+    cout << "trace: " << offNs << " ns per span off, " << onNs << " ns on (4 workers)" << endl;
+    return true;
+}
+
+/**
+ * Heap allocator that counts the allocations made through it, to set against an Arena's.
+ */
+template<typename T>
+struct CountingAllocator {
+    typedef T value_type;
+    size_t *count;
+
+    CountingAllocator(size_t *count) : count(count) {}
+
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U> &other) : count(other.count) {}
+
+    T *allocate(size_t n) {
+        ++*count;
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t) {
+        ::operator delete(p);
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const CountingAllocator<T> &a, const CountingAllocator<U> &b) {
+    return a.count == b.count;
+}
+
+template<typename T, typename U>
+bool operator!=(const CountingAllocator<T> &a, const CountingAllocator<U> &b) {
+    return a.count != b.count;
+}
+
+bool test_arena() {
+    using namespace std;
+    const int N = 1 << 20;
+    mt19937 rng(7);
+    uniform_int_distribution<int> key(0, N / 4);
+    vector<int> keys(N);
+    for (int &k : keys)
+        k = key(rng);
+
+    // the same inserts and erases on a heap multimap and on one in an arena, as scanNoteMap does
+    // with its pending note-offs, each timed on its own
+    typedef multimap<int, double, less<int>, CountingAllocator<pair<const int, double>>> HeapMap;
+    typedef multimap<int, double, less<int>, ArenaAllocator<pair<const int, double>>> ArenaMap;
+    size_t heapAllocations = 0;
+    HeapMap heapMap{HeapMap::allocator_type(&heapAllocations)};
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < N; i++) {
+        heapMap.insert({keys[i], i * 0.5});
+        if (i % 3 == 2)
+            heapMap.erase(heapMap.begin());
+    }
+    double heapMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    Arena arena;
+    ArenaMap arenaMap{ArenaMap::allocator_type(&arena)};
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < N; i++) {
+        arenaMap.insert({keys[i], i * 0.5});
+        if (i % 3 == 2)
+            arenaMap.erase(arenaMap.begin());
+    }
+    double arenaMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    size_t arenaAllocations = arena.getAllocations();
+    if (!equal(heapMap.begin(), heapMap.end(), arenaMap.begin(), arenaMap.end())) {
+        cout << "FAILED arena map differs from heap map" << endl;
+        return false;
+    }
+    if (heapAllocations != (size_t) N || arenaAllocations != (size_t) N) {
+        cout << "FAILED " << heapAllocations << " heap and " << arenaAllocations << " arena allocations, not " << N
+             << endl;
+        return false;
+    }
+
+    // a block given back is the next one handed out at its size
+    void *block = arena.allocate(48);
+    arena.deallocate(block, 48);
+    size_t reserved = arena.getReserved();
+    if (arena.allocate(40) != block) {
+        cout << "FAILED arena doesn't reuse blocks" << endl;
+        return false;
+    }
+    arenaMap.clear();
+    arena.release();
+    if (arena.getReserved() != 0) {
+        cout << "FAILED arena not released" << endl;
+        return false;
+    }
+    cout << "arena: " << N << " inserts, heap map " << heapMs << " ms (" << heapAllocations
+         << " heap allocations), arena map " << arenaMs << " ms (" << arenaAllocations << " arena allocations from "
+         << reserved / 1024 << " KB of chunks)" << endl;
+    return true;
+}
+
 //int main() {
 //    using namespace std;
 //    if (!test_histo())
@@ -457,5 +1568,45 @@ bool test_histo() {
 //        cout << "test_exam1 failed" << endl;
 //    if (!test_hw2())
 //        cout << "test_hw2 failed" << endl;
+//    if (!test_odd_sizes())
+//        cout << "test_odd_sizes failed" << endl;
+//    if (!test_pool_scaling())
+//        cout << "test_pool_scaling failed" << endl;
+//    if (!test_static_dispatch())
+//        cout << "test_static_dispatch failed" << endl;
+//    if (!test_simd_kernels())
+//        cout << "test_simd_kernels failed" << endl;
+//    if (!test_lookback())
+//        cout << "test_lookback failed" << endl;
+//    if (!test_spans())
+//        cout << "test_spans failed" << endl;
+//    if (!test_segmented())
+//        cout << "test_segmented failed" << endl;
+//    if (!test_stream())
+//        cout << "test_stream failed" << endl;
+//    if (!test_note_store())
+//        cout << "test_note_store failed" << endl;
+//    if (!test_note_histo_scan())
+//        cout << "test_note_histo_scan failed" << endl;
+//    if (!test_radix_sort())
+//        cout << "test_radix_sort failed" << endl;
+//    if (!test_smf_reader())
+//        cout << "test_smf_reader failed" << endl;
+//    if (!test_channel_note_histos())
+//        cout << "test_channel_note_histos failed" << endl;
+//    if (!test_midi_file_notes())
+//        cout << "test_midi_file_notes failed" << endl;
+//    if (!test_heatmap_keyframes())
+//        cout << "test_heatmap_keyframes failed" << endl;
+//    if (!test_affine_scan())
+//        cout << "test_affine_scan failed" << endl;
+//    if (!test_heatmap_decay())
+//        cout << "test_heatmap_decay failed" << endl;
+//    if (!test_spsc_ring())
+//        cout << "test_spsc_ring failed" << endl;
+//    if (!test_trace())
+//        cout << "test_trace failed" << endl;
+//    if (!test_arena())
+//        cout << "test_arena failed" << endl;
 //    return 0;
 //}